@@ -0,0 +1,178 @@
+#! /usr/bin/env python3
+"""
+Measures the effect of the access-pattern hints (utils.advise()), readahead
+(utils.copy_sequential()), huge page staging buffers (utils.alloc_staging()),
+and compression (frames.py) on reading a large split from disk. Evicts the
+split from the page cache before each cold measurement. Compression speeds up
+sequential copies but slows down random gathers, which is why
+prepare_data.py stores splits uncompressed unless run with "--compress".
+"""
+
+import argparse
+import os
+from os import path
+import time
+
+import numpy as np
+
+import defaults
+import frames
+import utils
+
+
+# The number of float64 columns in the synthetic split.
+NUM_COLS = 32
+
+
+def evict(flp):
+    """ Evicts the provided file from the page cache. """
+    fd = os.open(flp, os.O_RDONLY)
+    try:
+        os.fsync(fd)
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+    finally:
+        os.close(fd)
+
+
+def make_split(out_dir, size_B):
+    """
+    Creates a synthetic split of about size_B bytes in out_dir, if one does
+    not already exist, and returns its name.
+    """
+    name = f"bench_{size_B}"
+    dtype = np.dtype([(f"fet_{col}", "float64") for col in range(NUM_COLS)])
+    num_pkts = size_B // dtype.itemsize
+    flp = utils.get_split_data_flp(out_dir, name)
+    if path.exists(flp) and path.getsize(flp) == num_pkts * dtype.itemsize:
+        return name
+    print(f"Creating split: {flp}")
+    dat = np.memmap(flp, dtype=dtype, mode="w+", shape=(num_pkts,))
+    rng = np.random.default_rng(defaults.SEED)
+    chunk = 2**20
+    # Mimic the kinds of features in real splits: values from a small set
+    # (e.g., packet sizes and -1 for unknown), smoothly-varying values (e.g.,
+    # EWMAs), increasing counters (e.g., timestamps), and noise.
+    for srt in range(0, num_pkts, chunk):
+        end = min(srt + chunk, num_pkts)
+        num = end - srt
+        for col in range(NUM_COLS):
+            kind = col % 4
+            if kind == 0:
+                val = rng.choice([-1, 66, 1514], num, p=[0.1, 0.2, 0.7])
+            elif kind == 1:
+                val = np.round(np.cumsum(rng.normal(0, 0.01, num)), 3)
+            elif kind == 2:
+                val = srt * 100 + np.cumsum(rng.integers(0, 200, num))
+            else:
+                val = rng.random(num)
+            dat[f"fet_{col}"][srt:end] = val
+    dat.flush()
+    del dat
+    utils.save_split_metadata(out_dir, name, dat=(num_pkts, dtype.descr))
+    return name
+
+
+def timed(msg, func, size_B=None):
+    """ Runs func and prints its running time (and throughput). """
+    tim_srt_s = time.time()
+    ret = func()
+    tim_s = time.time() - tim_srt_s
+    print(
+        f"\t{msg}: {tim_s:.2f} seconds" +
+        (f" ({size_B / tim_s / 2**30:.2f} GB/s)" if size_B is not None else ""))
+    return tim_s, ret
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description="Measures the cost of reading a large split from disk.")
+    psr.add_argument(
+        "--dir", help="The directory in which to create the split (required).",
+        required=True, type=str)
+    psr.add_argument(
+        "--size-GB", default=4, help="The size of the split, in GB.",
+        required=False, type=float)
+    psr.add_argument(
+        "--gathers", default=2_000,
+        help="The number of rows to read during random gathers.",
+        required=False, type=int)
+    args = psr.parse_args()
+    if not path.exists(args.dir):
+        os.makedirs(args.dir)
+    name = make_split(args.dir, int(args.size_GB * 2**30))
+    flp = utils.get_split_data_flp(args.dir, name)
+    size_B = path.getsize(flp)
+    num_pkts, dtype = utils.load_split_metadata(args.dir, name)
+    print(f"Split: {flp} ({size_B / 2**30:.2f} GB)")
+
+    print("Copying the split into memory (cold cache):")
+    evict(flp)
+    base_s, _ = timed(
+        "Default paging, np.concatenate()",
+        lambda: np.concatenate([utils.load_split(args.dir, name)]), size_B)
+    evict(flp)
+    new_s, dat = timed(
+        "Sequential advice and readahead, huge page staging buffer",
+        lambda: utils.copy_sequential(
+            [utils.load_split(args.dir, name, access="sequential")],
+            utils.alloc_staging(num_pkts, dtype)),
+        size_B)
+    print(f"\tSpeedup: {base_s / new_s:.2f}x")
+
+    print("Scanning one column (cold cache):")
+    fet = "fet_0"
+    for access in [None, "sequential"]:
+        evict(flp)
+        timed(
+            f"Advice: {access}",
+            lambda: utils.load_split(args.dir, name, access)[fet].sum(),
+            size_B)
+
+    print(f"Gathering {args.gathers} random rows (cold cache):")
+    idxs = np.random.default_rng(defaults.SEED).integers(
+        0, num_pkts, args.gathers)
+    for access in [None, "random"]:
+        evict(flp)
+        timed(
+            f"Advice: {access}",
+            lambda: utils.load_split(args.dir, name, access)[idxs])
+
+    print("Compressing the split:")
+    zst_name = f"{name}_zst"
+    zst_flp = utils.get_split_frames_flp(args.dir, zst_name)
+    _, zst_B = timed(
+        "Compressing",
+        lambda: frames.write(zst_flp, utils.load_split(args.dir, name)),
+        size_B)
+    utils.save_split_metadata(args.dir, zst_name, dat=(num_pkts, dtype))
+    print(f"\tCompression ratio: {size_B / zst_B:.2f}x")
+    print("Copying the compressed split into memory (cold cache):")
+    evict(zst_flp)
+    zst_s, zst_dat = timed(
+        "Parallel decompression, huge page staging buffer",
+        lambda: utils.copy_sequential(
+            [utils.load_split(args.dir, zst_name)],
+            utils.alloc_staging(num_pkts, dtype)),
+        size_B)
+    assert (zst_dat == dat).all(), "Decompressed split does not match!"
+    del zst_dat
+    print(f"\tSpeedup over uncompressed default paging: {base_s / zst_s:.2f}x")
+    print(f"Gathering {args.gathers} random rows (compressed, cold cache):")
+    idxs = np.random.default_rng(defaults.SEED).integers(
+        0, num_pkts, args.gathers)
+    evict(zst_flp)
+    timed(
+        "Decompressing touched frames",
+        lambda: utils.load_split(args.dir, zst_name)[idxs])
+
+    print(f"Gathering {num_pkts} random rows from memory:")
+    idxs = np.random.default_rng(defaults.SEED).permutation(num_pkts)
+    regular = np.empty_like(dat)
+    regular[:] = dat
+    timed("Regular pages", lambda: regular[idxs])
+    timed("Huge page staging buffer", lambda: dat[idxs])
+
+
+if __name__ == "__main__":
+    main()
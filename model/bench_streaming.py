@@ -0,0 +1,122 @@
+#! /usr/bin/env python3
+"""
+Measures the per-packet cost of the streaming estimators in streaming.py that
+gen_features.py updates for every packet, using a synthetic flow whose arrival
+rate follows an 8-RTT cycle (like BBR's probing).
+"""
+
+import argparse
+import time
+
+import numpy as np
+
+import defaults
+import features
+import numa
+import streaming
+
+
+def make_flow(num_pkts, min_rtt_us, seed):
+    """
+    Returns the arrival times (us), interarrival times (us), RTTs (us), and
+    sizes (bytes) of the packets in a synthetic flow.
+    """
+    rng = np.random.default_rng(seed)
+    # Send 25% faster for one RTT out of every eight.
+    interarrs_us = np.empty((num_pkts,), dtype=np.int64)
+    time_us = 0
+    for idx in range(num_pkts):
+        fast = (time_us // min_rtt_us) % 8 == 0
+        interarrs_us[idx] = max(
+            1, int(rng.exponential(80 if fast else 100)))
+        time_us += interarrs_us[idx]
+    arr_times_us = np.cumsum(interarrs_us)
+    rtts_us = min_rtt_us + rng.integers(0, min_rtt_us // 4, num_pkts)
+    sizes_B = np.full((num_pkts,), 1514)
+    return (
+        arr_times_us.tolist(), interarrs_us.tolist(), rtts_us.tolist(),
+        sizes_B.tolist())
+
+
+def bench(name, update, pkts):
+    """
+    Calls update once per packet and prints the average time per packet.
+    """
+    tim_srt_s = time.time()
+    for pkt in pkts:
+        update(*pkt)
+    tim_s = time.time() - tim_srt_s
+    print(f"{name}: {tim_s * 1e6 / len(pkts):.2f} us per packet")
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description=(
+            "Measures the per-packet cost of the streaming feature "
+            "estimators."))
+    psr.add_argument(
+        "--packets", default=200_000, help="The number of packets.",
+        required=False, type=int)
+    psr.add_argument(
+        "--min-rtt-us", default=10_000, help="The flow's min RTT (us).",
+        required=False, type=int)
+    psr.add_argument(
+        "--window", default=8,
+        help="The window duration to use, in multiples of the min RTT.",
+        required=False, type=int)
+    args = psr.parse_args()
+    min_rtt_us = args.min_rtt_us
+    win_us = args.window * min_rtt_us
+    arr_times_us, interarrs_us, rtts_us, sizes_B = make_flow(
+        args.packets, min_rtt_us, seed=defaults.SEED)
+    print(f"Packets: {args.packets}, min RTT: {min_rtt_us} us, window: "
+          f"{args.window} min RTTs")
+
+    numastat = numa.read_numastat()
+    min_filter = streaming.WindowedMin(win_us)
+    bench(
+        "WindowedMin",
+        min_filter.update, list(zip(arr_times_us, rtts_us)))
+
+    quantiles = streaming.SlidingQuantiles(
+        defaults.QUANTILE_SLOTS, defaults.QUANTILE_SKETCH_K)
+
+    def update_quantiles(time_us, val):
+        quantiles.update(time_us, val, win_us)
+        quantiles.quantile(0.9)
+
+    bench(
+        "SlidingQuantiles",
+        update_quantiles, list(zip(arr_times_us, rtts_us)))
+
+    hist = streaming.LogHistogram(features.HIST_BKTS)
+    bench(
+        "LogHistogram",
+        lambda time_us, val: hist.update(time_us, val, win_us),
+        list(zip(arr_times_us, interarrs_us)))
+
+    bin_us = defaults.SPECTRUM_BIN_RTTS * min_rtt_us
+    spectrum = streaming.SlidingDft(
+        defaults.SPECTRUM_BINS,
+        [round(defaults.SPECTRUM_BINS * defaults.SPECTRUM_BIN_RTTS / period)
+         for period in features.SPECTRUM_PERIODS])
+
+    def update_spectrum(time_us, val):
+        spectrum.update(time_us, val, bin_us)
+        return spectrum.powers()
+
+    bench(
+        "SlidingDft",
+        update_spectrum, list(zip(arr_times_us, sizes_B)))
+    print(
+        "Spectral power at the end of the flow: " +
+        ", ".join(
+            f"period {period} min RTTs: {power:.3f}"
+            for period, power in zip(
+                features.SPECTRUM_PERIODS, spectrum.powers())))
+    numa.report(numastat)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,412 @@
+#! /usr/bin/env python3
+"""
+Captures packets from a network interface for online feature generation,
+without going through tcpdump and a pcap file.
+
+A Ring reads packets from a Linux AF_PACKET socket using a memory-mapped
+TPACKET_V3 receive ring. The kernel fills whole blocks of packets, and each
+block is handed to the consumer as a batch of memoryviews into the ring, so
+packets are never copied or re-encoded. Multiple Rings can join a fanout
+group, in which case the kernel spreads flows across them (e.g., one Ring per
+worker thread). Requires CAP_NET_RAW.
+"""
+
+import argparse
+import collections
+import concurrent.futures
+import contextlib
+import io
+import json
+import math
+import mmap
+import os
+from os import path
+import select
+import socket
+import struct
+import tarfile
+import threading
+import time
+
+import defaults
+import parse_utils
+
+
+# From linux/if_ether.h and linux/if_packet.h.
+ETH_P_ALL = 0x0003
+SOL_PACKET = 263
+PACKET_RX_RING = 5
+PACKET_VERSION = 10
+PACKET_FANOUT = 18
+TPACKET_V3 = 2
+PACKET_FANOUT_HASH = 0
+TP_STATUS_KERNEL = 0
+TP_STATUS_USER = 1
+# struct tpacket_req3: block size, number of blocks, frame size, number of
+# frames, block retire timeout (ms), private area size, feature request word.
+TPACKET_REQ3_FMT = "IIIIIII"
+# The parts of struct tpacket_block_desc that we use: block status, number of
+# packets, offset of the first packet.
+BLOCK_STATUS_OFF = 8
+BLOCK_HDR_FMT = "III"
+# The parts of struct tpacket3_hdr that we use: offset of the next packet,
+# seconds, nanoseconds, captured length, wire length, status, offset of the MAC
+# header.
+PKT_HDR_FMT = "IIIIIIH"
+
+class Ring:
+    """ An AF_PACKET socket with a memory-mapped TPACKET_V3 receive ring. """
+
+    def __init__(self, iface, block_size=1 << 22, num_blocks=64,
+                 frame_size=1 << 11, timeout_ms=10, fanout_group=None):
+        """
+        iface: The interface to capture from.
+        block_size: The size of each block, which must be a multiple of the
+            page size.
+        num_blocks: The number of blocks in the ring.
+        frame_size: The minimum space reserved per packet. With TPACKET_V3,
+            packets are packed into blocks regardless of this value.
+        timeout_ms: The kernel hands a partially full block to user space
+            after this much time.
+        fanout_group: If not None, then this Ring joins the fanout group with
+            this ID, which spreads packets across the group's Rings by flow.
+        """
+        assert block_size % mmap.PAGESIZE == 0, \
+            (f"Block size ({block_size}) must be a multiple of the page size "
+             f"({mmap.PAGESIZE})!")
+        assert block_size % frame_size == 0, \
+            (f"Block size ({block_size}) must be a multiple of the frame size "
+             f"({frame_size})!")
+        self.block_size = block_size
+        self.num_blocks = num_blocks
+        self.sock = socket.socket(
+            socket.AF_PACKET, socket.SOCK_RAW, socket.htons(ETH_P_ALL))
+        try:
+            self.sock.setsockopt(SOL_PACKET, PACKET_VERSION, TPACKET_V3)
+            self.sock.setsockopt(
+                SOL_PACKET, PACKET_RX_RING, struct.pack(
+                    TPACKET_REQ3_FMT, block_size, num_blocks, frame_size,
+                    block_size // frame_size * num_blocks, timeout_ms, 0, 0))
+            self.sock.bind((iface, ETH_P_ALL))
+            if fanout_group is not None:
+                self.sock.setsockopt(
+                    SOL_PACKET, PACKET_FANOUT,
+                    (fanout_group & 0xffff) | (PACKET_FANOUT_HASH << 16))
+            self.ring = mmap.mmap(
+                self.sock.fileno(), block_size * num_blocks,
+                mmap.MAP_SHARED, mmap.PROT_READ | mmap.PROT_WRITE)
+        except OSError:
+            self.sock.close()
+            raise
+        self.buf = memoryview(self.ring)
+        self.poller = select.poll()
+        self.poller.register(
+            self.sock.fileno(), select.POLLIN | select.POLLERR)
+        # The index of the next block to read.
+        self.blk_idx = 0
+
+    def close(self):
+        """ Releases the ring and closes the socket. """
+        self.buf.release()
+        self.ring.close()
+        self.sock.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def blocks(self, timeout_ms=100, stop=None):
+        """
+        A generator that yields each block of packets that the kernel fills,
+        as a list of (packet bytes, parse_utils.PktMdat) tuples, which can be
+        passed to parse_utils.decode_packets(). The packet bytes are
+        memoryviews into the ring. They are only valid until the generator is
+        resumed, at which point the block is returned to the kernel. Returns
+        when stop (a threading.Event) is set. If no block is ready within
+        timeout_ms, then yields an empty list.
+        """
+        while stop is None or not stop.is_set():
+            blk_off = self.blk_idx * self.block_size
+            status, num_pkts, pkt_off = struct.unpack_from(
+                BLOCK_HDR_FMT, self.buf, blk_off + BLOCK_STATUS_OFF)
+            if not status & TP_STATUS_USER:
+                # Wait for the kernel to fill the block, then reread its
+                # header.
+                if not self.poller.poll(timeout_ms):
+                    yield []
+                continue
+
+            pkts = []
+            pkt_off += blk_off
+            for _ in range(num_pkts):
+                (next_off, sec, nsec, snaplen, wirelen, _,
+                 mac_off) = struct.unpack_from(PKT_HDR_FMT, self.buf, pkt_off)
+                dat_off = pkt_off + mac_off
+                pkts.append((
+                    self.buf[dat_off:dat_off + snaplen],
+                    parse_utils.PktMdat(sec, nsec // 1000, wirelen)))
+                pkt_off += next_off
+            try:
+                yield pkts
+            finally:
+                # Release the views before returning the block to the kernel.
+                for pkt_dat, _ in pkts:
+                    pkt_dat.release()
+                struct.pack_into(
+                    "I", self.buf, blk_off + BLOCK_STATUS_OFF,
+                    TP_STATUS_KERNEL)
+                self.blk_idx = (self.blk_idx + 1) % self.num_blocks
+
+
+class FlowRecorder:
+    """
+    Keeps the headers of each flow's most recent packets in a ring buffer that
+    is bounded in bytes, and writes a flow's buffer to disk when trigger() is
+    called (e.g., when the online detector flags the flow as unfair). Writes
+    happen on a background thread. Each flow is written as an experiment
+    archive in the layout that gen_features.py expects, with the recorded
+    packets as the server (receiver) pcap and no client pcap. Experiment pcaps
+    use fixed client and server IP addresses (defaults.CLIENT_IP and
+    defaults.SERVER_IP), so the recorded packets' addresses are rewritten to
+    match, based on their ports. The original addresses are saved in the
+    archive's parameters.
+    """
+
+    def __init__(self, out_dir, bw_Mbps, rtt_ms, queue_p,
+                 max_B=defaults.RECORD_MAX_B,
+                 snaplen=max(defaults.SNAPLEN_TCP_B,
+                             *defaults.SNAPLEN_B.values())):
+        """
+        out_dir: The directory in which to write the experiment archives.
+        bw_Mbps, rtt_ms, queue_p: The bottleneck bandwidth, base RTT, and
+            queue size (packets), which are encoded in the archive names.
+        max_B: The maximum number of bytes of headers to keep per flow.
+        snaplen: The number of bytes of each packet to keep.
+        """
+        assert max_B > 0, f"Invalid buffer size: {max_B} B"
+        self.out_dir = out_dir
+        self.bw_Mbps = bw_Mbps
+        self.rtt_ms = rtt_ms
+        self.queue_p = queue_p
+        self.max_B = max_B
+        self.snaplen = snaplen
+        # Maps flow to a tuple of the form:
+        #     [deque of (packet bytes, parse_utils.PktMdat), bytes buffered,
+        #      (original client IP, original server IP)]
+        self.bufs = {}
+        self.exe = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+
+    def record(self, flw, pkt_dat, pkt_mdat):
+        """
+        Copies the first snaplen bytes of a packet (bytes or memoryview) into
+        flw's buffer, evicting the flow's oldest packets as needed. flw is a
+        tuple of the form (client port, server port). The packet must be an
+        Ethernet/IPv4 packet carrying TCP or UDP.
+        """
+        pkt_dat = bytearray(pkt_dat[:self.snaplen])
+        ips = normalize_ips(pkt_dat, flw[0])
+        if flw not in self.bufs:
+            self.bufs[flw] = [collections.deque(), 0, None]
+        buf = self.bufs[flw]
+        if buf[2] is None:
+            buf[2] = ips
+        buf[0].append((pkt_dat, pkt_mdat))
+        buf[1] += len(pkt_dat)
+        while buf[1] > self.max_B:
+            buf[1] -= len(buf[0].popleft()[0])
+
+    def forget(self, flw):
+        """ Discards a flow's buffer, e.g., when the flow ends. """
+        self.bufs.pop(flw, None)
+
+    def trigger(self, flw, cca):
+        """
+        Writes flw's buffered packets to disk in the background. cca is the
+        flow's CCA, which determines how gen_features.py decodes the packets.
+        Returns a Future whose result is the path to the archive, or None if
+        the flow has no buffered packets.
+        """
+        pkts, _, ips = self.bufs.get(flw, ([], 0, None))
+        return self.exe.submit(self.write, flw, cca, list(pkts), ips)
+
+    def write(self, flw, cca, pkts, ips=None):
+        """
+        Writes packets to an experiment archive. ips is a tuple of the form
+        (original client IP, original server IP). See trigger().
+        """
+        if not pkts:
+            return None
+        dur_s = math.ceil(
+            (pkts[-1][1].sec - pkts[0][1].sec) +
+            (pkts[-1][1].usec - pkts[0][1].usec) / 1e6)
+        # See parse_utils.Exp for the name format. The last token must be
+        # unique and must not contain "-".
+        exp_name = (
+            f"unfair-{cca}-{cca}-{self.bw_Mbps}bw-{self.rtt_ms}rtt-"
+            f"{self.queue_p}q-1{cca}-0{cca}-{max(dur_s, 1)}s-"
+            f"{time.strftime('%Y%m%dT%H%M%S')}_{flw[0]}_{flw[1]}")
+        out_flp = path.join(self.out_dir, f"{exp_name}.tar.gz")
+        # See gen_features.parse_opened_exp() for the format of the flowsets.
+        params = {"flowsets": [[cca, 0, max(dur_s, 1), [flw[0]], flw[1]]]}
+        if ips is not None:
+            params["client_ip"], params["server_ip"] = ips
+        params = json.dumps(params, indent=4).encode()
+        pcap = write_pcap(pkts, self.snaplen)
+        tmp_flp = out_flp + ".tmp"
+        with tarfile.open(tmp_flp, "w:gz") as tar:
+            for name, dat in [
+                    (f"{exp_name}.json", params),
+                    (f"server-tcpdump-{exp_name}.pcap", pcap)]:
+                info = tarfile.TarInfo(path.join(exp_name, name))
+                info.size = len(dat)
+                info.mtime = time.time()
+                tar.addfile(info, io.BytesIO(dat))
+        # Rename the archive only once it is complete, so that gen_features.py
+        # never sees a partial file.
+        os.rename(tmp_flp, out_flp)
+        print(f"Recorded {len(pkts)} packets of flow {flw} in: {out_flp}")
+        return out_flp
+
+    def close(self):
+        """ Waits for all pending writes to finish. """
+        self.exe.shutdown(wait=True)
+
+
+def normalize_ips(pkt_dat, client_port):
+    """
+    Rewrites, in place, the IP addresses of a captured Ethernet/IPv4 packet
+    (a bytearray) to defaults.CLIENT_IP and defaults.SERVER_IP, based on
+    whether the packet's source port is client_port, and updates the IP
+    header checksum. Returns the original addresses as a tuple of the form
+    (client IP, server IP), or None if the headers were not captured.
+    """
+    ip_off = defaults.ETHER_HEADER_SIZE_B
+    if len(pkt_dat) < ip_off + 20:
+        return None
+    trans_off = ip_off + ((pkt_dat[ip_off] & 0x0f) << 2)
+    if len(pkt_dat) < trans_off + 2:
+        return None
+    from_client = (
+        struct.unpack_from(">H", pkt_dat, trans_off)[0] == client_port)
+    src = socket.inet_ntoa(pkt_dat[ip_off + 12:ip_off + 16])
+    dst = socket.inet_ntoa(pkt_dat[ip_off + 16:ip_off + 20])
+    client, server = (src, dst) if from_client else (dst, src)
+    pkt_dat[ip_off + 12:ip_off + 20] = (
+        socket.inet_aton(defaults.CLIENT_IP) +
+        socket.inet_aton(defaults.SERVER_IP)
+        if from_client else
+        socket.inet_aton(defaults.SERVER_IP) +
+        socket.inet_aton(defaults.CLIENT_IP))
+    # Recompute the checksum over the IP header, with the checksum field
+    # zeroed. The TCP and UDP checksums, which also cover the addresses, are
+    # left as is, since parse_utils does not check them.
+    pkt_dat[ip_off + 10:ip_off + 12] = b"\x00\x00"
+    words = struct.unpack_from(
+        f">{(trans_off - ip_off) // 2}H", pkt_dat, ip_off)
+    csum = sum(words)
+    while csum >> 16:
+        csum = (csum & 0xffff) + (csum >> 16)
+    struct.pack_into(">H", pkt_dat, ip_off + 10, ~csum & 0xffff)
+    return client, server
+
+
+def write_pcap(pkts, snaplen):
+    """
+    Encodes a list of (packet bytes, parse_utils.PktMdat) tuples as a pcap
+    file with Ethernet link type. Returns the file contents.
+    """
+    chunks = [
+        # Magic number, version 2.4, UTC, timestamp accuracy, snapshot length,
+        # link type (Ethernet).
+        struct.pack("<IHHiIII", 0xa1b2c3d4, 2, 4, 0, 0, snaplen, 1)]
+    for pkt_dat, pkt_mdat in pkts:
+        chunks.append(struct.pack(
+            "<IIII", pkt_mdat.sec, pkt_mdat.usec, len(pkt_dat),
+            pkt_mdat.wirelen))
+        chunks.append(pkt_dat)
+    return b"".join(chunks)
+
+
+def capture(iface, handle, num_workers=1, stop=None, **kwargs):
+    """
+    Captures packets from iface using num_workers threads, each with its own
+    Ring. If there are multiple workers, then they form a fanout group so that
+    each flow is handled by one worker. For each block of packets, calls
+    handle(worker index, list of (packet bytes, parse_utils.PktMdat)). handle
+    must not retain the packet bytes. Returns when stop (a threading.Event) is
+    set. kwargs are passed to each Ring.
+    """
+    if stop is None:
+        stop = threading.Event()
+    fanout_group = None if num_workers == 1 else os.getpid() & 0xffff
+
+    def run(ring, wkr_idx):
+        # Close the generator (returning its current block to the kernel)
+        # before the Ring is closed.
+        with contextlib.closing(ring.blocks(stop=stop)) as blks:
+            for pkts in blks:
+                if pkts:
+                    handle(wkr_idx, pkts)
+
+    # Open all of the Rings before starting to capture, so that each worker
+    # receives its share of the flows from the start. If opening a Ring fails,
+    # then close the ones that are already open.
+    with contextlib.ExitStack() as stack:
+        rings = [
+            stack.enter_context(
+                Ring(iface, fanout_group=fanout_group, **kwargs))
+            for _ in range(num_workers)]
+        wkrs = [
+            threading.Thread(target=run, args=(ring, wkr_idx))
+            for wkr_idx, ring in enumerate(rings)]
+        for wkr in wkrs:
+            wkr.start()
+        for wkr in wkrs:
+            wkr.join()
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description=(
+            "Captures packets from a network interface using a TPACKET_V3 "
+            "ring and reports the capture rate."))
+    psr.add_argument(
+        "--interface", help="The interface to capture from.", required=True,
+        type=str)
+    psr.add_argument(
+        "--workers", default=1, help="The number of capture threads.",
+        required=False, type=int)
+    psr.add_argument(
+        "--duration-s", default=10, help="How long to capture for.",
+        required=False, type=float)
+    args = psr.parse_args()
+
+    num_pkts = [0] * args.workers
+    num_blks = [0] * args.workers
+    tot_B = [0] * args.workers
+
+    def handle(wkr_idx, pkts):
+        num_blks[wkr_idx] += 1
+        num_pkts[wkr_idx] += len(pkts)
+        tot_B[wkr_idx] += sum(pkt_mdat.wirelen for _, pkt_mdat in pkts)
+
+    stop = threading.Event()
+    timer = threading.Timer(args.duration_s, stop.set)
+    timer.start()
+    tim_srt_s = time.time()
+    capture(args.interface, handle, args.workers, stop)
+    tim_s = time.time() - tim_srt_s
+    for wkr_idx in range(args.workers):
+        print(
+            f"Worker {wkr_idx}: {num_pkts[wkr_idx]} packets, "
+            f"{tot_B[wkr_idx]} bytes, {num_blks[wkr_idx]} blocks")
+    print(
+        f"Captured {sum(num_pkts)} packets in {tim_s:.2f} seconds "
+        f"({sum(num_pkts) / tim_s:.2f} packets/s)")
+
+
+if __name__ == "__main__":
+    main()
@@ -11,7 +11,7 @@ from os import path
 
 import numpy as np
 
-import utils
+import parse_utils
 
 
 def process_one(flp):
@@ -20,7 +20,7 @@ def process_one(flp):
     dat = dat[dat.files[0]]
     labels = dat["mathis model label"]
     valid = np.where(labels != -1)
-    exp = utils.Exp(flp)
+    exp = parse_utils.Exp(flp)
     return (
         (
             (labels[valid] ==
@@ -0,0 +1,132 @@
+#! /usr/bin/env python3
+"""
+Measures the accuracy of the sketch-based flow admission front stage
+(streaming.FlowAdmission) on a synthetic trace with many mostly tiny flows.
+"""
+
+import argparse
+import collections
+import time
+
+import numpy as np
+
+import defaults
+import streaming
+
+
+def make_trace(num_flws, dur_us, seed):
+    """
+    Returns the flow, arrival time (us), and size (bytes) of every packet in a
+    synthetic trace, in order of arrival time. Flow sizes follow a heavy-tailed
+    (Pareto) distribution, so most flows are tiny and a few are large. Each
+    flow's packets are spread uniformly over a random interval.
+    """
+    rng = np.random.default_rng(seed)
+    flw_pkts = np.minimum(
+        np.ceil(rng.pareto(1.1, num_flws) + 1).astype(np.int64), 100_000)
+    starts_us = rng.integers(0, dur_us, num_flws)
+    lens_us = rng.integers(1, dur_us // 10, num_flws)
+    flws = np.repeat(np.arange(num_flws), flw_pkts)
+    times_us = (
+        np.repeat(starts_us, flw_pkts) +
+        (rng.random(flws.shape[0]) * np.repeat(lens_us, flw_pkts)).astype(
+            np.int64))
+    sizes_B = rng.choice([64, 576, 1514], flws.shape[0], p=[0.3, 0.1, 0.6])
+    order = np.argsort(times_us, kind="stable")
+    return flws[order], times_us[order], sizes_B[order]
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description=(
+            "Measures the accuracy of the sketch-based flow admission front "
+            "stage on a synthetic many-flow trace."))
+    psr.add_argument(
+        "--flows", default=100_000, help="The number of flows.",
+        required=False, type=int)
+    psr.add_argument(
+        "--duration-us", default=60_000_000,
+        help="The duration of the trace (us).", required=False, type=int)
+    psr.add_argument(
+        "--width", default=defaults.ADMISSION_SKETCH_WIDTH,
+        help="The width of each count-min sketch.", required=False, type=int)
+    psr.add_argument(
+        "--depth", default=defaults.ADMISSION_SKETCH_DEPTH,
+        help="The depth of each count-min sketch.", required=False, type=int)
+    psr.add_argument(
+        "--threshold-B", default=defaults.ADMISSION_THRESHOLD_B,
+        help="The number of bytes at which to promote a flow.",
+        required=False, type=int)
+    args = psr.parse_args()
+
+    flws, times_us, sizes_B = make_trace(
+        args.flows, args.duration_us, defaults.SEED)
+    num_pkts = flws.shape[0]
+    print(f"Flows: {args.flows}, packets: {num_pkts}")
+    adm = streaming.FlowAdmission(
+        args.threshold_B, max_flows=args.flows,
+        epoch_us=defaults.ADMISSION_EPOCH_US, width=args.width,
+        depth=args.depth, seed=defaults.SEED)
+
+    # Exact per-flow bytes and packets, for comparison. Only count the
+    # packets that the front stage records, i.e., those before promotion.
+    exact_B = collections.Counter()
+    exact_pkts = collections.Counter()
+    # The number of bytes that each flow had actually sent when it was
+    # promoted.
+    promoted_at_B = {}
+    tim_srt_s = time.time()
+    for flw, time_us, size_B in zip(
+            flws.tolist(), times_us.tolist(), sizes_B.tolist()):
+        if flw in promoted_at_B:
+            adm.update(flw, time_us, size_B)
+            continue
+        exact_B[flw] += size_B
+        exact_pkts[flw] += 1
+        if adm.update(flw, time_us, size_B):
+            promoted_at_B[flw] = exact_B[flw]
+    tim_s = time.time() - tim_srt_s
+    print(f"Front stage cost: {tim_s * 1e6 / num_pkts:.2f} us per packet")
+    print(
+        "Sketch memory: "
+        f"{4 * args.width * args.depth} counters, independent of the "
+        "number of flows")
+
+    heavy = {flw for flw, byts in exact_B.items() if byts >= args.threshold_B}
+    promoted = set(promoted_at_B)
+    print(f"Flows that reached the threshold: {len(heavy)}")
+    print(f"Promoted flows: {len(promoted)}")
+    # The sketches never underestimate, so every heavy flow is promoted.
+    print(f"Heavy flows that were not promoted: {len(heavy - promoted)}")
+    print(
+        f"Flows that were promoted early (false positives): "
+        f"{len(promoted - heavy)}")
+    if promoted:
+        early = np.array(
+            [promoted_at_B[flw] / args.threshold_B for flw in promoted])
+        print(
+            "Fraction of the threshold reached at promotion: "
+            f"mean {early.mean():.3f}, min {early.min():.3f}")
+
+    # Relative error of the byte and packet estimates for flows that were not
+    # promoted (i.e., whose state lives only in the sketches).
+    light = [flw for flw in exact_B if flw not in promoted]
+    if light:
+        ests = [adm.estimate(flw) for flw in light]
+        err_B = np.array(
+            [(est[0] - exact_B[flw]) / exact_B[flw]
+             for flw, est in zip(light, ests)])
+        err_pkts = np.array(
+            [(est[1] - exact_pkts[flw]) / exact_pkts[flw]
+             for flw, est in zip(light, ests)])
+        for name, err in [("bytes", err_B), ("packets", err_pkts)]:
+            print(
+                f"Relative error of {name} estimates for unpromoted flows: "
+                f"mean {err.mean():.4f}, median {np.median(err):.4f}, "
+                f"99th percentile {np.percentile(err, 99):.4f}, exact for "
+                f"{(err == 0).mean() * 100:.2f}% of flows")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+#! /usr/bin/env python3
+"""
+Measures the accuracy impact of storing the (scaled) training inputs in half
+precision (see utils.Dataset's storage_dtype), per model type, alongside the
+memory and bandwidth savings. Validation and test inputs are always stored as
+float32. Models that do not scale their inputs (HistGbdtSklearn) are evaluated
+with float32 storage only.
+"""
+
+import argparse
+
+import torch
+
+import cl_args
+import defaults
+import models
+import train
+import utils
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description=(
+            "Trains each model with its inputs stored in each storage type "
+            "and compares their accuracy."))
+    psr.add_argument(
+        "--models", choices=models.MODEL_NAMES, default=models.MODEL_NAMES,
+        help="The models to evaluate.", nargs="+", type=str)
+    psr, psr_verify = cl_args.add_training(psr)
+    args = vars(psr_verify(psr.parse_args()))
+    mdls = args.pop("models")
+    # Use the same random seed for every configuration, so that differences
+    # are due to the storage type only.
+    args["no_rand"] = True
+    for arg in args.keys():
+        assert arg in defaults.DEFAULTS, \
+            f"Argument {arg} missing from defaults.DEFAULTS!"
+
+    # Models that do not scale their inputs support float32 storage only.
+    storage_dtypes = {
+        mdl: (
+            ["float32"]
+            if issubclass(models.MODELS[mdl], models.HistGbdtSklearnWrapper)
+            else list(utils.STORAGE_DTYPES))
+        for mdl in mdls}
+    ress = {}
+    for mdl in mdls:
+        for storage_dtype in storage_dtypes[mdl]:
+            err, tim_s = train.run_trials(train.prepare_args(
+                {**args, "model": mdl, "storage_dtype": storage_dtype}))
+            ress[(mdl, storage_dtype)] = (1 - err, tim_s)
+
+    print("Results:")
+    for mdl in mdls:
+        acc_base, _ = ress[(mdl, "float32")]
+        for storage_dtype in storage_dtypes[mdl]:
+            acc, tim_s = ress[(mdl, storage_dtype)]
+            # Memory and per-epoch bandwidth scale with the element size.
+            typ = utils.STORAGE_DTYPES[storage_dtype]
+            size_frac = torch.tensor([], dtype=typ).element_size() / 4
+            print(
+                f"\t{mdl}, {storage_dtype}: accuracy {acc:.4f} "
+                f"({acc - acc_base:+.4f} vs. float32), input memory and "
+                f"bandwidth {size_frac * 100:.0f}% of float32, training time "
+                f"{tim_s:.2f} seconds")
+
+
+if __name__ == "__main__":
+    main()
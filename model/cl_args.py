@@ -5,6 +5,7 @@ from os import path
 
 import defaults
 import models
+import utils
 
 
 def add_out(psr, psr_verify=lambda args: args):
@@ -192,6 +193,13 @@ def add_training(psr, psr_verify=lambda args: args):
         "--max-attempts", default=defaults.DEFAULTS["max_attempts"],
         help="The maximum number of failed training attempts to survive.",
         type=int)
+    psr.add_argument(
+        "--storage-dtype", choices=list(utils.STORAGE_DTYPES),
+        default=defaults.DEFAULTS["storage_dtype"],
+        help=("The type in which to store the (scaled) input features in "
+              "memory. Batches are converted to float32 as they are "
+              "assembled."),
+        type=str)
     psr.add_argument(
         "--timeout-s", default=defaults.DEFAULTS["timeout_s"],
         help="Automatically stop training after this amount of time (seconds).",
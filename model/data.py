@@ -5,19 +5,36 @@ from os import path
 
 import numpy as np
 from numpy.lib import recfunctions
-import torch
 
 import defaults
 import features
 import models
+import rand
 import utils
 
 
+# Processed data splits that this process has already loaded or generated,
+# keyed by their filepath. Lets a worker process that runs many trials (e.g.,
+# in hyper.py) reuse data instead of reloading it from disk for every trial.
+# The cached splits stay alive after a trial finishes, so this is off unless a
+# process enables it (see hyper.init_worker()).
+CACHE_ENABLED = False
+CACHE = {}
+# The maximum number of entries in CACHE.
+CACHE_MAX = 2
+
+
 def get_dataloaders(args, net):
     """
     Builds training, validation, and test sets, which are returned as
     dataloaders.
     """
+    # Only scaled inputs fit in half precision (e.g., RTTs in microseconds
+    # overflow float16), and HistGbdtSklearn's inputs are not scaled.
+    assert (args["storage_dtype"] == "float32" or
+            not isinstance(net, models.HistGbdtSklearnWrapper)), \
+        (f"Model {args['model']} does not scale its inputs, so it requires "
+         f"\"--storage-dtype float32\", not: {args['storage_dtype']}")
     out_dir = args["out_dir"]
     dat_flp = path.join(
         out_dir,
@@ -28,7 +45,11 @@ def get_dataloaders(args, net):
     # Check for the presence of both the data and the scaling
     # parameters because the resulting model is useless without the
     # proper scaling parameters.
-    if (not args["regen_data"] and path.exists(dat_flp) and
+    if (CACHE_ENABLED and not args["regen_data"] and dat_flp in CACHE and
+            path.exists(scl_prms_flp)):
+        print(f"Found cached data: {dat_flp}")
+        trn, val, tst = CACHE[dat_flp]
+    elif (not args["regen_data"] and path.exists(dat_flp) and
             path.exists(scl_prms_flp)):
         print("Found existing data!")
         trn, val, tst = utils.load_parsed_data(dat_flp)
@@ -40,6 +61,12 @@ def get_dataloaders(args, net):
         # Save scaling parameters. We always need to save the scaling parameters,
         # because the trained model cannot be used without them.
         utils.save_scl_prms(args["out_dir"], scl_prms)
+    if CACHE_ENABLED:
+        # Evict the oldest entry. Dictionaries preserve insertion order.
+        CACHE.pop(dat_flp, None)
+        while len(CACHE) >= CACHE_MAX:
+            del CACHE[next(iter(CACHE))]
+        CACHE[dat_flp] = (trn, val, tst)
     return create_dataloaders(args, trn, val, tst)
 
 
@@ -52,8 +79,9 @@ def get_bulk_data(args, net):
     """
     data_dir = args["data_dir"]
     sample_frac = args["sample_percent"] / 100
+    # Use lists so that the training inputs can be replaced once scaled.
     trn, val, tst = [
-        get_split(data_dir, name, sample_frac, net)
+        list(get_split(data_dir, name, sample_frac, net))
         for name in ["train", "val", "test"]]
 
     # Validate scaling groups.
@@ -75,18 +103,20 @@ def get_bulk_data(args, net):
 def get_split(data_dir, name, sample_frac, net):
     """ Constructs a split from many subsplits on disk. """
     # Load the split's subsplits.
-    subsplits = utils.load_subsplits(data_dir, name)
+    subsplits = utils.load_subsplits(data_dir, name, access="sequential")
     # Optionally select a fraction of each subsplit. We always use all of the
     # test split.
-    if name in {"train", "val"} and sample_frac < 1:
-        subsplits = [
-            subsplit[:math.ceil(subsplit.shape[0] * sample_frac)]
-            for subsplit in subsplits]
-    # Merge the subsplits into a split.
-    split = np.concatenate(subsplits)
+    nums = [
+        math.ceil(subsplit.shape[0] * sample_frac)
+        if name in {"train", "val"} and sample_frac < 1
+        else subsplit.shape[0]
+        for subsplit in subsplits]
+    # Merge the subsplits into a split, reading them from disk in order.
+    split = utils.copy_sequential(
+        subsplits, utils.alloc_staging(sum(nums), subsplits[0].dtype), nums)
     # Optionally shuffle the split.
     if name == "train" and len(subsplits) > 1:
-        np.random.default_rng().shuffle(split)
+        rand.get(f"merge-{name}").shuffle(split)
     # Extract features from the split.
     return extract_fets(split, name, net)
 
@@ -110,13 +140,20 @@ def extract_fets(dat, split_name, net):
 
     # Remove samples where the ground truth output is unknown.
     len_before = dat.shape[0]
-    dat = dat[dat[list(net.out_spc)] != -1][0]
-    removed = dat.shape[0] - len_before
+    dat = dat[dat[net.out_spc[0]] != -1]
+    removed = len_before - dat.shape[0]
     if removed > 0:
         print(
             f"Removed {removed} rows with unknown out_spc from split "
             f"\"{split_name}\".")
 
+    # Parsed experiments from before a feature was added to features.FEATURES
+    # do not have it. Say so, instead of failing deep inside numpy.
+    missing = [fet for fet in net.in_spc if fet not in dat.dtype.names]
+    assert not missing, \
+        (f"{net.name}: Split \"{split_name}\" is missing input features "
+         f"{missing}. It was probably parsed by an older version of "
+         "gen_features.py. Parse the experiments again.")
     dat_in = recfunctions.repack_fields(dat[list(net.in_spc)])
     dat_out = recfunctions.repack_fields(dat[list(net.out_spc)])
     # Create a structured array to hold extra data that will not be used as
@@ -142,11 +179,15 @@ def extract_fets(dat, split_name, net):
                 ("Warning: NaNs or Infs in input feature for split "
                  f"\"{split_name}\": {fet}")
         assert (not (
-            np.isnan(dat_out[features.LABEL_FET]).any() or
-            np.isinf(dat_out[features.LABEL_FET]).any())), \
+            np.isnan(dat_out[net.out_spc[0]]).any() or
+            np.isinf(dat_out[net.out_spc[0]]).any())), \
             f"Warning: NaNs or Infs in ground truth for split \"{split_name}\"."
 
     if dat_in.shape[0] > 0:
+        # Integer features (e.g., the interarrival time histogram buckets)
+        # cannot hold NaN or a mean, so convert every feature to float.
+        dat_in = dat_in.astype(
+            [(fet, "float64") for fet in dat_in.dtype.names])
         # Convert all instances of -1 (feature value unknown) to either the mean for
         # that feature or NaN.
         bad_fets = []
@@ -180,7 +221,7 @@ def extract_fets(dat, split_name, net):
     # TODO: Refactor this to be compatible with bulk data splits.
     # dat_in, dat_out, dat_extra, scl_grps = net.modify_data(
     #     exp, dat_in, dat_out, dat_extra, sequential=sequential)
-    scl_grps = list(range(len(dat_in.dtype.names)))
+    scl_grps = net.get_scl_grps(dat_in.dtype.names)
 
     return dat_in, dat_out, dat_extra, scl_grps
 
@@ -290,30 +331,37 @@ def create_dataloaders(args, trn, val, tst):
     if bch_tst is None:
         bch_tst = dat_tst_in.shape[0]
 
-    # Create the dataloaders.
-    dataset_trn = utils.Dataset(fets, dat_trn_in, dat_trn_out, dat_trn_extra)
+    # Create the dataloaders. Only the training inputs are scaled (see
+    # get_bulk_data()), so only they may be stored in half precision.
+    storage_dtype = args["storage_dtype"]
+    dataset_trn = utils.Dataset(
+        fets, dat_trn_in, dat_trn_out, dat_trn_extra, storage_dtype)
+    # Report the memory (and per-epoch bandwidth) used by the training inputs.
+    _, dat_in, _, _ = dataset_trn.raw(upcast=False)
+    num_elms = dat_in.nelement()
+    print(
+        f"Training matrix: {num_elms * dat_in.element_size() / 2**20:.2f} MB "
+        f"as {storage_dtype} ({num_elms * 4 / 2**20:.2f} MB as float32)")
     return (
         # Train dataloader.
-        torch.utils.data.DataLoader(
+        utils.BatchLoader(
             dataset_trn,
             batch_sampler=utils.BalancedSampler(
                 dataset_trn, bch_trn, drop_last=False,
-                drop_popular=args["drop_popular"]))
+                drop_popular=args["drop_popular"], name="train"))
         if args["balance"]
-        else torch.utils.data.DataLoader(
+        else utils.BatchLoader(
             dataset_trn,
             # Do not calculate bch_trn above (similarly to bch_tst) because the
             # BalancedSampler has special handling for the case where bch_trn is
-            # None.
-            batch_size=dat_trn_in.shape[0] if bch_trn is None else bch_trn,
-            # Ordinarily, shuffle should be True. But we shuffle the training
-            # data in prepare_data.py, so we do not need to do so again here.
-            shuffle=False, drop_last=False),
+            # None. We shuffle the training data in prepare_data.py, so we do
+            # not need to do so again here.
+            batch_size=dat_trn_in.shape[0] if bch_trn is None else bch_trn),
         # Validation dataloader.
-        torch.utils.data.DataLoader(
+        utils.BatchLoader(
             utils.Dataset(fets, dat_val_in, dat_val_out, dat_val_extra),
-            batch_size=bch_tst, shuffle=False, drop_last=False),
+            batch_size=bch_tst),
         # Test dataloader.
-        torch.utils.data.DataLoader(
+        utils.BatchLoader(
             utils.Dataset(fets, dat_tst_in, dat_tst_out, dat_tst_extra),
-            batch_size=bch_tst, shuffle=False, drop_last=False))
+            batch_size=bch_tst))
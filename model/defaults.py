@@ -45,7 +45,8 @@ DEFAULTS = {
     "l2_regularization": 0,
     "clusters": 30,
     "fets_to_pick": None,
-    "perm_imp_repeats": 10
+    "perm_imp_repeats": 10,
+    "storage_dtype": "float32"
 }
 # When converting an arguments dictionary to a string, ignore arguments that do
 # not impact model training.
@@ -53,9 +54,18 @@ ARGS_TO_IGNORE_MODEL = [
     "data_dir", "out_dir", "tmp_dir", "sims", "features", "exps",
     "analyze_features", "sync", "graph", "test_batch", "regen_data",
     "clusters", "fets_to_pick", "perm_imp_repeats"]
-ARGS_TO_IGNORE_DATA = ARGS_TO_IGNORE_MODEL + ["max_iter"]
+# The storage type does not change the data on disk.
+ARGS_TO_IGNORE_DATA = ARGS_TO_IGNORE_MODEL + ["max_iter", "storage_dtype"]
+# Arguments that model filenames did not always include. Filenames that lack
+# them are parsed as if they had their default values.
+ARGS_ADDED_MODEL = ["storage_dtype"]
 # String to prepend to processed train/val/test data saved on disk.
 DATA_PREFIX = "data_"
+# String to append to an experiment output directory to form the directory in
+# which to save parsed sender-side features. This is a sibling of the output
+# directory (not a subdirectory) so that programs that list the output
+# directory do not see the sender-side files.
+SENDER_DIR_SUFFIX = "_sender"
 # String to prepend to trained models saved on disk.
 MODEL_PREFIX = "model_"
 # The maximum number of epochs when using early stopping.
@@ -73,7 +83,38 @@ CLUSTER_ATTEMPTS = 1000
 FAIR_THRESH = 0.1
 # The window size to use for the ground truth.
 CHOSEN_WIN = 8
-# The type format of the Copa header, which is the beginning of the UDP payload.
+# The duration of the window over which to track the windowed min RTT. Matches
+# the duration of BBR's min RTT filter.
+MIN_RTT_WIN_US = 10_000_000
+# The duration of the window over which to track the minimum one-way delay when
+# calculating the queueing delay.
+QUEUE_DELAY_WIN_US = MIN_RTT_WIN_US
+# The number of time slots into which to divide each window when estimating
+# windowed quantiles, and the size of each slot's quantile sketch. See
+# streaming.SlidingQuantiles.
+QUANTILE_SLOTS = 8
+QUANTILE_SKETCH_K = 64
+# The default window duration (multiple of the min RTT) of the histogram
+# features.
+HIST_WIN = 8
+# The duration of each bin (multiple of the min RTT) and the number of bins in
+# the window of the spectral power features. Bin durations are rounded to a
+# power of two microseconds. See streaming.SlidingDft.
+SPECTRUM_BIN_RTTS = 0.5
+SPECTRUM_BINS = 64
+# Parameters of the front stage that decides which flows receive full feature
+# state when there are too many flows to track exactly. See
+# streaming.FlowAdmission. The sketches use 4 * 2**16 counters each.
+ADMISSION_THRESHOLD_B = 100_000
+ADMISSION_MAX_FLOWS = 10_000
+ADMISSION_EPOCH_US = 1_000_000
+ADMISSION_SKETCH_WIDTH = 2**16
+ADMISSION_SKETCH_DEPTH = 4
+# Whether to pin worker processes to the CPUs of a single NUMA node. See
+# numa.py.
+NUMA_PIN = True
+# The type format of the Copa header, which is the beginning of the UDP
+# payload.
 # See https://github.com/venkatarun95/genericCC/blob/master/tcp-header.hh
 #     int seq_num;
 #     int flow_id;
@@ -84,3 +125,61 @@ COPA_HEADER_FMT = "iiidd"
 # "iiidd" is ordinarily 28 bytes. However, when in a C struct, it is padded
 # to enforce memory alignment. Therefore, it somehow ends up being 32 bytes.
 COPA_HEADER_SIZE_B = struct.calcsize(COPA_HEADER_FMT)
+# The size of the UDT header, which is the beginning of the UDP payload for PCC
+# Vivace, and the size of the UDT ACK control information that follows it.
+UDT_HEADER_SIZE_B = 16
+UDT_ACK_SIZE_B = 24
+# Header sizes.
+ETHER_HEADER_SIZE_B = 14
+IP_HEADER_MAX_SIZE_B = 60
+TCP_HEADER_MAX_SIZE_B = 60
+UDP_HEADER_SIZE_B = 8
+# The recommended capture snapshot length (i.e., tcpdump's "-s") for each CCA.
+# parse_utils.parse_packets() reads only the Ethernet, IP, and transport
+# headers (including TCP options) and, for Copa and Vivace, the Copa or UDT
+# header at the start of the UDP payload. These allow for the largest possible
+# IP and TCP headers. Full-sized packets are 1514 bytes, so these are over 10x
+# smaller.
+SNAPLEN_TCP_B = (
+    ETHER_HEADER_SIZE_B + IP_HEADER_MAX_SIZE_B + TCP_HEADER_MAX_SIZE_B)
+SNAPLEN_B = {
+    "copa": (
+        ETHER_HEADER_SIZE_B + IP_HEADER_MAX_SIZE_B + UDP_HEADER_SIZE_B +
+        COPA_HEADER_SIZE_B),
+    "vivace": (
+        ETHER_HEADER_SIZE_B + IP_HEADER_MAX_SIZE_B + UDP_HEADER_SIZE_B +
+        UDT_HEADER_SIZE_B + UDT_ACK_SIZE_B)
+}
+# The client and server IP addresses in experiment pcaps. parse_utils infers a
+# packet's direction from them, so capture.FlowRecorder rewrites recorded
+# packets to use them.
+CLIENT_IP = "192.0.0.4"
+SERVER_IP = "192.0.0.2"
+# The maximum number of bytes of packet headers that capture.FlowRecorder keeps
+# for each flow (about 8000 packets at the largest snapshot length).
+RECORD_MAX_B = 2**20
+# The segment duration, retention period, and number of records per chunk of
+# tsstore.Store.
+TSSTORE_SEGMENT_US = 60_000_000
+TSSTORE_RETENTION_US = 24 * 60 * 60 * 1_000_000
+TSSTORE_CHUNK_ROWS = 100_000
+# When copying a split from disk into memory, the amount of data to ask the
+# kernel to read ahead of the copy. See utils.copy_sequential().
+SPLIT_READAHEAD_B = 64 * 2**20
+# Compressed splits: the uncompressed size of each independently-compressed
+# frame, the zstd compression level, and the number of decompressed frames to
+# cache when reading individual rows. See frames.py. Splits are uncompressed
+# unless prepare_data.py is run with "--compress".
+SPLIT_FRAME_B = 2**20
+SPLIT_COMPRESSION_LEVEL = 3
+SPLIT_FRAME_CACHE = 16
+# Intermediate files are staged in STAGING_DIR (a tmpfs), up to
+# STAGING_BUDGET_B bytes in total, and spill over to STAGING_SPILL_DIR (a local
+# disk) beyond that. See staging.py.
+STAGING_DIR = "/tmp"
+STAGING_SPILL_DIR = "/var/tmp/unfair"
+STAGING_BUDGET_B = 40 * 2**30
+# The maximum length of the header of a .npy file, or of each array in a .npz
+# file. Parsed experiments have hundreds of features, so their headers are
+# longer than numpy's default limit (10,000 bytes).
+NPY_MAX_HEADER_B = 2**20
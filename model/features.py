@@ -16,18 +16,36 @@ def make_win_metric(metric, win):
     """ Format the name of a windowed metric. """
     return f"{metric}-windowed-minRtt{win}"
 
+def make_hist_metric(metric, bkt):
+    """ Format the name of a histogram bucket metric. """
+    return f"{metric}-histogram-bucket{bkt}"
+
+def make_spectrum_metric(metric, period):
+    """ Format the name of a spectral power metric. """
+    return f"{metric}-spectrum-periodMinRtt{period}"
+
 def make_smoothed_features():
-    """ Return a dtype for all EWMA and windowed metrics. """
+    """
+    Return a dtype for all EWMA, windowed, histogram, and spectral power
+    metrics.
+    """
     return (
         [(make_ewma_metric(metric, alpha), typ)
          for (metric, typ), alpha in itertools.product(EWMAS, ALPHAS)] +
         [(make_win_metric(metric, win), typ)
-         for (metric, typ), win in itertools.product(WINDOWED, WINDOWS)])
+         for (metric, typ), win in itertools.product(WINDOWED, WINDOWS)] +
+        [(make_hist_metric(metric, bkt), typ)
+         for (metric, typ), bkt in itertools.product(
+             HISTOGRAMS, range(HIST_BKTS))] +
+        [(make_spectrum_metric(metric, period), typ)
+         for (metric, typ), period in itertools.product(
+             SPECTRA, SPECTRUM_PERIODS)])
 
 
 SEQ_FET = "seq"
 ARRIVAL_TIME_FET = "arrival time us"
 MIN_RTT_FET = "min RTT us"
+WINDOWED_MIN_RTT_FET = "windowed min RTT us"
 INTERARR_TIME_FET = "interarrival time us"
 INV_INTERARR_TIME_FET = "inverse interarrival time b/s"
 PACKETS_LOST_FET = "packets lost since last packet"
@@ -42,6 +60,10 @@ TOTAL_SO_FAR_FET = "total so far B"
 PAYLOAD_SO_FAR_FET = "payload so far B"
 RTT_FET = "RTT us"
 RTT_RATIO_FET = "RTT ratio us"
+RTT_P90_FET = "90th percentile RTT us"
+INTERARR_TIME_P10_FET = "10th percentile interarrival time us"
+ONE_WAY_DELAY_FET = "one way delay us"
+QUEUE_DELAY_FET = "queueing delay us"
 ACTIVE_FLOWS_FET = "active flows"
 BW_FAIR_SHARE_FRAC_FET = "bandwidth fair share frac"
 BW_FAIR_SHARE_BPS_FET = "bandwidth fair share b/s"
@@ -53,6 +75,15 @@ TPUT_TO_FAIR_SHARE_RATIO_FET = "throughput to fair share ratio"
 LABEL_FET = "class"
 MATHIS_TPUT_FET = "mathis model throughput b/s"
 
+# Sender-side features.
+SEND_TIME_FET = "send time us"
+INTERDEP_TIME_FET = "interdeparture time us"
+SENDER_RTT_FET = "sender RTT us"
+IN_FLIGHT_FET = "in flight estimate B"
+SEND_RATE_FET = "send rate b/s"
+TIME_SINCE_ACK_FET = "time since last ACK us"
+ACK_INTERARR_TIME_FET = "ACK interarrival time us"
+
 # Additional features used when parking packets.
 TS_1_FET = "timestamp 1 us"
 TS_2_FET = "timestamp 2 us"
@@ -67,7 +98,10 @@ REGULAR = [
     (ARRIVAL_TIME_FET, "int32"),
     (RTT_FET, "int32"),
     (MIN_RTT_FET, "int32"),
+    (WINDOWED_MIN_RTT_FET, "int32"),
     (RTT_RATIO_FET, "float64"),
+    (ONE_WAY_DELAY_FET, "int32"),
+    (QUEUE_DELAY_FET, "int32"),
     (INTERARR_TIME_FET, "int32"),
     (INV_INTERARR_TIME_FET, "float64"),
     (PACKETS_LOST_FET, "int32"),
@@ -90,6 +124,8 @@ EWMAS = [
     (INV_INTERARR_TIME_FET, "float64"),
     (RTT_FET, "float64"),
     (RTT_RATIO_FET, "float64"),
+    (ONE_WAY_DELAY_FET, "float64"),
+    (QUEUE_DELAY_FET, "float64"),
     (LOSS_RATE_FET, "float64"),
     (MATHIS_TPUT_FET, "float64")
 ]
@@ -106,12 +142,62 @@ WINDOWED = [
     (TPUT_TO_FAIR_SHARE_RATIO_FET, "float64"),
     (RTT_FET, "float64"),
     (RTT_RATIO_FET, "float64"),
+    (RTT_P90_FET, "float64"),
+    (INTERARR_TIME_P10_FET, "float64"),
+    (ONE_WAY_DELAY_FET, "float64"),
+    (QUEUE_DELAY_FET, "float64"),
     (LOSS_EVENT_RATE_FET, "float64"),
     (SQRT_LOSS_EVENT_RATE_FET, "float64"),
     (LOSS_RATE_FET, "float64"),
+    (RETRANS_RATE_FET, "float64"),
     (MATHIS_TPUT_FET, "float64")
 ]
 
+# These metrics are calculated from the sender's view of a flow, with one entry
+# per sent data packet. They are stored separately from the receiver-side
+# metrics above.
+SENDER = [
+    # See REGULAR for details.
+    (SEQ_FET, "int64"),
+    (SEND_TIME_FET, "int64"),
+    (INTERDEP_TIME_FET, "int32"),
+    (PAYLOAD_FET, "int32"),
+    (SENDER_RTT_FET, "int32"),
+    (IN_FLIGHT_FET, "int64"),
+    (SEND_RATE_FET, "float64"),
+    (TIME_SINCE_ACK_FET, "int32"),
+    (ACK_INTERARR_TIME_FET, "int32")
+]
+
+# These metrics are histograms over a window of packets, with one feature per
+# bucket. See streaming.LogHistogram for the bucket boundaries.
+HISTOGRAMS = [
+    (INTERARR_TIME_FET, "int32")
+]
+
+# The number of buckets in each histogram. The last bucket starts at 2**18 us
+# (about 262 ms).
+HIST_BKTS = 20
+
+# Maps the name of each histogram bucket feature to its histogram's metric.
+HIST_FETS = {
+    make_hist_metric(metric, bkt): metric
+    for (metric, _), bkt in itertools.product(HISTOGRAMS, range(HIST_BKTS))}
+
+# These metrics are the fraction of a binned signal's energy at various periods,
+# which captures periodic behavior such as BBR's 8-RTT probing cycle. See
+# streaming.SlidingDft. The signal for WIRELEN_FET is the number of bytes that
+# arrive in each bin (i.e., the arrival rate).
+SPECTRA = [
+    (WIRELEN_FET, "float64")
+]
+
+# The periods (multiples of the minimum RTT) at which to evaluate the spectral
+# power metrics. Each must evenly divide the spectrum window duration
+# (defaults.SPECTRUM_BINS * defaults.SPECTRUM_BIN_RTTS) and be at least two
+# bins long.
+SPECTRUM_PERIODS = [2, 4, 8, 16]
+
 # The alpha values at which to evaluate the EWMA metrics.
 ALPHAS = [i / 1000 for i in range(1, 11)] + [i / 10 for i in range(1, 11)]
 
@@ -123,6 +209,9 @@ WINDOWS = [2**i for i in range(11)]
 # should not be used as training inputs (i.e., should never be in "in_spc").
 UNKNOWABLE_FETS = [
     DROP_RATE_FET,
+    # Require matching the sender's and receiver's packet traces.
+    ONE_WAY_DELAY_FET,
+    QUEUE_DELAY_FET,
     RETRANS_RATE_FET,
     ACTIVE_FLOWS_FET,
     BW_FAIR_SHARE_FRAC_FET,
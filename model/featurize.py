@@ -0,0 +1,92 @@
+#! /usr/bin/env python3
+"""
+Batch-mode featurization front-end. Parses a directory of experiments, or an
+explicit list of experiment archives, using a single pool of workers that pull
+experiments one at a time, so that a worker that finishes a small experiment
+immediately picks up the next one instead of waiting on a pre-assigned batch.
+
+Unlike running gen_features.py through utils.py, this only imports the modules
+needed to parse pcaps (not torch, scapy, matplotlib, or sklearn), so workers
+start quickly and use less memory. Each worker reuses one pcap read buffer
+(see parse_utils.read_pcap()) across all of the experiments that it parses.
+"""
+
+import argparse
+import multiprocessing
+import os
+from os import path
+import time
+
+import defaults
+import gen_features
+import numa
+
+
+def find_exps(exp_dir, exp_flps):
+    """
+    Returns the experiment archives to parse: the provided archives plus every
+    archive in exp_dir (if exp_dir is not None). Experiments are returned
+    largest first, so that the longest experiments do not start last and
+    leave the other workers idle at the end.
+    """
+    exp_flps = list(exp_flps)
+    if exp_dir is not None:
+        exp_flps.extend(
+            path.join(exp_dir, exp) for exp in os.listdir(exp_dir)
+            if exp.endswith(".tar.gz"))
+    for exp_flp in exp_flps:
+        assert path.isfile(exp_flp), f"Experiment does not exist: {exp_flp}"
+    return sorted(set(exp_flps), key=path.getsize, reverse=True)
+
+
+def parse_exp(args):
+    """ Wrapper for gen_features.parse_exp() for use with imap_unordered(). """
+    return gen_features.parse_exp(*args)
+
+
+def main():
+    """ This program's entrypoint. """
+    # Parse command line arguments.
+    psr = argparse.ArgumentParser(
+        description=(
+            "Parses a batch of CloudLab experiments into feature files."))
+    psr.add_argument(
+        "exps", nargs="*", default=[],
+        help="Experiment archives (.tar.gz) to parse.", type=str)
+    psr.add_argument(
+        "--exp-dir", default=None,
+        help=("A directory in which experiment results are stored. Every "
+              "archive in this directory is parsed."), type=str)
+    args = gen_features.add_args(psr).parse_args()
+    assert args.exps or args.exp_dir is not None, \
+        "Must specify experiment archives, --exp-dir, or both."
+    assert args.parallel > 0, \
+        f"\"--parallel\" must be positive, but is: {args.parallel}"
+
+    pcaps = gen_features.get_parse_args(
+        find_exps(args.exp_dir, args.exps), args)
+    num_exps = len(pcaps)
+    print(f"Num files: {num_exps}")
+    numastat = numa.read_numastat()
+    tim_srt_s = time.time()
+    if defaults.SYNC:
+        smallest_safe_wins = [parse_exp(pcap) for pcap in pcaps]
+    else:
+        smallest_safe_wins = []
+        with multiprocessing.Pool(
+                processes=min(args.parallel, max(1, num_exps)),
+                **numa.pool_kwargs()) as pol:
+            # chunksize=1 hands out one experiment at a time to whichever
+            # worker is free. Each experiment is parsed by a single worker,
+            # so its buffers stay on that worker's NUMA node.
+            for idx, win in enumerate(
+                    pol.imap_unordered(parse_exp, pcaps, chunksize=1)):
+                smallest_safe_wins.append(win)
+                print(f"Finished {idx + 1}/{num_exps} experiments")
+    print(f"Done parsing - time: {time.time() - tim_srt_s:.2f} seconds")
+    numa.report(numastat)
+    gen_features.report_safe_wins(smallest_safe_wins)
+
+
+if __name__ == "__main__":
+    main()
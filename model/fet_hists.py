@@ -8,6 +8,7 @@ from matplotlib import pyplot
 import numpy as np
 
 import cl_args
+import defaults
 
 
 def main():
@@ -24,7 +25,7 @@ def main():
     assert path.exists(dat_flp), f"File does not exist: {dat_flp}"
 
     # Read data.
-    dat = np.load(dat_flp)
+    dat = np.load(dat_flp, max_header_size=defaults.NPY_MAX_HEADER_B)
     num_arrays = len(dat.files)
     assert num_arrays == 5, f"Expected 5 arrays, but found: {dat.files}"
     dat_in = dat["dat_in"]
@@ -0,0 +1,189 @@
+"""
+Seekable compressed arrays, used to store training, validation, and test
+splits compactly.
+
+A file holds a 1D numpy array as a sequence of independently-compressed zstd
+frames of frame_rows rows each, followed by a zstd skippable frame that
+contains the frame index. The file is a valid zstd stream, so "zstd -d"
+decompresses it to the array's raw bytes. The skippable frame's payload is:
+    (uint64 end offset of each data frame) * num_frames,
+    uint64 num_frames, uint64 frame_rows, uint32 SEEK_MAGIC
+
+Because the frames are independent, reading a few rows decompresses only the
+frames that contain them, and reading many rows decompresses frames in
+parallel (zstandard releases the GIL).
+"""
+
+import collections
+import concurrent.futures
+import multiprocessing
+import os
+import struct
+
+import numpy as np
+import zstandard
+
+import defaults
+
+
+# The magic number of a zstd skippable frame.
+SKIPPABLE_MAGIC = 0x184D2A5E
+SKIPPABLE_HEADER = struct.Struct("<II")
+# The end of the index.
+INDEX_TRAILER = struct.Struct("<QQI")
+SEEK_MAGIC = 0x8F92EAB1
+
+
+def get_frame_rows(dtype, frame_B=defaults.SPLIT_FRAME_B):
+    """
+    Returns the number of rows of the provided dtype to put in each frame.
+    """
+    return max(1, frame_B // np.dtype(dtype).itemsize)
+
+
+def write(flp, dat, level=defaults.SPLIT_COMPRESSION_LEVEL,
+          frame_rows=None, parallel=multiprocessing.cpu_count()):
+    """
+    Compresses the 1D array dat (e.g., an np.memmap) and writes it to flp,
+    compressing frames in parallel. Writes to a temporary file first, so flp
+    never contains a partial file. Returns the size of flp in bytes.
+    """
+    assert len(dat.shape) == 1, f"Array must be 1D, but has shape: {dat.shape}"
+    if frame_rows is None:
+        frame_rows = get_frame_rows(dat.dtype)
+    num_rows = dat.shape[0]
+
+    def compress(srt):
+        # ZstdCompressor objects are not thread-safe, so use one per frame.
+        return zstandard.ZstdCompressor(level=level).compress(
+            np.ascontiguousarray(dat[srt:srt + frame_rows]).tobytes())
+
+    ends = []
+    tmp_flp = f"{flp}.tmp"
+    with open(tmp_flp, "wb") as fil, \
+            concurrent.futures.ThreadPoolExecutor(parallel) as pol:
+        # map() yields frames in order.
+        for frame in pol.map(compress, range(0, num_rows, frame_rows)):
+            fil.write(frame)
+            ends.append(fil.tell())
+        payload = (
+            np.array(ends, dtype="<u8").tobytes() +
+            INDEX_TRAILER.pack(len(ends), frame_rows, SEEK_MAGIC))
+        fil.write(SKIPPABLE_HEADER.pack(SKIPPABLE_MAGIC, len(payload)))
+        fil.write(payload)
+    os.rename(tmp_flp, flp)
+    return os.path.getsize(flp)
+
+
+class FrameReader:
+    """
+    Reads an array written by write(). Supports len(), "shape", "dtype", and
+    indexing with an integer, a slice, or an array of indices, like a
+    read-only np.memmap. Indexing returns an in-memory copy. Recently
+    decompressed frames are cached.
+    """
+
+    def __init__(self, flp, dtype, num_rows,
+                 cache_frames=defaults.SPLIT_FRAME_CACHE):
+        self.flp = flp
+        self.dtype = np.dtype(dtype)
+        self.shape = (num_rows,)
+        self.fd = os.open(flp, os.O_RDONLY)
+        size_B = os.fstat(self.fd).st_size
+        num_frames, self.frame_rows, magic = INDEX_TRAILER.unpack(
+            os.pread(self.fd, INDEX_TRAILER.size, size_B - INDEX_TRAILER.size))
+        assert magic == SEEK_MAGIC, f"Missing frame index: {flp}"
+        ends = np.frombuffer(
+            os.pread(
+                self.fd, num_frames * 8,
+                size_B - INDEX_TRAILER.size - num_frames * 8),
+            dtype="<u8").astype(np.int64)
+        self.srts = np.concatenate(([0], ends[:-1]))
+        self.ends = ends
+        assert num_rows <= num_frames * self.frame_rows, \
+            (f"Frame index of {flp} covers fewer than {num_rows} rows")
+        self.cache_frames = cache_frames
+        # Maps frame index to decompressed frame, in order of last use.
+        self.cache = collections.OrderedDict()
+
+    def __del__(self):
+        if getattr(self, "fd", None) is not None:
+            os.close(self.fd)
+            self.fd = None
+
+    def __len__(self):
+        return self.shape[0]
+
+    def decompress(self, frame):
+        """ Returns the provided frame as an array. Thread-safe. """
+        srt_B = self.srts[frame]
+        return np.frombuffer(
+            zstandard.ZstdDecompressor().decompress(
+                os.pread(self.fd, self.ends[frame] - srt_B, srt_B)),
+            dtype=self.dtype)
+
+    def get_frame(self, frame):
+        """ Returns the provided frame, from the cache if possible. """
+        if frame in self.cache:
+            self.cache.move_to_end(frame)
+            return self.cache[frame]
+        dat = self.decompress(frame)
+        self.cache[frame] = dat
+        if len(self.cache) > self.cache_frames:
+            self.cache.popitem(last=False)
+        return dat
+
+    def __getitem__(self, key):
+        if isinstance(key, slice):
+            srt, end, step = key.indices(self.shape[0])
+            if step == 1:
+                return self.read_into(
+                    np.empty((max(0, end - srt),), dtype=self.dtype), srt)
+            key = np.arange(srt, end, step)
+        idxs = np.asarray(key)
+        scalar = idxs.ndim == 0
+        idxs = idxs.reshape(-1)
+        if idxs.size == 0:
+            return np.empty((0,), dtype=self.dtype)
+        idxs = np.where(idxs < 0, idxs + self.shape[0], idxs)
+        assert ((idxs >= 0) & (idxs < self.shape[0])).all(), \
+            f"Index out of bounds for shape {self.shape}"
+        frames = idxs // self.frame_rows
+        out = np.empty(idxs.shape, dtype=self.dtype)
+        # Group the indices by frame with one sort, so that each frame that
+        # the indices touch is decompressed once and its indices are a
+        # contiguous run of order.
+        order = np.argsort(frames, kind="stable")
+        srt_frames = frames[order]
+        bounds = np.flatnonzero(np.diff(srt_frames)) + 1
+        for run in np.split(order, bounds):
+            frame = int(frames[run[0]])
+            out[run] = self.get_frame(frame)[
+                idxs[run] - frame * self.frame_rows]
+        return out[0] if scalar else out
+
+    def read_into(self, out, srt=0, parallel=multiprocessing.cpu_count()):
+        """
+        Decompresses rows [srt, srt + len(out)) into out, decompressing frames
+        in parallel. Returns out.
+        """
+        end = srt + out.shape[0]
+        assert 0 <= srt <= end <= self.shape[0], \
+            f"Invalid range [{srt}, {end}) for shape {self.shape}"
+        if srt == end:
+            return out
+
+        def copy(frame):
+            frm_srt = frame * self.frame_rows
+            dat = self.decompress(frame)
+            # The portion of this frame that falls within [srt, end).
+            lo = max(srt, frm_srt)
+            hi = min(end, frm_srt + dat.shape[0])
+            out[lo - srt:hi - srt] = dat[lo - frm_srt:hi - frm_srt]
+
+        frames = range(
+            srt // self.frame_rows, (end - 1) // self.frame_rows + 1)
+        with concurrent.futures.ThreadPoolExecutor(parallel) as pol:
+            # Consume the results to surface any exceptions.
+            list(pol.map(copy, frames))
+        return out
@@ -11,7 +11,6 @@ import subprocess
 import os
 from os import path
 import random
-import shutil
 import sys
 import time
 import traceback
@@ -19,10 +18,12 @@ import traceback
 import json
 import numpy as np
 
-import cl_args
 import defaults
 import features
-import utils
+import numa
+import parse_utils
+import staging
+import streaming
 
 
 # Mathis model constant.
@@ -83,8 +84,9 @@ def loss_rate(loss_q, win_start_idx, pkt_loss_cur, recv_time_cur_us,
 
 def get_time_bounds(pkts, direction="data"):
     """
-    Returns the earliest and latest times in a particular direction of each flow
-    in a trace. pkts is in the format produced by utils.parse_packets().
+    Returns the earliest and latest times in a particular direction of each
+    flow in a trace. pkts is in the format produced by
+    parse_utils.parse_packets().
 
     Returns a list of tuples of the form:
         ( time of first packet, time of last packet )
@@ -98,17 +100,256 @@ def get_time_bounds(pkts, direction="data"):
         for flw in pkts.keys()]
 
 
+def get_transmission_ordinals(seqs):
+    """
+    Returns an array where entry i is the number of packets before packet i
+    that have the same sequence number as packet i. I.e., the first
+    transmission of a sequence number has ordinal 0, its first retransmission
+    has ordinal 1, etc.
+    """
+    num_pkts = seqs.shape[0]
+    ords = np.zeros((num_pkts,), dtype="int64")
+    if num_pkts == 0:
+        return ords
+    order = np.argsort(seqs, kind="stable")
+    seqs_srt = seqs[order]
+    # The index in seqs_srt at which each group of identical sequence numbers
+    # starts.
+    grp_starts = np.flatnonzero(
+        np.concatenate(([True], seqs_srt[1:] != seqs_srt[:-1])))
+    # Repeat each group's start index once for each packet in the group.
+    pkt_grp_starts = np.repeat(
+        grp_starts, np.diff(np.append(grp_starts, num_pkts)))
+    ords[order] = np.arange(num_pkts) - pkt_grp_starts
+    return ords
+
+
+def match_packets(snd_data_pkts, recv_data_pkts):
+    """
+    Matches each received data packet with the transmission that produced it,
+    using the key (sequence number, transmission ordinal). I.e., the k-th
+    arrival of a sequence number is matched with the k-th transmission of that
+    sequence number. Returns an array containing the index in snd_data_pkts of
+    each received packet's transmission, or -1 if the received packet has an
+    unknown sequence number or no matching transmission.
+
+    If a transmission was dropped, then the next arrival of its sequence number
+    is matched with the dropped transmission.
+    """
+    num_snd = snd_data_pkts.shape[0]
+    snd_idxs = np.full((recv_data_pkts.shape[0],), -1, dtype="int64")
+    if num_snd == 0:
+        return snd_idxs
+    snd_seqs = snd_data_pkts[features.SEQ_FET].astype("int64")
+    recv_seqs = recv_data_pkts[features.SEQ_FET].astype("int64")
+
+    def make_keys(seqs):
+        """
+        Combines each sequence number and its transmission ordinal into a
+        single key. Sequence numbers are at most 32 bits, which leaves 24 bits
+        for the ordinal.
+        """
+        return (seqs << 24) | np.minimum(
+            get_transmission_ordinals(seqs), 2**24 - 1)
+
+    # Sort the sent packets' keys once, then look up every received packet's
+    # key with a vectorized binary search.
+    snd_keys = make_keys(snd_seqs)
+    snd_order = np.argsort(snd_keys, kind="stable")
+    snd_keys_srt = snd_keys[snd_order]
+    recv_keys = make_keys(recv_seqs)
+    found = np.minimum(np.searchsorted(snd_keys_srt, recv_keys), num_snd - 1)
+    matched = (recv_seqs != -1) & (snd_keys_srt[found] == recv_keys)
+    snd_idxs[matched] = snd_order[found[matched]]
+    return snd_idxs
+
+
+def get_one_way_delays(snd_data_pkts, recv_data_pkts, snd_idxs, win_us):
+    """
+    Returns two arrays with one entry per received packet:
+        (one-way delay (us), queueing delay (us))
+    snd_idxs maps each received packet to its transmission (see
+    match_packets()). The queueing delay is the one-way delay minus the minimum
+    one-way delay during the previous win_us. Packets without a matching
+    transmission have values of -1 (unknown).
+
+    The client and server clocks are not synchronized, so a raw one-way delay
+    includes the offset between them and may be negative. The returned one-way
+    delays are relative to the flow's minimum raw one-way delay, which removes
+    the offset (along with the propagation delay), so known values are never
+    negative and cannot be mistaken for -1. The queueing delay is unaffected,
+    since the offset cancels out. If a transmission was dropped, then the
+    matching overestimates the delay of the next arrival of its sequence
+    number.
+    """
+    num_recv = recv_data_pkts.shape[0]
+    owds = np.full((num_recv,), -1, dtype="int64")
+    qdelays = np.full((num_recv,), -1, dtype="int64")
+    matched = snd_idxs != -1
+    owds[matched] = (
+        recv_data_pkts[features.ARRIVAL_TIME_FET][matched].astype("int64") -
+        snd_data_pkts[features.ARRIVAL_TIME_FET][snd_idxs[matched]])
+    if matched.any():
+        owds[matched] -= owds[matched].min()
+
+    min_owd = streaming.WindowedMin(win_us)
+    recv_times_us = recv_data_pkts[features.ARRIVAL_TIME_FET].tolist()
+    for j, owd_us in enumerate(owds.tolist()):
+        min_owd_us = min_owd.update(recv_times_us[j], owd_us)
+        if owd_us != -1:
+            qdelays[j] = owd_us - min_owd_us
+    return owds, qdelays
+
+
+def get_retransmissions(snd_data_pkts, packet_seq):
+    """
+    Returns two boolean arrays indicating whether each sent packet carries
+    data (i.e., consumes sequence numbers) and whether it is a retransmission,
+    i.e., whether any of its sequence numbers were sent before. packet_seq
+    indicates whether the flow uses packet-based (as opposed to byte-based)
+    sequence numbers.
+    """
+    num_pkts = snd_data_pkts.shape[0]
+    data = np.zeros((num_pkts,), dtype=bool)
+    retrans = np.zeros((num_pkts,), dtype=bool)
+    tracker = streaming.SeqRangeTracker()
+    seqs = snd_data_pkts[features.SEQ_FET].tolist()
+    payloads_B = snd_data_pkts[features.PAYLOAD_FET].tolist()
+    for idx in range(num_pkts):
+        seq = seqs[idx]
+        length = 1 if packet_seq else payloads_B[idx]
+        # Packets without a payload (e.g., pure ACKs) do not consume sequence
+        # numbers.
+        if seq == -1 or length <= 0:
+            continue
+        data[idx] = True
+        retrans[idx] = tracker.add(seq, length)
+        # In the event of sequence number wraparound, start tracking again.
+        if seq + length > 2**32:
+            tracker = streaming.SeqRangeTracker()
+    return data, retrans
+
+
+def get_sender_dir(out_dir):
+    """
+    Returns the directory in which to save the sender-side features of the
+    experiments whose results are saved in out_dir.
+    """
+    return path.normpath(out_dir) + defaults.SENDER_DIR_SUFFIX
+
+
+def gen_sender_features(cca, snd_data_pkts, snd_ack_pkts):
+    """
+    Calculates sender-side features for one flow using the client's view of
+    that flow. Returns a structured array with one row per sent data packet
+    and the columns in features.SENDER. -1 implies that a value could not be
+    calculated.
+    """
+    num_pkts = snd_data_pkts.shape[0]
+    num_acks = snd_ack_pkts.shape[0]
+    output = np.full((num_pkts,), -1, dtype=features.SENDER)
+    if num_pkts == 0:
+        return output
+    snd_times_us = snd_data_pkts[features.ARRIVAL_TIME_FET].astype("int64")
+    ack_times_us = snd_ack_pkts[features.ARRIVAL_TIME_FET].astype("int64")
+    payloads_B = snd_data_pkts[features.PAYLOAD_FET].astype("int64")
+    output[features.SEQ_FET] = snd_data_pkts[features.SEQ_FET]
+    output[features.SEND_TIME_FET] = snd_times_us
+    output[features.PAYLOAD_FET] = payloads_B
+    output[features.INTERDEP_TIME_FET][1:] = np.diff(snd_times_us)
+
+    # Calculate one RTT sample per ACK, if possible.
+    rtt_smps_us = np.full((num_acks,), -1, dtype="int64")
+    keys = None
+    if cca == "copa":
+        # A Copa ACK contains the sequence number of the data packet that it
+        # acknowledges.
+        keys = snd_data_pkts[features.SEQ_FET]
+        ack_keys = snd_ack_pkts[features.SEQ_FET]
+    elif cca == "vivace":
+        # UDT ACKs may contain the RTT (see parse_utils.parse_packets()).
+        ack_rtts_us = snd_ack_pkts[features.TS_1_FET]
+        rtt_smps_us = np.where(ack_rtts_us > 0, ack_rtts_us, -1)
+    else:
+        # A TCP ACK echoes the TSval of the data packet that triggered it in
+        # its TSecr. TSval has a coarse granularity, so many data packets may
+        # have the same TSval. Match each ACK with the first of them, which is
+        # conservative.
+        keys = snd_data_pkts[features.TS_1_FET]
+        ack_keys = snd_ack_pkts[features.TS_2_FET]
+    if keys is not None and num_acks > 0:
+        # Match each ACK with the first data packet with the same key.
+        uniq_keys, first_idxs = np.unique(keys, return_index=True)
+        found = np.minimum(
+            np.searchsorted(uniq_keys, ack_keys), uniq_keys.shape[0] - 1)
+        matched = (ack_keys != -1) & (uniq_keys[found] == ack_keys)
+        rtt_smps_us[matched] = (
+            ack_times_us[matched] - snd_times_us[first_idxs[found[matched]]])
+        rtt_smps_us[rtt_smps_us < 0] = -1
+
+    # For each data packet, find the last ACK that arrived before it was sent.
+    last_acks = np.searchsorted(ack_times_us, snd_times_us, side="right") - 1
+    acked = last_acks >= 0
+    output[features.TIME_SINCE_ACK_FET][acked] = (
+        snd_times_us[acked] - ack_times_us[last_acks[acked]])
+    clocked = last_acks >= 1
+    output[features.ACK_INTERARR_TIME_FET][clocked] = (
+        ack_times_us[last_acks[clocked]] -
+        ack_times_us[last_acks[clocked] - 1])
+
+    # The sender's RTT estimate when sending each data packet is the most
+    # recent RTT sample from an ACK that arrived before the packet was sent.
+    # For each ACK, find the index of the most recent ACK with an RTT sample.
+    latest_smps = np.maximum.accumulate(
+        np.where(rtt_smps_us != -1, np.arange(num_acks), -1))
+    rtts_us = np.full((num_pkts,), -1, dtype="int64")
+    if num_acks > 0:
+        smp_idxs = np.where(acked, latest_smps[np.maximum(last_acks, 0)], -1)
+        rtts_us[smp_idxs != -1] = rtt_smps_us[smp_idxs[smp_idxs != -1]]
+    output[features.SENDER_RTT_FET] = rtts_us
+
+    # Estimate the data in flight as the data sent during the last RTT, and the
+    # send rate as that amount of data divided by the RTT.
+    known = rtts_us > 0
+    payloads_sum_B = np.cumsum(payloads_B)
+    win_starts = np.searchsorted(
+        snd_times_us, snd_times_us - rtts_us, side="right")
+    in_flight_B = payloads_sum_B - np.where(
+        win_starts > 0, payloads_sum_B[np.maximum(win_starts - 1, 0)], 0)
+    output[features.IN_FLIGHT_FET][known] = in_flight_B[known]
+    output[features.SEND_RATE_FET][known] = (
+        in_flight_B[known] * 8 * 1e6 / rtts_us[known])
+    return output
+
+
+def move_window_start(arr_times_us, target_us, start_idx, end_idx):
+    """
+    Returns the index of the first packet in arr_times_us[:end_idx + 1] that
+    arrived at or after target_us. start_idx is the previous start of the
+    window. Usually the window only moves later in time, so the search walks
+    forward from start_idx. However, if the window's duration increased (e.g.,
+    because a windowed min RTT increased), then the start of the window may
+    move earlier in time, in which case this does a binary search instead.
+    """
+    if start_idx > 0 and arr_times_us[start_idx - 1] >= target_us:
+        start_idx = int(np.searchsorted(
+            arr_times_us[:end_idx + 1], target_us, side="left"))
+    return parse_utils.find_bound(
+        arr_times_us, target=target_us, min_idx=start_idx, max_idx=end_idx,
+        which="after")
+
+
 @contextmanager
-def open_exp(exp, exp_flp, untar_dir, out_dir, out_flp):
+def open_exp(exp, exp_flp, untar_dir, spill_dir, budget_B, out_dir, out_flp):
     """
-    Locks and untars an experiment. Cleans up the lock and untarred files
+    Locks and untars an experiment. The untarred files count against
+    untar_dir's staging budget of budget_B bytes, and are placed in spill_dir
+    if they do not fit (see staging.py). Cleans up the lock and untarred files
     automatically.
     """
     lock_flp = path.join(out_dir, f"{exp.name}.lock")
-    exp_dir = path.join(untar_dir, exp.name)
     # Keep track of what we do.
     locked = False
-    untarred = False
     try:
         # Check the lock file for this experiment.
         if path.exists(lock_flp):
@@ -126,26 +367,28 @@ def open_exp(exp, exp_flp, untar_dir, out_dir, out_flp):
             # Create a temporary folder to untar experiments.
             if not path.exists(untar_dir):
                 os.mkdir(untar_dir)
-            # If this experiment has already been untarred, then delete the old
-            # files.
-            if path.exists(exp_dir):
-                shutil.rmtree(exp_dir)
-            untarred = True
-            subprocess.check_call(["tar", "-xf", exp_flp, "-C", untar_dir])
-            yield True, exp_dir
+            # The staging directory, and therefore the untarred files, are
+            # deleted when the reservation ends.
+            with staging.reserve(
+                    staging.get_gzip_size_B(exp_flp), untar_dir, spill_dir,
+                    budget_B, name=exp.name) as stage_dir:
+                subprocess.check_call(["tar", "-xf", exp_flp, "-C", stage_dir])
+                yield True, path.join(stage_dir, exp.name)
     finally:
-        # Remove an entity only if we created it.
-        #
-        # Remove untarred folder
-        if locked and path.exists(exp_dir):
-            shutil.rmtree(exp_dir)
-        # Remove lock file.
-        if untarred and path.exists(lock_flp):
+        # Remove the lock file only if we created it.
+        if locked and path.exists(lock_flp):
             os.remove(lock_flp)
 
 
-def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
-    """ Parses an experiment. Returns the smallest safe window size. """
+def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed,
+                     win_min_rtt, hist_win):
+    """
+    Parses an experiment. Returns the smallest safe window size. win_min_rtt
+    is either "cumulative" or "windowed", and determines which min RTT
+    estimate the windowed metrics use as their unit of time. hist_win is the
+    duration (in multiples of that min RTT) of the window over which the
+    histogram features are computed.
+    """
     print(f"Parsing: {exp_flp}")
     if exp.name.startswith("FAILED"):
         print(f"Error: Experimant failed: {exp_flp}")
@@ -172,11 +415,24 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
 
     client_pcap = path.join(exp_dir, f"client-tcpdump-{exp.name}.pcap")
     server_pcap = path.join(exp_dir, f"server-tcpdump-{exp.name}.pcap")
-    if not (path.exists(client_pcap) and path.exists(server_pcap)):
+    if not path.exists(server_pcap):
         print(f"Warning: Missing pcap file in: {exp_flp}")
         return -1
-    flw_to_pkts_client = utils.parse_packets(client_pcap, flw_to_cca)
-    flw_to_pkts_server = utils.parse_packets(server_pcap, flw_to_cca)
+    flw_to_pkts_server = parse_utils.parse_packets(server_pcap, flw_to_cca)
+    # The client (sender) pcap is optional, e.g., for flows that were recorded
+    # at the receiver by capture.FlowRecorder. Without it, the features that
+    # require the sender's view of a flow are unknown (-1).
+    have_client = path.exists(client_pcap)
+    if have_client:
+        flw_to_pkts_client = parse_utils.parse_packets(client_pcap, flw_to_cca)
+    else:
+        print(
+            f"Warning: Missing client pcap file in: {exp_flp}. Sender-side "
+            "features will be unknown.")
+        flw_to_pkts_client = {
+            flw: (np.empty((0,), dtype=features.PARSE_PACKETS_FETS),
+                  np.empty((0,), dtype=features.PARSE_PACKETS_FETS))
+            for flw in flws}
 
     # Determine the path to the bottleneck queue log file.
     toks = exp.name.split("-")
@@ -186,18 +442,19 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
         ".log")
     q_log = None
     if path.exists(q_log_flp):
-        q_log = list(enumerate(utils.parse_queue_log(q_log_flp)))
+        q_log = list(enumerate(parse_utils.parse_queue_log(q_log_flp)))
 
     # Transform absolute times into relative times to make life easier.
     #
     # Determine the absolute earliest time observed in the experiment.
     earliest_time_us = min(
         first_time_us
-        for bounds in [
-            get_time_bounds(flw_to_pkts_client, direction="data"),
-            get_time_bounds(flw_to_pkts_client, direction="ack"),
-            get_time_bounds(flw_to_pkts_server, direction="data"),
-            get_time_bounds(flw_to_pkts_server, direction="ack")]
+        for bounds in (
+            ([get_time_bounds(flw_to_pkts_client, direction="data"),
+              get_time_bounds(flw_to_pkts_client, direction="ack")]
+             if have_client else []) +
+            [get_time_bounds(flw_to_pkts_server, direction="data"),
+             get_time_bounds(flw_to_pkts_server, direction="ack")])
         for first_time_us, _ in bounds)
     # Subtract the earliest time from all times.
     for flw in flws:
@@ -224,11 +481,22 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
     # Process PCAP files from senders and receivers.
     # The final output, with one entry per flow.
     flw_results = {}
+    # The sender-side features, with one entry per flow.
+    flw_snd_results = {}
 
     # Keep track of the number of erroneous throughputs (i.e., higher than the
     # experiment bandwidth) for each window size.
     win_to_errors = {win: 0 for win in features.WINDOWS}
 
+    # The feature to use as the min RTT when calculating window durations.
+    win_min_rtt_fet = (
+        features.WINDOWED_MIN_RTT_FET if win_min_rtt == "windowed"
+        else features.MIN_RTT_FET)
+    # The DFT indices of the spectral power features' periods.
+    spectrum_freqs = [
+        round(defaults.SPECTRUM_BINS * defaults.SPECTRUM_BIN_RTTS / period)
+        for period in features.SPECTRUM_PERIODS]
+
     # Create the (super-complicated) dtype. The dtype combines each metric at
     # multiple granularities.
     dtype = (
@@ -242,6 +510,8 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
         packet_seq = cca in {"copa", "vivace"}
         snd_data_pkts, snd_ack_pkts = flw_to_pkts_client[flw]
         recv_data_pkts, recv_ack_pkts = flw_to_pkts_server[flw]
+        flw_snd_results[flw] = gen_sender_features(
+            cca, snd_data_pkts, snd_ack_pkts)
 
         first_data_time_us = recv_data_pkts[0][features.ARRIVAL_TIME_FET]
 
@@ -250,7 +520,7 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
 
         # If this flow does not have any packets, then skip it.
         skip = False
-        if snd_data_pkts.shape[0] == 0:
+        if have_client and snd_data_pkts.shape[0] == 0:
             skip = True
             print(
                 f"Warning: No data packets sent for flow {flw_idx} in: "
@@ -269,16 +539,46 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
             flw_results[flw] = output
             continue
 
+        # Join the received packets with the sent packets.
+        snd_idxs = match_packets(snd_data_pkts, recv_data_pkts)
+        owds, qdelays = get_one_way_delays(
+            snd_data_pkts, recv_data_pkts, snd_idxs,
+            defaults.QUEUE_DELAY_WIN_US)
+        # The number of data packets and of retransmissions among the first
+        # i + 1 sent packets. Retransmission rates are relative to the number
+        # of data packets, since packets without a payload (e.g., pure ACKs)
+        # cannot be retransmissions.
+        snd_data, snd_retrans = get_retransmissions(snd_data_pkts, packet_seq)
+        snd_data_total = np.cumsum(snd_data)
+        snd_retrans_total = np.cumsum(snd_retrans)
+        snd_times_us = snd_data_pkts[features.ARRIVAL_TIME_FET]
+        num_snd = snd_times_us.shape[0]
+
         # State that the windowed metrics need to track across packets.
         win_state = {win: {
             # The index at which this window starts.
             "window_start_idx": 0,
+            # The index of the first sent packet in the window that ends when
+            # the current packet was sent.
+            "snd_window_start_idx": 0,
             # The "loss event rate".
             "loss_interval_weights": make_interval_weight(8),
             "loss_event_intervals": collections.deque(),
             "current_loss_event_start_idx": 0,
             "current_loss_event_start_time": 0,
+            # Quantile sketches.
+            "rtt_quantiles": streaming.SlidingQuantiles(
+                defaults.QUANTILE_SLOTS, defaults.QUANTILE_SKETCH_K),
+            "interarr_quantiles": streaming.SlidingQuantiles(
+                defaults.QUANTILE_SLOTS, defaults.QUANTILE_SKETCH_K),
         } for win in features.WINDOWS}
+        # Tracks the minimum RTT over a sliding window.
+        min_rtt_filter = streaming.WindowedMin(defaults.MIN_RTT_WIN_US)
+        # Tracks the distribution of interarrival times over a sliding window.
+        interarr_hist = streaming.LogHistogram(features.HIST_BKTS)
+        # Tracks the periodicity of the arrival rate.
+        arr_spectrum = streaming.SlidingDft(
+            defaults.SPECTRUM_BINS, spectrum_freqs)
         # Total number of packet losses up to the current received
         # packet.
         pkt_loss_total_estimate = 0
@@ -316,7 +616,8 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
             retrans = (
                 recv_seq in unique_pkts or
                 (prev_seq is not None and prev_payload_B is not None and
-                 (prev_seq + (1 if packet_seq else prev_payload_B)) > recv_seq))
+                 (prev_seq + (1 if packet_seq else prev_payload_B)) >
+                 recv_seq))
             if retrans:
                 # If this packet is a multiple retransmission, then this line
                 # has no effect.
@@ -348,15 +649,19 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                  f"flow {flw_idx} in: {exp_flp}")
 
             output[j][features.ACTIVE_FLOWS_FET] = active_flws
-            output[j][features.BW_FAIR_SHARE_FRAC_FET] = utils.safe_div(
+            output[j][features.BW_FAIR_SHARE_FRAC_FET] = parse_utils.safe_div(
                 1, active_flws)
-            output[j][features.BW_FAIR_SHARE_BPS_FET] = utils.safe_div(
+            output[j][features.BW_FAIR_SHARE_BPS_FET] = parse_utils.safe_div(
                 exp.bw_bps, active_flws)
 
             # Calculate RTT-related metrics.
             rtt_us = -1
             if not first and recv_seq != -1 and not retrans:
-                if cca == "copa":
+                if cca == "copa" and not have_client:
+                    # Copa RTT estimation requires the sender's view of the
+                    # flow.
+                    pass
+                elif cca == "copa":
                     # In a Copa ACK, the sender timestamp is the time at which
                     # the corresponding data packet was sent. The receiver
                     # timestamp is the time that the data packet was received
@@ -368,19 +673,20 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     # For now, we will just do sender-side RTT estimation. When
                     # selecting which packets to use for the RTT estimate, we
                     # will select the packet/ACK pair whose ACK arrived soonest
-                    # before packet j was sent. This means that the sender would
-                    # have been able to calculate this RTT estimate before
-                    # sending packet j, and could very well have included the
-                    # RTT estimate in packet j's header.
+                    # before packet j was sent. This means that the sender
+                    # would have been able to calculate this RTT estimate
+                    # before sending packet j, and could very well have
+                    # included the RTT estimate in packet j's header.
                     #
-                    # First, find the index of the ACK that was received soonest
-                    # before packet j was sent.
-                    snd_ack_idx = utils.find_bound(
+                    # First, find the index of the ACK that was received
+                    # soonest before packet j was sent.
+                    snd_ack_idx = parse_utils.find_bound(
                         snd_ack_pkts[features.SEQ_FET], recv_seq, snd_ack_idx,
                         snd_ack_pkts.shape[0] - 1, which="before")
                     snd_ack_seq = snd_ack_pkts[snd_ack_idx][features.SEQ_FET]
                     # Then, find this ACK's data packet.
-                    snd_data_seq = snd_data_pkts[snd_data_idx][features.SEQ_FET]
+                    snd_data_seq = snd_data_pkts[snd_data_idx][
+                        features.SEQ_FET]
                     while snd_data_idx < snd_data_pkts.shape[0]:
                         snd_data_seq = snd_data_pkts[snd_data_idx][
                             features.SEQ_FET]
@@ -400,9 +706,9 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                             break
                         snd_data_idx += 1
                 elif cca == "vivace":
-                    # UDT ACKs may contain the RTT. Find the last ACK to be sent
-                    # by the receiver before packet j was received.
-                    recv_ack_idx = utils.find_bound(
+                    # UDT ACKs may contain the RTT. Find the last ACK to be
+                    # sent by the receiver before packet j was received.
+                    recv_ack_idx = parse_utils.find_bound(
                         recv_ack_pkts[features.ARRIVAL_TIME_FET],
                         recv_time_cur_us, recv_ack_idx,
                         recv_ack_pkts.shape[0] - 1, which="before")
@@ -434,27 +740,43 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                         recv_ack_idx += 1
                     else:
                         # If we never found a matching tsval, then use the
-                        # previous RTT estimate and reset recv_ack_idx to search
-                        # again on the next packet.
+                        # previous RTT estimate and reset recv_ack_idx to
+                        # search again on the next packet.
                         rtt_us = output[j - 1][features.RTT_FET]
                         recv_ack_idx = recv_ack_idx_old
 
             recv_time_prev_us = (
                 -1 if first else output[j - 1][features.ARRIVAL_TIME_FET])
-            interarr_time_us = utils.safe_sub(
+            interarr_time_us = parse_utils.safe_sub(
                 recv_time_cur_us, recv_time_prev_us)
             output[j][features.INTERARR_TIME_FET] = interarr_time_us
-            output[j][features.INV_INTERARR_TIME_FET] = utils.safe_mul(
+            output[j][features.INV_INTERARR_TIME_FET] = parse_utils.safe_mul(
                 8 * 1e6 * wirelen_B,
-                utils.safe_div(1, interarr_time_us))
+                parse_utils.safe_div(1, interarr_time_us))
 
             output[j][features.RTT_FET] = rtt_us
-            min_rtt_us = utils.safe_min(
+            min_rtt_us = parse_utils.safe_min(
                 sys.maxsize if first else output[j - 1][features.MIN_RTT_FET],
                 rtt_us)
             output[j][features.MIN_RTT_FET] = min_rtt_us
-            rtt_estimate_ratio = utils.safe_div(rtt_us, min_rtt_us)
+            # Unlike the cumulative min RTT, the windowed min RTT recovers
+            # after the path's base RTT increases. Ignore 0 RTTs, as
+            # parse_utils.safe_min() does.
+            output[j][features.WINDOWED_MIN_RTT_FET] = min_rtt_filter.update(
+                recv_time_cur_us, -1 if rtt_us == 0 else rtt_us)
+            # The min RTT to use as the unit of window durations.
+            win_min_rtt_us = output[j][win_min_rtt_fet]
+            rtt_estimate_ratio = parse_utils.safe_div(rtt_us, min_rtt_us)
             output[j][features.RTT_RATIO_FET] = rtt_estimate_ratio
+            output[j][features.ONE_WAY_DELAY_FET] = owds[j]
+            output[j][features.QUEUE_DELAY_FET] = qdelays[j]
+            # The retransmission rate of all packets sent up to and including
+            # this packet's transmission.
+            snd_idx = snd_idxs[j]
+            output[j][features.RETRANS_RATE_FET] = (
+                -1 if snd_idx == -1 else
+                parse_utils.safe_div(
+                    snd_retrans_total[snd_idx], snd_data_total[snd_idx]))
 
             # Receiver-side loss rate estimation. Estimate the number of lost
             # packets since the last packet. Do not try anything complex or
@@ -480,9 +802,9 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
 
             if pkt_loss_cur_estimate != -1:
                 pkt_loss_total_estimate += pkt_loss_cur_estimate
-            loss_rate_cur = utils.safe_div(
+            loss_rate_cur = parse_utils.safe_div(
                 pkt_loss_cur_estimate,
-                utils.safe_add(pkt_loss_cur_estimate, 1))
+                parse_utils.safe_add(pkt_loss_cur_estimate, 1))
 
             output[j][features.PACKETS_LOST_FET] = pkt_loss_cur_estimate
             output[j][features.LOSS_RATE_FET] = loss_rate_cur
@@ -506,49 +828,86 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     new = rtt_us
                 elif metric.startswith(features.RTT_RATIO_FET):
                     new = rtt_estimate_ratio
+                elif metric.startswith(features.ONE_WAY_DELAY_FET):
+                    new = owds[j]
+                elif metric.startswith(features.QUEUE_DELAY_FET):
+                    new = qdelays[j]
                 elif metric.startswith(features.LOSS_RATE_FET):
                     new = loss_rate_cur
                 elif metric.startswith(features.MATHIS_TPUT_FET):
                     # tput = (MSS / RTT) * (C / sqrt(p))
-                    new = utils.safe_mul(
-                        utils.safe_div(
-                            utils.safe_mul(8, output[j][features.PAYLOAD_FET]),
-                            utils.safe_div(output[j][features.RTT_FET], 1e6)),
-                        utils.safe_div(
+                    new = parse_utils.safe_mul(
+                        parse_utils.safe_div(
+                            parse_utils.safe_mul(
+                                8, output[j][features.PAYLOAD_FET]),
+                            parse_utils.safe_div(
+                                output[j][features.RTT_FET], 1e6)),
+                        parse_utils.safe_div(
                             MATHIS_C,
-                            utils.safe_sqrt(loss_rate_cur)))
+                            parse_utils.safe_sqrt(loss_rate_cur)))
                 else:
                     raise Exception(f"Unknown EWMA metric: {metric}")
                 # Update the EWMA. If this is the first value, then use 0 are
                 # the old value.
-                output[j][metric] = utils.safe_update_ewma(
+                output[j][metric] = parse_utils.safe_update_ewma(
                     -1 if first else output[j - 1][metric], new, alpha)
 
             # If we cannot estimate the min RTT, then we cannot compute any
             # windowed metrics.
-            if min_rtt_us != -1:
-                # Move the window start indices later in time. The min RTT
-                # estimate will never increase, so we do not need to investigate
-                # whether the start of the window moved earlier in time.
+            if win_min_rtt_us != -1:
+                # Move the window start indices. The cumulative min RTT
+                # estimate will never increase, so the windows usually move
+                # later in time. The windowed min RTT may increase, in which
+                # case the windows move earlier in time.
                 for win in features.WINDOWS:
-                    win_state[win]["window_start_idx"] = utils.find_bound(
+                    win_state[win]["window_start_idx"] = move_window_start(
                         output[features.ARRIVAL_TIME_FET],
-                        target=recv_time_cur_us - (win * min_rtt_us),
-                        min_idx=win_state[win]["window_start_idx"],
-                        max_idx=j,
-                        which="after")
+                        target_us=recv_time_cur_us - (win * win_min_rtt_us),
+                        start_idx=win_state[win]["window_start_idx"],
+                        end_idx=j)
+                    # Record this packet in the quantile sketches.
+                    if not skip_smoothed:
+                        win_state[win]["rtt_quantiles"].update(
+                            recv_time_cur_us, output[j][features.RTT_FET],
+                            win * win_min_rtt_us)
+                        win_state[win]["interarr_quantiles"].update(
+                            recv_time_cur_us, interarr_time_us,
+                            win * win_min_rtt_us)
+
+                # Histogram metrics. These are updated incrementally, so
+                # computing them takes constant time per packet.
+                if not skip_smoothed:
+                    for bkt, cnt in enumerate(interarr_hist.update(
+                            recv_time_cur_us, interarr_time_us,
+                            hist_win * win_min_rtt_us)):
+                        output[j][features.make_hist_metric(
+                            features.INTERARR_TIME_FET, bkt)] = cnt
+
+                # Spectral power metrics. Each packet adds its bytes to the
+                # current bin, and each completed bin updates each period's
+                # DFT component in constant time. The bin duration tracks the
+                # min RTT only to within a power of two, so that the signal is
+                # not cleared every time that the min RTT changes.
+                if not skip_smoothed:
+                    arr_spectrum.update(
+                        recv_time_cur_us, wirelen_B,
+                        defaults.SPECTRUM_BIN_RTTS * win_min_rtt_us)
+                    for period, power in zip(
+                            features.SPECTRUM_PERIODS, arr_spectrum.powers()):
+                        output[j][features.make_spectrum_metric(
+                            features.WIRELEN_FET, period)] = power
 
             # Windowed metrics.
             for (metric, _), win in itertools.product(
                     features.WINDOWED, features.WINDOWS):
                 # If we cannot estimate the min RTT, then we cannot compute any
                 # windowed metrics.
-                if skip_smoothed or min_rtt_us == -1:
+                if skip_smoothed or win_min_rtt_us == -1:
                     continue
 
                 # Calculate windowed metrics only if an entire window has
                 # elapsed since the start of the flow.
-                win_size_us = win * min_rtt_us
+                win_size_us = win * win_min_rtt_us
                 if recv_time_cur_us - first_data_time_us < win_size_us:
                     continue
 
@@ -560,15 +919,15 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
 
                 metric = features.make_win_metric(metric, win)
                 if metric.startswith(features.INTERARR_TIME_FET):
-                    new = utils.safe_div(
-                        utils.safe_sub(
+                    new = parse_utils.safe_div(
+                        parse_utils.safe_sub(
                             recv_time_cur_us,
                             output[win_start_idx][features.ARRIVAL_TIME_FET]),
                         j - win_start_idx)
                 elif metric.startswith(features.INV_INTERARR_TIME_FET):
-                    new = utils.safe_mul(
+                    new = parse_utils.safe_mul(
                         8 * 1e6 * wirelen_B,
-                        utils.safe_div(
+                        parse_utils.safe_div(
                             1,
                             output[j][features.make_win_metric(
                                 features.INTERARR_TIME_FET, win)]))
@@ -578,7 +937,7 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     # first packet.
                     #
                     # Sum up the payloads of the packets in the window.
-                    total_bytes = utils.safe_sum(
+                    total_bytes = parse_utils.safe_sum(
                         output[features.WIRELEN_FET],
                         start_idx=win_start_idx + 1, end_idx=j)
                     # Divide by the duration of the window.
@@ -586,10 +945,11 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                         output[win_start_idx][features.ARRIVAL_TIME_FET]
                         if win_start_idx >= 0 else -1)
                     end_time_us = output[j][features.ARRIVAL_TIME_FET]
-                    tput_bps = utils.safe_div(
-                        utils.safe_mul(total_bytes, 8),
-                        utils.safe_div(
-                            utils.safe_sub(end_time_us, start_time_us), 1e6))
+                    tput_bps = parse_utils.safe_div(
+                        parse_utils.safe_mul(total_bytes, 8),
+                        parse_utils.safe_div(
+                            parse_utils.safe_sub(end_time_us, start_time_us),
+                            1e6))
                     # If the throughput exceeds the bandwidth, then record a
                     # warning and do not record this throughput.
                     if tput_bps != -1 and tput_bps > exp.bw_bps:
@@ -608,11 +968,21 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     # This is calculated at the end.
                     continue
                 elif metric.startswith(features.RTT_FET):
-                    new = utils.safe_mean(
+                    new = parse_utils.safe_mean(
                         output[features.RTT_FET], win_start_idx, j)
                 elif metric.startswith(features.RTT_RATIO_FET):
-                    new = utils.safe_mean(
+                    new = parse_utils.safe_mean(
                         output[features.RTT_RATIO_FET], win_start_idx, j)
+                elif metric.startswith(features.RTT_P90_FET):
+                    new = win_state[win]["rtt_quantiles"].quantile(0.9)
+                elif metric.startswith(features.INTERARR_TIME_P10_FET):
+                    new = win_state[win]["interarr_quantiles"].quantile(0.1)
+                elif metric.startswith(features.ONE_WAY_DELAY_FET):
+                    new = parse_utils.safe_mean(
+                        output[features.ONE_WAY_DELAY_FET], win_start_idx, j)
+                elif metric.startswith(features.QUEUE_DELAY_FET):
+                    new = parse_utils.safe_mean(
+                        output[features.QUEUE_DELAY_FET], win_start_idx, j)
                 elif metric.startswith(features.LOSS_EVENT_RATE_FET):
                     rtt_us = output[j][features.make_win_metric(
                         features.RTT_FET, win)]
@@ -661,7 +1031,8 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                                 # which the packet should have been
                                 # received if it had not been lost.
                                 loss_time = (
-                                    recv_time_prev_us + (k + 1) * loss_interval)
+                                    recv_time_prev_us +
+                                    (k + 1) * loss_interval)
 
                                 # If the time of this loss is more
                                 # than one RTT from the time of the
@@ -672,14 +1043,13 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                                     # between the start of the new
                                     # loss event and the start of the
                                     # previous loss event.
-                                    win_state[
-                                        win]["loss_event_intervals"].appendleft(
-                                            new_start_idx - cur_start_idx)
+                                    intervals = win_state[win][
+                                        "loss_event_intervals"]
+                                    intervals.appendleft(
+                                        new_start_idx - cur_start_idx)
                                     # Potentially discard an old event.
-                                    if len(win_state[
-                                            win]["loss_event_intervals"]) > win:
-                                        win_state[
-                                            win]["loss_event_intervals"].pop()
+                                    if len(intervals) > win:
+                                        intervals.pop()
 
                                     cur_start_idx = new_start_idx
                                     cur_start_time = loss_time
@@ -713,25 +1083,57 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                 elif metric.startswith(features.SQRT_LOSS_EVENT_RATE_FET):
                     # Use the loss event rate to compute
                     # 1 / sqrt(loss event rate).
-                    new = utils.safe_div(
+                    new = parse_utils.safe_div(
                         1,
-                        utils.safe_sqrt(output[j][
+                        parse_utils.safe_sqrt(output[j][
                             features.make_win_metric(
                                 features.LOSS_EVENT_RATE_FET, win)]))
+                elif metric.startswith(features.RETRANS_RATE_FET):
+                    # Consider the packets that were sent during the window
+                    # that ends when this packet was sent.
+                    snd_idx = snd_idxs[j]
+                    if snd_idx == -1:
+                        continue
+                    # Equivalent to np.searchsorted(..., side="right"), but
+                    # advances the previous packet's window start instead.
+                    # The window start moves backwards only when packets
+                    # arrive out of order or the window shrinks, so this
+                    # takes amortized constant time.
+                    snd_win_srt_us = snd_times_us[snd_idx] - win_size_us
+                    snd_win_start_idx = win_state[win][
+                        "snd_window_start_idx"]
+                    while (snd_win_start_idx < num_snd and
+                           snd_times_us[snd_win_start_idx] <= snd_win_srt_us):
+                        snd_win_start_idx += 1
+                    while (snd_win_start_idx > 0 and
+                           snd_times_us[snd_win_start_idx - 1] >
+                           snd_win_srt_us):
+                        snd_win_start_idx -= 1
+                    win_state[win]["snd_window_start_idx"] = snd_win_start_idx
+                    new = parse_utils.safe_div(
+                        snd_retrans_total[snd_idx] -
+                        (snd_retrans_total[snd_win_start_idx - 1]
+                         if snd_win_start_idx > 0 else 0),
+                        snd_data_total[snd_idx] -
+                        (snd_data_total[snd_win_start_idx - 1]
+                         if snd_win_start_idx > 0 else 0))
                 elif metric.startswith(features.LOSS_RATE_FET):
-                    win_losses = utils.safe_sum(
-                        output[features.PACKETS_LOST_FET], win_start_idx + 1, j)
-                    new = utils.safe_div(
+                    win_losses = parse_utils.safe_sum(
+                        output[features.PACKETS_LOST_FET], win_start_idx + 1,
+                        j)
+                    new = parse_utils.safe_div(
                         win_losses, win_losses + (j - win_start_idx))
                 elif metric.startswith(features.MATHIS_TPUT_FET):
                     # tput = (MSS / RTT) * (C / sqrt(p))
-                    new = utils.safe_mul(
-                        utils.safe_div(
-                            utils.safe_mul(8, output[j][features.PAYLOAD_FET]),
-                            utils.safe_div(output[j][features.RTT_FET], 1e6)),
-                        utils.safe_div(
+                    new = parse_utils.safe_mul(
+                        parse_utils.safe_div(
+                            parse_utils.safe_mul(
+                                8, output[j][features.PAYLOAD_FET]),
+                            parse_utils.safe_div(
+                                output[j][features.RTT_FET], 1e6)),
+                        parse_utils.safe_div(
                             MATHIS_C,
-                            utils.safe_sqrt(
+                            parse_utils.safe_sqrt(
                                 output[j][features.make_win_metric(
                                     features.LOSS_EVENT_RATE_FET, win)])))
                 else:
@@ -741,7 +1143,8 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
             prev_seq = recv_seq
             prev_payload_B = payload_B
             highest_seq = (
-                prev_seq if highest_seq is None else max(highest_seq, prev_seq))
+                prev_seq if highest_seq is None
+                else max(highest_seq, prev_seq))
             # In the event of sequence number wraparound, reset the sequence
             # number tracking.
             #
@@ -758,64 +1161,22 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
         last_seq = output[-1][features.SEQ_FET]
         if last_seq == -1:
             print(
-                "Warning: Unable to calculate retransmission or bottleneck "
-                "queue drop rates due to unknown last sequence number for "
+                "Warning: Unable to calculate bottleneck queue drop rate due "
+                "to unknown last sequence number for "
                 f"(UDP?) flow {flw_idx} in: {exp_flp}")
         else:
-            # Calculate the true number of retransmissions using the sender
-            # traces.
-            #
-            # Truncate the sent packets at the last occurence of the last packet to
-            # be received.
-            #
-            # Find when the last received packet was sent. Assume that if this
-            # packet was retransmitted, then the last retransmission is the one
-            # that arrived at the receiver (which may be an incorrect
-            # assumption).
-            snd_idx = len(snd_data_pkts) - 1
-            while snd_idx >= 0:
-                if snd_data_pkts[snd_idx][features.SEQ_FET] == last_seq:
-                    # unique_snd_pkts, counts = np.unique(
-                    #     snd_data_pkts[:snd_idx + 1][features.SEQ_FET],
-                    #     return_counts=True)
-                    # unique_snd_pkts = unique_snd_pkts.tolist()
-                    # counts = counts.tolist()
-                    # all_retrans = [
-                    #     (seq, counts)
-                    #     for seq, counts in zip(unique_snd_pkts, counts)
-                    #     if counts > 1]
-
-                    # tot_pkts = snd_idx + 1
-
-                    # The retransmission rate is:
-                    #     1 - unique packets / total packets.
-                    output[-1][features.RETRANS_RATE_FET] = (
-                        1 -
-                        # Find the number of unique sequence numbers, from the
-                        # beginning up until when the last received packet was
-                        # sent.
-                        np.unique(snd_data_pkts[
-                            :snd_idx + 1][features.SEQ_FET]).shape[0] /
-                        # Convert from index to packet count.
-                        (snd_idx + 1))
-                    break
-                snd_idx -= 1
-            else:
-                print(
-                    "Warning: Did not find when the last received packet "
-                    f"(seq: {last_seq}) was sent for flow {flw_idx} in: "
-                    f"{exp_flp}")
-
             # Calculate the true drop rate at the bottleneck queue using the
             # bottleneck queue logs.
             client_port = flw[0]
             deq_idx = None
             drop_rate = None
             if q_log is None:
-                print(f"Warning: Unable to find bottleneck queue log: {q_log_flp}")
+                print(
+                    "Warning: Unable to find bottleneck queue log: "
+                    f"{q_log_flp}")
             else:
-                # Find the dequeue log corresponding to the last packet that was
-                # received.
+                # Find the dequeue log corresponding to the last packet that
+                # was received.
                 for record_idx, record in reversed(q_log):
                     if (record[0] == "deq" and record[2] == client_port and
                         record[3] == last_seq):
@@ -835,8 +1196,8 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                         break
             if drop_rate is None:
                 print(
-                    "Warning: Did not calculate the drop rate at the bottleneck "
-                    f"queue for flow {flw_idx} in: {exp_flp}")
+                    "Warning: Did not calculate the drop rate at the "
+                    f"bottleneck queue for flow {flw_idx} in: {exp_flp}")
             else:
                 output[-1][features.DROP_RATE_FET] = drop_rate
 
@@ -873,13 +1234,14 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     ("client port", "int32"),
                     ("server port", "int32"),
                     ("index", "int32")])
-            merged[features.WIRELEN_FET] = flw_results[flw][features.WIRELEN_FET]
-            merged[features.MIN_RTT_FET] = flw_results[flw][features.MIN_RTT_FET]
+            merged[features.WIRELEN_FET] = flw_results[flw][
+                features.WIRELEN_FET]
+            merged[features.MIN_RTT_FET] = flw_results[flw][win_min_rtt_fet]
             merged["client port"].fill(flw[0])
             merged["server port"].fill(flw[1])
             merged["index"] = np.arange(num_pkts)
             combined.append(merged)
-        zipped_arr_times, zipped_dat = utils.zip_timeseries(
+        zipped_arr_times, zipped_dat = parse_utils.zip_timeseries(
             [flw_results[flw][features.ARRIVAL_TIME_FET] for flw in flws],
             combined)
 
@@ -889,32 +1251,32 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                 continue
 
             for win in features.WINDOWS:
-                # The bounds should never go backwards, so start the
-                # search at the current bound.
-                win_to_start_idx[win] = utils.find_bound(
-                        zipped_arr_times,
-                        target=(
-                            zipped_arr_times[j] -
-                            (win * zipped_dat[j][features.MIN_RTT_FET])),
-                        min_idx=win_to_start_idx[win],
-                        max_idx=j,
-                        which="after")
+                # The bounds usually move forward, so start the search at the
+                # current bound. However, the flows may have different min
+                # RTTs.
+                win_to_start_idx[win] = move_window_start(
+                    zipped_arr_times,
+                    target_us=(
+                        zipped_arr_times[j] -
+                        (win * zipped_dat[j][features.MIN_RTT_FET])),
+                    start_idx=win_to_start_idx[win],
+                    end_idx=j)
                 # If the window's trailing edge caught up with its
                 # leading edge, then skip this flow.
                 if win_to_start_idx[win] >= j:
                     continue
 
-                total_tput_bps = utils.safe_div(
-                    utils.safe_mul(
-                        # Accumulate the bytes received by this flow during this
-                        # window. When calculating the average throughput, we
-                        # must exclude the first packet in the window.
-                        utils.safe_sum(
+                total_tput_bps = parse_utils.safe_div(
+                    parse_utils.safe_mul(
+                        # Accumulate the bytes received by this flow during
+                        # this window. When calculating the average throughput,
+                        # we must exclude the first packet in the window.
+                        parse_utils.safe_sum(
                             zipped_dat[features.WIRELEN_FET],
                             start_idx=win_to_start_idx[win] + 1,
                             end_idx=j),
                         8 * 1e6),
-                    utils.safe_sub(
+                    parse_utils.safe_sub(
                         zipped_arr_times[j],
                         zipped_arr_times[win_to_start_idx[win]]))
                 # Check if this throughput is erroneous.
@@ -928,25 +1290,26 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
                     index = zipped_dat[j]["index"]
                     flw_results[flw][index][features.make_win_metric(
                         features.TOTAL_TPUT_FET, win)] = total_tput_bps
-                    # Use the total throughput and the number of active flows to
-                    # calculate the throughput fair share.
+                    # Use the total throughput and the number of active flows
+                    # to calculate the throughput fair share.
                     flw_results[flw][index][features.make_win_metric(
                         features.TPUT_FAIR_SHARE_BPS_FET, win)] = (
-                            utils.safe_div(
+                            parse_utils.safe_div(
                                 total_tput_bps,
                                 flw_results[flw][index][
                                     features.ACTIVE_FLOWS_FET]))
                     # Divide the flow's throughput by the total throughput.
-                    tput_share = utils.safe_div(
+                    tput_share = parse_utils.safe_div(
                         flw_results[flw][index][
                             features.make_win_metric(features.TPUT_FET, win)],
                         total_tput_bps)
                     flw_results[flw][index][features.make_win_metric(
                         features.TPUT_SHARE_FRAC_FET, win)] = tput_share
-                    # Calculate the ratio of tput share to bandwidth fair share.
+                    # Calculate the ratio of tput share to bandwidth fair
+                    # share.
                     flw_results[flw][index][features.make_win_metric(
                         features.TPUT_TO_FAIR_SHARE_RATIO_FET, win)] = (
-                            utils.safe_div(
+                            parse_utils.safe_div(
                                 tput_share,
                                 flw_results[flw][index][
                                     features.BW_FAIR_SHARE_FRAC_FET]))
@@ -958,7 +1321,7 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
             ", ".join(
                 f"{dur_us} us" if dur_us > 0 else "unknown" for dur_us in (
                     win * np.asarray(
-                        [res[-1][features.MIN_RTT_FET]
+                        [res[-1][win_min_rtt_fet]
                          for res in flw_results.values()])
                 ).tolist()
             )
@@ -996,19 +1359,34 @@ def parse_opened_exp(exp, exp_flp, exp_dir, out_flp, skip_smoothed):
             out_flp,
             **{str(k + 1): v
                for k, v in enumerate(flw_results[flw] for flw in flws)})
+        # Store the sender-side features in a separate directory with the same
+        # layout, so that they are not mistaken for receiver-side results.
+        snd_out_dir = get_sender_dir(path.dirname(out_flp))
+        if not path.exists(snd_out_dir):
+            os.makedirs(snd_out_dir, exist_ok=True)
+        snd_out_flp = path.join(snd_out_dir, path.basename(out_flp))
+        print(f"\tSaving: {snd_out_flp}")
+        np.savez_compressed(
+            snd_out_flp,
+            **{str(k + 1): v
+               for k, v in enumerate(flw_snd_results[flw] for flw in flws)})
 
     return smallest_safe_win
 
 
-def parse_exp(exp_flp, untar_dir, out_dir, skip_smoothed):
+def parse_exp(exp_flp, untar_dir, spill_dir, budget_B, out_dir, skip_smoothed,
+              win_min_rtt, hist_win):
     """ Locks, untars, and parses an experiment. """
-    exp = utils.Exp(exp_flp)
+    exp = parse_utils.Exp(exp_flp)
     out_flp = path.join(out_dir, f"{exp.name}.npz")
-    with open_exp(exp, exp_flp, untar_dir, out_dir, out_flp) as (locked, exp_dir):
+    with open_exp(
+            exp, exp_flp, untar_dir, spill_dir, budget_B, out_dir,
+            out_flp) as (locked, exp_dir):
         if locked and exp_dir is not None:
             try:
                 return parse_opened_exp(
-                    exp, exp_flp, exp_dir, out_flp, skip_smoothed)
+                    exp, exp_flp, exp_dir, out_flp, skip_smoothed,
+                    win_min_rtt, hist_win)
             except AssertionError:
                 traceback.print_exc()
                 return -1
@@ -1016,52 +1394,76 @@ def parse_exp(exp_flp, untar_dir, out_dir, skip_smoothed):
     return -1
 
 
-def main():
-    """ This program's entrypoint. """
-    # Parse command line arguments.
-    psr = argparse.ArgumentParser(
-        description="Parses the output of CloudLab experiments.")
-    psr.add_argument(
-        "--exp-dir",
-        help=("The directory in which the experiment results are stored "
-              "(required)."), required=True, type=str)
+def add_args(psr):
+    """
+    Adds the arguments that control how experiments are parsed to the provided
+    ArgumentParser, and returns it. Shared with featurize.py.
+    """
     psr.add_argument(
         "--untar-dir",
         help=("The directory in which the untarred experiment intermediate "
               "files are stored (required)."),
         required=True, type=str)
+    psr.add_argument(
+        "--spill-dir", default=defaults.STAGING_SPILL_DIR,
+        help=("The directory in which to untar experiments that do not fit "
+              "within the staging budget of \"--untar-dir\"."),
+        type=str)
+    psr.add_argument(
+        "--staging-budget-GB", default=defaults.STAGING_BUDGET_B / 2**30,
+        help=("The total size of the files to stage on the filesystem of "
+              "\"--untar-dir\" at once, across all processes and stages."),
+        type=float)
     psr.add_argument(
         "--random-order", action="store_true",
         help="Parse experiments in a random order.")
     psr.add_argument(
         "--skip-smoothed-features", action="store_true",
         help="Do not calculate EWMA and windowed features.")
+    psr.add_argument(
+        "--window-min-rtt", choices=["cumulative", "windowed"],
+        default="cumulative",
+        help=("Which min RTT estimate to use as the unit of window durations: "
+              "the min RTT over the whole flow, or the min RTT over the last "
+              f"{defaults.MIN_RTT_WIN_US / 1e6:.0f} seconds."))
+    psr.add_argument(
+        "--histogram-window", default=defaults.HIST_WIN,
+        help=("The duration of the window over which to compute the "
+              "interarrival time histogram, in multiples of the min RTT."),
+        type=int)
     psr.add_argument(
         "--parallel", default=multiprocessing.cpu_count(),
         help="The number of files to parse in parallel.", type=int)
-    psr, psr_verify = cl_args.add_out(psr)
-    args = psr_verify(psr.parse_args())
-    exp_dir = args.exp_dir
-    untar_dir = args.untar_dir
-    out_dir = args.out_dir
-    skip_smoothed = args.skip_smoothed_features
+    # Do not use cl_args.add_out(), since cl_args imports torch (via models).
+    psr.add_argument(
+        "--out-dir", default=".",
+        help="The directory in which to store output files.", type=str)
+    return psr
 
-    # Find all experiments.
+
+def get_parse_args(exp_flps, args):
+    """
+    Returns a list of the arguments to parse_exp() for each experiment file,
+    shuffled if requested. Creates the output directory.
+    """
+    if not path.exists(args.out_dir):
+        os.makedirs(args.out_dir)
     pcaps = [
-        (path.join(exp_dir, exp), untar_dir, out_dir, skip_smoothed)
-        for exp in sorted(os.listdir(exp_dir)) if exp.endswith(".tar.gz")]
+        (exp_flp, args.untar_dir, args.spill_dir,
+         int(args.staging_budget_GB * 2**30), args.out_dir,
+         args.skip_smoothed_features, args.window_min_rtt,
+         args.histogram_window)
+        for exp_flp in exp_flps]
     if args.random_order:
         random.shuffle(pcaps)
+    return pcaps
 
-    print(f"Num files: {len(pcaps)}")
-    tim_srt_s = time.time()
-    if defaults.SYNC:
-        smallest_safe_wins = {parse_exp(*pcap) for pcap in pcaps}
-    else:
-        with multiprocessing.Pool(processes=args.parallel) as pol:
-            smallest_safe_wins = set(pol.starmap(parse_exp, pcaps))
-    print(f"Done parsing - time: {time.time() - tim_srt_s:.2f} seconds")
 
+def report_safe_wins(smallest_safe_wins):
+    """
+    Prints the smallest window size that is safe for all of the parsed
+    experiments, given the return values of parse_exp().
+    """
     # Remove return values from experiments that were not parsed.
     smallest_safe_wins = [win for win in smallest_safe_wins if win != -1]
     if 0 in smallest_safe_wins:
@@ -1072,5 +1474,35 @@ def main():
         else "No experiments parsed!")
 
 
+def main():
+    """ This program's entrypoint. """
+    # Parse command line arguments.
+    psr = argparse.ArgumentParser(
+        description="Parses the output of CloudLab experiments.")
+    psr.add_argument(
+        "--exp-dir",
+        help=("The directory in which the experiment results are stored "
+              "(required)."), required=True, type=str)
+    args = add_args(psr).parse_args()
+    exp_dir = args.exp_dir
+
+    # Find all experiments.
+    pcaps = get_parse_args(
+        [path.join(exp_dir, exp) for exp in sorted(os.listdir(exp_dir))
+         if exp.endswith(".tar.gz")],
+        args)
+
+    print(f"Num files: {len(pcaps)}")
+    tim_srt_s = time.time()
+    if defaults.SYNC:
+        smallest_safe_wins = {parse_exp(*pcap) for pcap in pcaps}
+    else:
+        with multiprocessing.Pool(
+                processes=args.parallel, **numa.pool_kwargs()) as pol:
+            smallest_safe_wins = set(pol.starmap(parse_exp, pcaps))
+    print(f"Done parsing - time: {time.time() - tim_srt_s:.2f} seconds")
+    report_safe_wins(smallest_safe_wins)
+
+
 if __name__ == "__main__":
     main()
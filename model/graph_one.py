@@ -10,8 +10,9 @@ from matplotlib import pyplot as plt
 import numpy as np
 
 import cl_args
+import defaults
 import features
-import utils
+import parse_utils
 
 
 def graph_fet(out_dir, dat, fet, bw_share_fair, bw_fair, x_min, x_max, labels):
@@ -62,10 +63,10 @@ def main():
     assert path.exists(dat_flp), f"File does not exist: {dat_flp}"
     if not path.exists(out_dir):
         os.makedirs(out_dir)
-    with np.load(dat_flp) as fil:
+    with np.load(dat_flp, max_header_size=defaults.NPY_MAX_HEADER_B) as fil:
         dat = [fil[flw] for flw in sorted(fil.files, key=int)]
 
-    exp = utils.Exp(dat_flp)
+    exp = parse_utils.Exp(dat_flp)
     num_flws = exp.tot_flws
     found_flws = len(dat)
     assert num_flws == found_flws, \
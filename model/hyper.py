@@ -5,18 +5,120 @@ Hyper-parameter optimization for train.py.
 
 import argparse
 import itertools
+import math
 import multiprocessing
+import queue
 import time
 
 import ax
+from ax.exceptions import core as ax_core_exceptions
+from ax.exceptions import generation_strategy as ax_gs_exceptions
+from ax.service import ax_client
 import numpy as np
 
 import cl_args
+import data
 import defaults
 import train
 
 
 DEFAULT_TLS_OPT = 40
+# The name of the optimization objective.
+OBJECTIVE = "error"
+
+
+def init_worker():
+    """
+    Initializes a process that runs trials. Each such process runs many trials
+    on the same data, so it caches the data that it loads (see data.CACHE).
+    """
+    data.CACHE_ENABLED = True
+
+
+def run_trial(cnf):
+    """
+    Runs a single configuration and returns its error. This must be a
+    module-level function (i.e., not a lambda) so that it can be pickled and
+    sent to a worker process.
+    """
+    return train.run_trials(train.prepare_args(cnf))[0]
+
+
+def run_indexed_trial(idx_cnf):
+    """
+    Runs a configuration that is paired with an index, and returns the index
+    along with the configuration's error. Used to match results that arrive
+    out of order to their configurations.
+    """
+    idx, cnf = idx_cnf
+    return idx, run_trial(cnf)
+
+
+def optimize(params, tls_opt, parallel, seed):
+    """
+    Runs tls_opt Bayesian optimization trials, keeping up to parallel trials in
+    flight at once. Trials are executed by a pool of worker processes and their
+    results are reported to Ax as soon as they complete, so a slow trial does
+    not block the others. Returns a tuple of the form:
+        (best parameters, best error)
+    """
+    # By default, Ax limits the number of concurrent trials during the Bayesian
+    # optimization phase. Instead, we generate a new trial whenever a worker
+    # becomes free.
+    cli = ax_client.AxClient(
+        random_seed=seed, enforce_sequential_optimization=False)
+    cli.create_experiment(
+        name="hyper", parameters=params, objective_name=OBJECTIVE,
+        minimize=True)
+    # Completed trials are reported back to this thread through this queue.
+    # Each entry is a tuple of the form: (trial index, error, exception)
+    done = queue.Queue()
+    # Maps trial index to that trial's parameters.
+    pending = {}
+    launched = 0
+    finished = 0
+    with multiprocessing.Pool(
+            processes=parallel, initializer=init_worker) as pol:
+        while launched < tls_opt or pending:
+            # Keep the pool full.
+            while launched < tls_opt and len(pending) < parallel:
+                try:
+                    cnf, tl_idx = cli.get_next_trial()
+                except (ax_core_exceptions.DataRequiredError,
+                        ax_gs_exceptions.MaxParallelismReachedException):
+                    # Ax requires more completed trials before it can
+                    # generate the next one.
+                    break
+                pending[tl_idx] = cnf
+                launched += 1
+                print(f"Launching trial {tl_idx} ({launched}/{tls_opt}): {cnf}")
+                pol.apply_async(
+                    run_trial, (cnf,),
+                    callback=(
+                        lambda err, tl_idx=tl_idx: done.put(
+                            (tl_idx, err, None))),
+                    error_callback=(
+                        lambda exc, tl_idx=tl_idx: done.put(
+                            (tl_idx, None, exc))))
+            assert pending, "Unable to generate any optimization trials."
+
+            # Wait for any trial to finish.
+            tl_idx, err, exc = done.get()
+            del pending[tl_idx]
+            finished += 1
+            if exc is not None or math.isnan(err):
+                print(
+                    f"Trial {tl_idx} failed ({finished}/{tls_opt}): "
+                    f"{'NaN error' if exc is None else exc}")
+                cli.log_trial_failure(trial_index=tl_idx)
+            else:
+                print(
+                    f"Trial {tl_idx} finished ({finished}/{tls_opt}) - "
+                    f"error: {err:.4f}")
+                cli.complete_trial(trial_index=tl_idx, raw_data=err)
+
+    best_params, (means, _) = cli.get_best_parameters()
+    return best_params, means[OBJECTIVE]
 
 
 def main():
@@ -32,10 +134,16 @@ def main():
         "--exhaustive", action="store_true",
         help=("Try all combinations of parameters. Incompatible with "
               "parameters of type \"range\"."))
+    psr.add_argument(
+        "--parallel", default=multiprocessing.cpu_count(),
+        help="The number of trials to run in parallel.", type=int)
     args = psr_verify(psr.parse_args())
+    assert args.parallel > 0, \
+        f"\"--parallel\" must be greater than 0, but is: {args.parallel}"
     tls_opt = args.opt_trials
     tls_cnf = args.conf_trials
     no_rand = args.no_rand
+    parallel = 1 if defaults.SYNC else args.parallel
 
     # Define the optimization parameters.
     params = [
@@ -173,25 +281,42 @@ def main():
             f"configuration: {[pairs[0][0] for pairs in to_vary]}")
         cnfs = [
             {**fixed, **dict(params)} for params in itertools.product(*to_vary)]
-        print(f"Total trials: {len(cnfs) * tls_cnf}")
-        if defaults.SYNC:
-            res = [train.run_trials(cnf)[0] for cnf in cnfs]
+        num_cnfs = len(cnfs)
+        print(f"Total trials: {num_cnfs * tls_cnf}")
+        if parallel == 1:
+            init_worker()
+            res = [run_trial(cnf) for cnf in cnfs]
         else:
-            with multiprocessing.Pool() as pol:
-                res = pol.map(lambda cnf: train.run_trials(cnf)[0], cnfs)
-        best_idx = np.argmin(np.array(res))
+            res = [None] * num_cnfs
+            with multiprocessing.Pool(
+                    processes=parallel, initializer=init_worker) as pol:
+                # Report results as they arrive instead of waiting for all
+                # configurations to finish.
+                for finished, (idx, err) in enumerate(pol.imap_unordered(
+                        run_indexed_trial, enumerate(cnfs))):
+                    print(
+                        f"Configuration {idx} finished "
+                        f"({finished + 1}/{num_cnfs}) - error: {err:.4f}")
+                    res[idx] = err
+        # Failed configurations have an error of NaN.
+        best_idx = np.nanargmin(np.array(res))
         best_params = cnfs[best_idx]
         best_err = res[best_idx]
     else:
         print((f"Running {tls_opt} optimization trial(s), with {tls_cnf} "
-               "sub-trial(s) for each configuration."))
-        best_params, best_vals, _, _ = ax.optimize(
-            parameters=params,
-            evaluation_function=lambda cnf: train.run_trials(cnf)[0],
-            minimize=True,
-            total_trials=args.opt_trials,
-            random_seed=defaults.SEED if no_rand else None)
-        best_err = best_vals[0]["objective"]
+               f"sub-trial(s) for each configuration, {parallel} at a time."))
+        seed = defaults.SEED if no_rand else None
+        if parallel == 1:
+            init_worker()
+            best_params, best_vals, _, _ = ax.optimize(
+                parameters=params,
+                evaluation_function=run_trial,
+                minimize=True,
+                total_trials=tls_opt,
+                random_seed=seed)
+            best_err = best_vals[0]["objective"]
+        else:
+            best_params, best_err = optimize(params, tls_opt, parallel, seed)
     print((f"Done with hyper-parameter optimization - "
            f"{time.time() - tim_srt_s:.2f} seconds"))
     print(f"\nBest params: {best_params}")
@@ -0,0 +1,209 @@
+#! /usr/bin/env python3
+"""
+Runs inference using trained TorchScript models (i.e., the ".pth" files that
+train.py produces for the BinaryDnn, Fc*, and Lstm models), outside of the
+training and evaluation pipelines.
+
+A Runner loads a model once, pins the number of intra-op threads, and reuses
+preallocated input, output, and (for LSTMs) hidden state tensors across calls,
+so that classifying a batch of packets does not allocate new buffers or build
+an autograd graph.
+"""
+
+import argparse
+import json
+from os import path
+import time
+
+import numpy as np
+import torch
+
+import cl_args
+import defaults
+import models
+import utils
+
+
+class Runner:
+    """ Runs a TorchScript model on batches of packet features. """
+
+    def __init__(self, mdl_flp, num_ins, max_batch=1, num_threads=1,
+                 scl_prms=None, standardize=False, hid_dim=None, num_lyrs=1):
+        """
+        mdl_flp: Path to a TorchScript model file.
+        num_ins: The number of input features.
+        max_batch: The largest batch that infer() will be called with.
+        num_threads: The number of intra-op threads that torch may use.
+        scl_prms: Optional scaling parameters (as saved by train.py) to apply
+            to the input features before running the model.
+        standardize: Whether scl_prms are standardization parameters (True)
+            or min/max parameters (False).
+        hid_dim: If the model is an LSTM, then this is its hidden dimension.
+            Otherwise, None.
+        num_lyrs: If the model is an LSTM, then this is its number of layers.
+        """
+        assert path.exists(mdl_flp), f"Model file does not exist: {mdl_flp}"
+        assert max_batch > 0, f"Invalid max batch size: {max_batch}"
+        # Intra-op parallelism only helps with large batches. For single-packet
+        # batches, the cost of waking up threads dominates.
+        torch.set_num_threads(num_threads)
+
+        net = torch.jit.load(mdl_flp, map_location="cpu")
+        net.eval()
+        try:
+            # Fold the parameters into the graph as constants and let torch
+            # fuse operators.
+            net = torch.jit.optimize_for_inference(torch.jit.freeze(net))
+        except RuntimeError as exc:
+            print(f"Warning: Unable to freeze model {mdl_flp}: {exc}")
+        self.net = net
+        self.num_ins = num_ins
+        self.max_batch = max_batch
+
+        # Convert the scaling parameters to vectors so that scaling a batch is
+        # a single vectorized operation.
+        self.scl_sub = None
+        self.scl_div = None
+        self.scl_zero = None
+        if scl_prms is not None:
+            scl_prms = np.array(scl_prms, dtype=np.float32)
+            assert scl_prms.shape == (num_ins, 2), \
+                (f"Expected scaling parameters of shape ({num_ins}, 2), but "
+                 f"found: {scl_prms.shape}. The model and scaling parameters "
+                 "may be from an older version of features.FEATURES.")
+            self.scl_sub = torch.from_numpy(scl_prms[:, 0])
+            # Scaling to [0, 1] divides by (max - min). Standardization
+            # divides by the standard deviation.
+            scl_div = (
+                scl_prms[:, 1] if standardize
+                else scl_prms[:, 1] - scl_prms[:, 0])
+            # Like data.scale_fets(), map features whose divisor is 0 (i.e.,
+            # whose training values were all the same) to 0: divide by 1 and
+            # zero the numerator.
+            self.scl_zero = torch.from_numpy(scl_div == 0)
+            self.scl_div = torch.from_numpy(
+                np.where(scl_div == 0, 1, scl_div).astype(np.float32))
+
+        # Preallocated buffers.
+        self.dat_in = torch.zeros((max_batch, num_ins), dtype=torch.float)
+        self.dat_out = torch.zeros((max_batch,), dtype=torch.long)
+        self.hidden = None
+        if hid_dim is not None:
+            self.hidden = (
+                torch.zeros((num_lyrs, 1, hid_dim), dtype=torch.float),
+                torch.zeros((num_lyrs, 1, hid_dim), dtype=torch.float))
+
+    def reset(self):
+        """ Clears the LSTM hidden state, e.g., when starting a new flow. """
+        if self.hidden is not None:
+            for hid in self.hidden:
+                hid.zero_()
+
+    def infer(self, dat_in):
+        """
+        Classifies the rows of dat_in, which must be a 2D numpy array or torch
+        Tensor with at most max_batch rows and num_ins columns. Returns a view
+        of the preallocated output buffer containing one class per row. The
+        view is overwritten by the next call to infer().
+        """
+        num_pkts = dat_in.shape[0]
+        assert num_pkts <= self.max_batch, \
+            (f"Batch of {num_pkts} packets exceeds the maximum batch size of "
+             f"{self.max_batch}!")
+        assert dat_in.shape[1] == self.num_ins, \
+            (f"Expected {self.num_ins} features, but found: "
+             f"{dat_in.shape[1]}")
+        if isinstance(dat_in, np.ndarray):
+            dat_in = torch.from_numpy(dat_in)
+
+        with torch.inference_mode():
+            buf_in = self.dat_in[:num_pkts]
+            buf_in.copy_(dat_in)
+            if self.scl_sub is not None:
+                buf_in.sub_(self.scl_sub).div_(self.scl_div)
+                buf_in.masked_fill_(self.scl_zero, 0)
+            if self.hidden is None:
+                out = self.net(buf_in)
+            else:
+                # Treat the batch as a sequence of packets from one flow.
+                out, hidden = self.net(buf_in.unsqueeze(1), self.hidden)
+                for buf, hid in zip(self.hidden, hidden):
+                    buf.copy_(hid)
+            buf_out = self.dat_out[:num_pkts]
+            torch.argmax(out, dim=1, out=buf_out)
+        return buf_out
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description=(
+            "Classifies the flows in an experiment using a trained TorchScript "
+            "model and reports the per-packet inference cost."))
+    psr.add_argument(
+        "--model", help="The path to a trained model file (.pth).",
+        required=True, type=str)
+    psr.add_argument(
+        "--experiment",
+        help="The path to a parsed experiment file (from gen_features.py).",
+        required=True, type=str)
+    psr.add_argument(
+        "--scale-params", help="The path to the input scaling parameters.",
+        required=False, type=str)
+    psr.add_argument(
+        "--batch", default=1, help="The number of packets per batch.",
+        required=False, type=int)
+    psr.add_argument(
+        "--threads", default=1, help="The number of intra-op threads.",
+        required=False, type=int)
+    psr, psr_verify = cl_args.add_standardize(psr)
+    args = psr_verify(psr.parse_args())
+    mdl_flp = args.model
+    assert mdl_flp.endswith("pth"), \
+        f"Only TorchScript (.pth) models are supported: {mdl_flp}"
+
+    # Parse the model filepath to determine the model type.
+    net = models.MODELS[
+        utils.str_to_args(
+            path.basename(mdl_flp),
+            order=sorted(defaults.DEFAULTS.keys()),
+            which="model"
+        )["model"]]()
+    fets = list(net.in_spc)
+    scl_prms = None
+    if args.scale_params is not None:
+        with open(args.scale_params, "r") as fil:
+            scl_prms = json.load(fil)
+    lstm = isinstance(net, models.LstmWrapper)
+    runner = Runner(
+        mdl_flp, len(fets), args.batch, args.threads, scl_prms,
+        args.standardize, hid_dim=net.hid_dim if lstm else None,
+        num_lyrs=net.num_lyrs if lstm else 1)
+
+    _, dat = utils.load_exp(args.experiment)
+    assert dat is not None, f"Unable to load experiment: {args.experiment}"
+    num_pkts = 0
+    tim_s = 0
+    for flw_idx, flw_dat in enumerate(dat):
+        flw_in = np.ascontiguousarray(
+            utils.clean(flw_dat[fets]), dtype=np.float32)
+        runner.reset()
+        clss = np.empty((flw_in.shape[0],), dtype=int)
+        tim_srt_s = time.time()
+        for srt in range(0, flw_in.shape[0], args.batch):
+            end = srt + args.batch
+            clss[srt:end] = runner.infer(flw_in[srt:end]).numpy()
+        tim_s += time.time() - tim_srt_s
+        num_pkts += flw_in.shape[0]
+        if clss.shape[0] > 0:
+            print(
+                f"Flow {flw_idx}: {clss.shape[0]} packets, class "
+                f"distribution: {np.bincount(clss, minlength=net.num_clss)}")
+    if num_pkts > 0:
+        print(
+            f"Classified {num_pkts} packets in {tim_s:.2f} seconds "
+            f"({tim_s * 1e6 / num_pkts:.2f} us per packet)")
+
+
+if __name__ == "__main__":
+    main()
@@ -4,11 +4,9 @@ import copy
 import math
 import os
 from os import path
-import random
 
 from matplotlib import pyplot as plt
 import numpy as np
-import sklearn
 from sklearn import ensemble
 from sklearn import linear_model
 from sklearn import metrics
@@ -18,6 +16,8 @@ import torch
 
 import defaults
 import features
+import rand
+import rfe
 import utils
 
 
@@ -54,6 +54,13 @@ class PytorchModelWrapper:
                 os.makedirs(self.out_dir)
         self.__check()
 
+    def get_scl_grps(self, fets):
+        """
+        Returns the scaling group of each of the provided features. By default,
+        each feature is part of its own scaling group.
+        """
+        return list(range(len(fets)))
+
     def __check(self):
         """
         Verifies that this PytorchModel instance has been initialized properly.
@@ -150,16 +157,35 @@ class BinaryModelWrapper(PytorchModelWrapper):
         self.win = win
         self.rtt_buckets = rtt_buckets
         self.windows = windows
-        # Determine layer dimensions. If we are bucketizing packets
-        # based on arrival time, then there will be one input feature
-        # for every bucket (self.win) plus one input feature for every
-        # entry in self.in_spc. If we are not bucketizing packets,
-        # then there will be one input feature for each entry in
-        # self.in_spc for each packet (self.win).
+        if self.rtt_buckets:
+            # Use the arrival time histograms that gen_features.py computes
+            # online (features.HISTOGRAMS) as additional input features.
+            self.in_spc = tuple(self.in_spc) + tuple(
+                fet for fet in features.HIST_FETS if fet not in self.in_spc)
+        # Determine layer dimensions. If we are using windows of packets, then
+        # there will be one input feature for each entry in self.in_spc for
+        # each packet (self.win). Otherwise, there will be one input feature
+        # for each entry in self.in_spc.
         self.num_ins = (
-            self.win + len(self.in_spc) if self.rtt_buckets else (
-                len(self.in_spc) * self.win if self.windows else
-                len(self.in_spc)))
+            len(self.in_spc) * self.win if self.windows else len(self.in_spc))
+
+    def get_scl_grps(self, fets):
+        """
+        Returns the scaling group of each of the provided features. If using
+        the arrival time histograms, then the buckets of each histogram share
+        a scaling group. Each other feature is part of its own group.
+        """
+        if not self.rtt_buckets:
+            return super().get_scl_grps(fets)
+        # Maps each scaling group's key (the feature itself, or its histogram
+        # for a histogram bucket) to the group's index.
+        grps = {}
+        return [
+            grps.setdefault(
+                ("histogram", features.HIST_FETS[fet])
+                if fet in features.HIST_FETS else fet,
+                len(grps))
+            for fet in fets]
 
     @staticmethod
     def convert_to_class(dat_out):
@@ -170,139 +196,7 @@ class BinaryModelWrapper(PytorchModelWrapper):
         clss[features.LABEL_FET] = (dat_out[:,0] > 1).astype(int)
         return clss
 
-    def __bucketize(self, dat_in, dat_extra, dat_in_start_idx, dat_in_end_idx,
-                    dat_in_new, dat_in_new_idx, dur_us, num_buckets):
-        """
-        Uses dat_extra[features.ARRIVAL_TIME_FET] to divide the arriving packets
-        from the range [dat_in_start_idx, dat_in_end_idx] into num_buckets
-        intervals. Each interval has duration dur_us / num_buckets.  Stores the
-        resulting histogram in dat_in_new, at the row indicated by
-        dat_in_new_idx. Returns nothing.
-        """
-        arr_times = dat_extra[features.ARRIVAL_TIME_FET][
-            dat_in_start_idx:dat_in_end_idx + 1]
-        num_pkts = arr_times.shape[0]
-        assert num_pkts > 0, "Need more than 0 packets!"
-
-        # The duration of each interval.
-        interval_us = dur_us / num_buckets
-        # The arrival time of the first packet, and therefore the
-        # start of the first interval.
-        start_time_us = arr_times[0]
-        # Convert the arrival times to interval indices and loop over them.
-        for interval_idx in np.floor(
-                (arr_times - start_time_us) / interval_us).astype(int):
-            if interval_idx == num_buckets:
-                self.log(f"Warning: Interval is {interval_idx} when it should be "
-                      f"in the range [0, {num_buckets}]. Fixing interval...")
-                interval_idx -= 1
-            assert 0 <= interval_idx < num_buckets, \
-                (f"Invalid idx ({interval_idx}) for the number of buckets "
-                 f"({num_buckets})!")
-            dat_in_new[dat_in_new_idx][interval_idx] += 1
-        # Set the values of the other features based on the last packet in this
-        # window.
-        for fet in dat_in.dtype.names:
-            dat_in_new[fet][dat_in_new_idx] = dat_in[fet][dat_in_end_idx]
-
-        # Check that the bucket features reflect all of the packets.
-        bucketed_pkts = sum(dat_in_new[dat_in_new_idx].tolist()[:num_buckets])
-        assert bucketed_pkts == num_pkts, \
-            (f"Error building counts! Bucketed {bucketed_pkts} of {num_pkts} "
-             "packets!")
-
-    def __create_buckets(self, exp, dat_in, dat_out, dat_extra, sequential):
-        """
-        Divides dat_in into windows and divides each window into self.win
-        buckets, which each defines a temporal interval. The value of
-        each bucket is the number of packets that arrived during that
-        interval. The output value for each window is the output of
-        the last packet in the window.
-        """
-        self.log("Creating arrival time buckets...")
-        # 100x the min RTT (as determined by the experiment parameters).
-        dur_us = 100 * 2 * (exp.edge_delays[0] * 2 + exp.btl_delay_us)
-        # Determine the safe starting index. Do not pick indices
-        # between 0 and start_idx to make sure that all windows ending
-        # on the chosen index fit within the experiment.
-        first_arr_time = None
-        start_idx = None
-        for idx, arr_time in enumerate(dat_extra[features.ARRIVAL_TIME_FET]):
-            if first_arr_time is None:
-                first_arr_time = arr_time
-                continue
-            if arr_time - first_arr_time >= dur_us:
-                start_idx = idx
-                break
-        num_pkts = dat_in.shape[0]
-        assert start_idx is not None and 0 <= start_idx < num_pkts, \
-            f"Invalid start index: {start_idx}"
-
-        if sequential:
-            # Select all valid windows, in order.
-            num_wins = num_pkts - start_idx
-            pkt_idxs = list(range(start_idx, num_pkts))
-        else:
-            # The number of windows is the number of times the window
-            # durations fits within the experiment.
-            num_wins = 10 * math.floor(exp.dur_s * 1e6 / dur_us)
-            # Select random intervals from this experiment to create the
-            # new input data. win_idx is the index into
-            # dat_in_new. pkt_idx is the index of the last packet in this
-            # window.
-            pkt_idxs = random.choices(range(start_idx, num_pkts), k=num_wins)
-        # Records the number of packets that arrived during each
-        # interval. This is a structured numpy array where each column
-        # is named based on its bucket index. We add extra columns for
-        # the normal time features.
-        dat_in_new = np.zeros(
-            (num_wins,),
-            dtype=([(f"bucket_{bkt}", "float") for bkt in range(self.win)] +
-                   [col for col in dat_in.dtype.descr if col[0] != ""]))
-
-        for win_idx, pkt_idx in enumerate(pkt_idxs):
-            # Find the first packet in this window (whose index will
-            # be win_start_idx).
-            cur_arr_time = dat_extra[features.ARRIVAL_TIME_FET][pkt_idx]
-            win_start_idx = None
-            # Move backwards from the last packet in the window until
-            # we find a packet whose arrival time is more that dur_us
-            # in the past.
-            for arr_time_idx in range(pkt_idx, -1, -1):
-                if (cur_arr_time -
-                        dat_extra[features.ARRIVAL_TIME_FET][arr_time_idx] >
-                        dur_us):
-                    # This packet is the first packet that is too far
-                    # in the past, so we will start the window on the
-                    # next packet.
-                    win_start_idx = arr_time_idx + 1
-                    break
-            assert (
-                win_start_idx is not None and 0 <= win_start_idx <= pkt_idx), \
-                ("Problem finding beginning of window! Are there insufficient "
-                 "packets?")
-            self.__bucketize(
-                dat_in, dat_extra, win_start_idx, pkt_idx, dat_in_new, win_idx,
-                dur_us, self.win)
-
-        # Verify that we selected at least as many windows as we intended to.
-        num_selected_wins = len(dat_in_new)
-        assert num_selected_wins >= num_wins, \
-            f"Insufficient windows: {num_selected_wins} < {num_wins}"
-
-        return (
-            dat_in_new,
-            # As an output feature, select only the final ground truth
-            # value. I.e., the final ground truth value for this window
-            # becomes the ground truth for the entire window.
-            np.take(dat_out, pkt_idxs),
-            np.take(dat_extra, pkt_idxs),
-            # The buckets all share a scaling group. Each other
-            # feature is part of its own group.
-            [0] * self.win +
-            list(range(1, len(dat_in_new.dtype.names) - self.win + 1)))
-
-    def __create_windows(self, dat_in, dat_out, sequential):
+    def __create_windows(self, exp, dat_in, dat_out, sequential):
         """
         Divides dat_in into windows of self.win packets. Flattens the
         features of the packets in a window. The output value for each
@@ -316,7 +210,8 @@ class BinaryModelWrapper(PytorchModelWrapper):
         # new input data. Do not pick indices between 0 and self.win
         # to make sure that all windows ending on the chosen index fit
         # within the experiment.
-        pkt_idxs = random.choices(range(self.win, num_pkts), k=num_wins)
+        pkt_idxs = rand.get("windows", exp=exp.name).integers(
+            self.win, num_pkts, num_wins).tolist()
         # The new data format consists of self.win copies of the
         # existing input features. All copies of a particular feature
         # share the same scaling group.
@@ -355,14 +250,10 @@ class BinaryModelWrapper(PytorchModelWrapper):
     #     interval becomes a training example.
     #     """
     #     dat_in, dat_out, dat_extra, scl_grps = (
-    #         self.__create_buckets(
-    #             exp, dat_in, dat_out, dat_extra, sequential)
-    #         if self.rtt_buckets else (
-    #             self.__create_windows(dat_in, dat_out, sequential)
-    #             if self.windows else (
-    #                 dat_in, dat_out, dat_extra,
-    #                 # Each feature is part of its own scaling group.
-    #                 list(range(len(dat_in.dtype.names))))))
+    #         self.__create_windows(exp, dat_in, dat_out, sequential)
+    #         if self.windows else (
+    #             dat_in, dat_out, dat_extra,
+    #             self.get_scl_grps(dat_in.dtype.names)))
     #     return dat_in, dat_out, dat_extra, scl_grps
 
 
@@ -925,14 +816,11 @@ class LrSklearnWrapper(SvmSklearnWrapper):
             self.log("Not using recursive feature elimination.")
         elif rfe_type == "rfe":
             self.log("Using recursive feature elimination.")
-            final_net = sklearn.feature_selection.RFE(
+            final_net = rfe.Rfe(
                 estimator=net, n_features_to_select=10, step=10)
         elif rfe_type == "rfecv":
             self.log("Using recursive feature elimination with cross-validation.")
-            final_net = sklearn.feature_selection.RFECV(
-                estimator=net, step=1,
-                cv=sklearn.model_selection.StratifiedKFold(10),
-                scoring="accuracy", n_jobs=-1)
+            final_net = rfe.RfeCv(estimator=net, step=1, folds=10)
         else:
             raise Exception(f"Unknown RFE type: {rfe_type}")
         return final_net
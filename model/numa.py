@@ -0,0 +1,151 @@
+"""
+NUMA-aware placement of worker processes.
+
+Linux allocates a page on the NUMA node of the CPU that first touches it. A
+worker that is pinned to the CPUs of one node therefore allocates its buffers
+(e.g., the per-flow arrays and memmaps that gen_features.py creates while
+parsing an experiment) from that node's memory, and later accesses them
+locally. pool_kwargs() pins multiprocessing.Pool workers round-robin across
+nodes, and each experiment is parsed entirely by one worker, so an
+experiment's data never crosses sockets.
+
+On machines with a single node, or without /sys/devices/system/node, all of
+this degrades to using every CPU.
+"""
+
+import multiprocessing
+import os
+from os import path
+
+import defaults
+
+
+NODE_DIR = "/sys/devices/system/node"
+
+
+def parse_cpulist(cpulist):
+    """ Parses a Linux CPU list (e.g., "0-3,8-11") into a set of CPUs. """
+    cpus = set()
+    for part in cpulist.strip().split(","):
+        if not part:
+            continue
+        if "-" in part:
+            srt, end = part.split("-")
+            cpus.update(range(int(srt), int(end) + 1))
+        else:
+            cpus.add(int(part))
+    return cpus
+
+
+def get_nodes():
+    """
+    Returns a list of tuples of the form (node, set of CPUs) for every NUMA
+    node that has at least one CPU that this process is allowed to run on.
+    """
+    allowed = os.sched_getaffinity(0)
+    nodes = []
+    if path.isdir(NODE_DIR):
+        for fln in sorted(os.listdir(NODE_DIR)):
+            if not (fln.startswith("node") and fln[4:].isdigit()):
+                continue
+            with open(path.join(NODE_DIR, fln, "cpulist"), "r") as fil:
+                cpus = parse_cpulist(fil.read()) & allowed
+            if cpus:
+                nodes.append((int(fln[4:]), cpus))
+    return nodes if nodes else [(0, allowed)]
+
+
+def get_free_B(node):
+    """ Returns the amount of free memory on the provided node, in bytes. """
+    flp = path.join(NODE_DIR, f"node{node}", "meminfo")
+    if not path.exists(flp):
+        return 0
+    with open(flp, "r") as fil:
+        for line in fil:
+            # Lines are of the form: "Node 0 MemFree:  123456 kB"
+            toks = line.split()
+            if len(toks) >= 4 and toks[2] == "MemFree:":
+                return int(toks[3]) * 1024
+    return 0
+
+
+def pin(node=None):
+    """
+    Pins this process to the CPUs of the provided NUMA node, so that the
+    memory that it touches from now on is allocated on that node. If node is
+    None, then picks the node with the most free memory. Returns the node.
+    """
+    nodes = dict(get_nodes())
+    if node is None:
+        node = max(nodes, key=get_free_B)
+    assert node in nodes, f"Unknown NUMA node: {node}"
+    if defaults.NUMA_PIN:
+        os.sched_setaffinity(0, nodes[node])
+    return node
+
+
+def pin_worker(counter, nodes):
+    """
+    Pool worker initializer. Assigns workers to nodes round-robin, in the order
+    in which they start, and pins this worker to its node's CPUs.
+    """
+    with counter.get_lock():
+        idx = counter.value
+        counter.value += 1
+    if defaults.NUMA_PIN:
+        os.sched_setaffinity(0, nodes[idx % len(nodes)][1])
+
+
+def pool_kwargs():
+    """
+    Returns the keyword arguments to pass to multiprocessing.Pool() to pin its
+    workers across NUMA nodes, e.g.:
+        multiprocessing.Pool(processes=N, **numa.pool_kwargs())
+    """
+    return {
+        "initializer": pin_worker,
+        "initargs": (multiprocessing.Value("i", 0), get_nodes())}
+
+
+def read_numastat():
+    """
+    Returns the system-wide count of pages allocated on the intended node
+    ("local_node") and on another node ("other_node"), summed across nodes.
+    """
+    counts = {"local_node": 0, "other_node": 0}
+    if not path.isdir(NODE_DIR):
+        return counts
+    for fln in os.listdir(NODE_DIR):
+        flp = path.join(NODE_DIR, fln, "numastat")
+        if not path.exists(flp):
+            continue
+        with open(flp, "r") as fil:
+            for line in fil:
+                key, val = line.split()
+                if key in counts:
+                    counts[key] += int(val)
+    return counts
+
+
+def remote_ratio(before, after):
+    """
+    Returns the fraction of page allocations between two calls to
+    read_numastat() that were served by a node other than the allocating
+    CPU's node, or -1 if there were no allocations. Counts are system-wide, so
+    this is only meaningful on an otherwise idle machine.
+    """
+    local = after["local_node"] - before["local_node"]
+    other = after["other_node"] - before["other_node"]
+    tot = local + other
+    return other / tot if tot > 0 else -1
+
+
+def report(before):
+    """
+    Prints the number of NUMA nodes in use and the remote allocation ratio
+    since before (the output of read_numastat()).
+    """
+    ratio = remote_ratio(before, read_numastat())
+    print(
+        f"NUMA nodes: {len(get_nodes())}, remote allocation ratio: " +
+        (f"{ratio:.4f}" if ratio != -1 else "unknown"))
@@ -0,0 +1,622 @@
+"""
+Utility functions for parsing experiments and computing features. Unlike
+utils.py, this module does not depend on torch, sklearn, scapy, or matplotlib,
+so the feature generation processes (gen_features.py and featurize.py) stay
+small and start quickly.
+"""
+
+import collections
+import math
+from os import path
+import socket
+import struct
+import sys
+
+import numpy as np
+
+import defaults
+import features
+
+
+# Values considered unsafe for division and min().
+UNSAFE = {-1, 0}
+# The pcap file header: magic number, major version, minor version, time zone
+# offset, timestamp accuracy, snapshot length, link type.
+PCAP_GLOBAL_HEADER = struct.Struct("<IHHiIII")
+# Maps pcap magic number (microsecond or nanosecond resolution) to the number
+# of timestamp units per microsecond.
+PCAP_MAGICS = {0xa1b2c3d4: 1, 0xa1b23c4d: 1000}
+# The buffer into which read_pcap() reads pcap files. Each process reuses its
+# own buffer for every file that it parses.
+PCAP_BUF = bytearray()
+
+# Packet metadata. See decode_packets().
+PktMdat = collections.namedtuple("PktMdat", ["sec", "usec", "wirelen"])
+
+
+class Exp():
+    """ Describes the parameters of a simulation. """
+
+    def __init__(self, sim):
+        if "/" in sim:
+            sim = path.basename(sim)
+        self.name = sim
+        toks = sim.split("-")
+        if sim.endswith(".tar.gz"):
+            # unfair-pcc-cubic-8bw-30rtt-64q-1pcc-1cubic-100s-20201118T114242.tar.gz
+            # Remove ".tar.gz" from the last token.
+            toks[-1] = toks[-1][:-7]
+            # Update sim.name.
+            self.name = self.name[:-7]
+        elif sim.endswith(".npz"):
+            # Remove ".npz" from the last token.
+            toks[-1] = toks[-1][:-4]
+            # Update sim.name.
+            self.name = self.name[:-4]
+        # unfair-pcc-cubic-8bw-30rtt-64q-1pcc-1cubic-100s-20201118T114242
+        (_, self.cca_1_name, self.cca_2_name, bw_Mbps, rtt_ms, queue_p,
+         cca_1_flws, cca_2_flws, end_time, _) = toks
+        # Link bandwidth (Mbps).
+        self.bw_Mbps = float(bw_Mbps[:-2])
+        self.bw_bps = self.bw_Mbps * 1e6
+        # Bottleneck router delay (us).
+        self.rtt_us = float(rtt_ms[:-3]) * 1000
+        # Bandwidth-delay product (bits).
+        self.bdp_b = self.bw_Mbps * self.rtt_us
+        # Queue size (packets).
+        self.queue_p = float(queue_p[:-1])
+        # Queue size (multiples of the BDP).
+        self.queue_bdp = self.queue_p / (self.bdp_b / 8 / 1514)
+        # Number of CCA 1 flows.
+        self.cca_1_flws = int(cca_1_flws[:-(len(self.cca_1_name))])
+        # Number of CCA 2 flows.
+        self.cca_2_flws = int(cca_2_flws[:-(len(self.cca_2_name))])
+        # The total number of flows.
+        self.tot_flws = self.cca_1_flws + self.cca_2_flws
+        # Experiment duration (s).
+        self.dur_s = int(end_time[:-1])
+        # Largest RTT that this experiment should experiment, based on the size
+        # of the bottleneck queue and the RTT.
+        self.calculated_max_rtt_us = (self.queue_bdp + 1) * self.rtt_us
+        # Fair share bandwidth for each flow.
+        self.target_per_flow_bw_Mbps = (
+            self.bw_Mbps / (self.cca_1_flws + self.cca_2_flws))
+
+
+def get_snaplen(cca):
+    """
+    Returns the recommended capture snapshot length for flows that use the
+    provided CCA. See defaults.SNAPLEN_B.
+    """
+    return defaults.SNAPLEN_B.get(cca, defaults.SNAPLEN_TCP_B)
+
+
+def get_tcp_timestamp(pkt_dat, start, end):
+    """
+    Searches the TCP options in pkt_dat[start:end] for the Timestamp option.
+    Returns a tuple of the form (TSval, TSecr), or (-1, -1) if it is not found.
+    """
+    while start < end:
+        kind = pkt_dat[start]
+        if kind == 0:
+            # End of options list.
+            break
+        if kind == 1:
+            # No-operation.
+            start += 1
+            continue
+        if start + 1 >= end:
+            break
+        opt_len = pkt_dat[start + 1]
+        if opt_len < 2:
+            # Malformed option.
+            break
+        if kind == 8 and opt_len == 10 and start + 10 <= end:
+            return struct.unpack_from(">II", pkt_dat, start + 2)
+        start += opt_len
+    return -1, -1
+
+
+def parse_packets(flp, flw_to_cca):
+    """
+    Parses a PCAP file. Considers packets between a specified client and server
+    using specified ports only.
+
+    Returns a dictionary mapping flow to a tuple containing two lists, one for
+    data packets and one for ACK packets:
+        {
+              (client port, server port) :
+                  ([ list of data packets ], [ list of ACK packets ])
+        }
+
+    Each packet is a tuple of the form:
+         (sequence number, timestamp (us),
+          TCP timestamp option TSval, TCP timestamp option TSecr,
+          TCP payload size (B), total packet size (B))
+    """
+    print(f"\tParsing PCAP: {flp}")
+    return decode_packets(read_pcap(flp), flw_to_cca, name=flp)
+
+
+def read_pcap(flp):
+    """
+    Reads a pcap file all at once (to minimize seeks) into this process's
+    reusable buffer. Returns a list of (packet bytes, PktMdat) tuples, where
+    the packet bytes are memoryviews into the buffer. They are valid until the
+    next call to read_pcap() and must be released (e.g., by discarding the
+    list) before then.
+    """
+    size = path.getsize(flp)
+    if len(PCAP_BUF) < size:
+        PCAP_BUF.extend(bytes(size - len(PCAP_BUF)))
+    buf = memoryview(PCAP_BUF)
+    with open(flp, "rb") as fil:
+        assert fil.readinto(buf[:size]) == size, f"Unable to read: {flp}"
+    assert size >= PCAP_GLOBAL_HEADER.size, f"Invalid pcap file: {flp}"
+    magic = struct.unpack_from("<I", buf)[0]
+    if magic in PCAP_MAGICS:
+        order = "<"
+    else:
+        magic = struct.unpack_from(">I", buf)[0]
+        assert magic in PCAP_MAGICS, f"Invalid pcap file: {flp}"
+        order = ">"
+    # Convert nanosecond-resolution timestamps to microseconds.
+    div = PCAP_MAGICS[magic]
+    rec_hdr = struct.Struct(order + "IIII")
+    pkts = []
+    off = PCAP_GLOBAL_HEADER.size
+    while off + rec_hdr.size <= size:
+        sec, frac, caplen, wirelen = rec_hdr.unpack_from(buf, off)
+        off += rec_hdr.size
+        assert off + caplen <= size, f"Truncated pcap file: {flp}"
+        pkts.append(
+            (buf[off:off + caplen], PktMdat(sec, frac // div, wirelen)))
+        off += caplen
+    return pkts
+
+
+def decode_packets(pkts, flw_to_cca, name="", verbose=True):
+    """
+    Decodes a list of captured packets, each of which is a tuple of the form
+    (packet bytes, metadata), where the metadata has "sec", "usec", and
+    "wirelen" attributes (e.g., the output of read_pcap() or
+    capture.Ring.blocks()). The packet bytes may be a bytes object or a
+    memoryview, and are not retained. See parse_packets() for the return
+    format. name is used in error messages. If verbose is True, then prints the
+    number of discarded and truncated packets.
+    """
+    num_pkts = len(pkts)
+
+    def make_empty():
+        """ Make an empty numpy array to store the packets. """
+        return np.full((num_pkts,), -1, dtype=features.PARSE_PACKETS_FETS)
+
+    def remove_unused_rows(arr):
+        """
+        Returns a filtered array with unused rows removed. A row is unused if
+        all of its columns are -1. As an optimization, we check the second
+        column (timestamp) in each row only because the timestamp should never
+        be unknown because it comes from PCAP.
+        """
+        return arr[arr[features.ARRIVAL_TIME_FET] != -1]
+
+    # Format described above. In this form, the arrays will be sparse. Unused
+    # rows will be removed later.
+    flw_to_pkts = {
+        flw_ports: (make_empty(), make_empty())
+        for flw_ports in flw_to_cca.keys()}
+    # The number of packets that were captured with too few bytes to decode the
+    # headers that we need (e.g., because the capture's snapshot length was
+    # too small).
+    num_truncated = 0
+    for idx, (pkt_dat, pkt_mdat) in enumerate(pkts):
+        # Decode the headers directly, rather than using scapy, so that we can
+        # check whether each field was captured before reading it. Assume that
+        # this is an Ethernet/IPv4 packet carrying TCP or UDP.
+        caplen = len(pkt_dat)
+        ip_off = defaults.ETHER_HEADER_SIZE_B
+        if caplen < ip_off + 20:
+            num_truncated += 1
+            continue
+        ip_header_len = (pkt_dat[ip_off] & 0x0f) << 2
+        # Use the IP length, not the captured length, to compute the payload
+        # size.
+        ip_len = struct.unpack_from(">H", pkt_dat, ip_off + 2)[0]
+        is_tcp = pkt_dat[ip_off + 9] == socket.IPPROTO_TCP
+        trans_off = ip_off + ip_header_len
+        if caplen < trans_off + 4:
+            num_truncated += 1
+            continue
+        sport, dport = struct.unpack_from(">HH", pkt_dat, trans_off)
+        # Determine this packet's direction. Assume that the client IP address
+        # if 192.0.0.4 and the server IP address is 192.0.0.2 (see
+        # defaults.CLIENT_IP and defaults.SERVER_IP). Assume that all packets
+        # are between the client and server. The source IP address is the 13th
+        # through 16th bytes of the IP header.
+        if pkt_dat[ip_off + 15] == 4:
+            dir_idx = 0
+            flw = (sport, dport)
+        else:
+            dir_idx = 1
+            flw = (dport, sport)
+        # Assume that the packets are between the relevent machines. Only check
+        # the ports.
+        if flw in flw_to_pkts:
+            # Decode the sequence number and timestamp info.
+            seq = -1
+            ts = (-1, -1)
+            if is_tcp:
+                if caplen < trans_off + 20:
+                    num_truncated += 1
+                    continue
+                seq = struct.unpack_from(">I", pkt_dat, trans_off + 4)[0]
+                trans_header_len = (pkt_dat[trans_off + 12] >> 4) << 2
+                if caplen < trans_off + trans_header_len:
+                    # The options were not captured, so the timestamp option
+                    # is unknown.
+                    num_truncated += 1
+                else:
+                    ts = get_tcp_timestamp(
+                        pkt_dat, trans_off + 20, trans_off + trans_header_len)
+            else:
+                # Start with the UDP header size.
+                trans_header_len = defaults.UDP_HEADER_SIZE_B
+                payload_off = trans_off + trans_header_len
+                cca = flw_to_cca[flw]
+                if cca == "copa":
+                    # Add the Copa header size to the UDP header size.
+                    trans_header_len += defaults.COPA_HEADER_SIZE_B
+                    if caplen < trans_off + trans_header_len:
+                        num_truncated += 1
+                        continue
+                    # The Copa header is the first part of the UDP payload.
+                    #     int seq_num;
+	                #     int flow_id;
+	                #     int src_id;
+	                #     double sender_timestamp;  // milliseconds
+	                #     double receiver_timestamp;  // milliseconds
+                    seq, _, _, sender_ts, receiver_ts = struct.unpack_from(
+                        defaults.COPA_HEADER_FMT, pkt_dat, payload_off)
+                    if seq == -1:
+                        # This is a connection-establishment packet. Skip it.
+                        continue
+                    # Convert from milliseconds to microsecods and then convert
+                    # from a double to an int.
+                    ts = (
+                        int(round(sender_ts * 1000)),
+                        int(round(receiver_ts * 1000)))
+
+                    # Furthermore, the Copa packet data includes:
+                    #     Time sent_time;
+                    #     Time intersend_time;
+                    #     Time intersend_time_vel;
+                    #     Time rtt;
+                    #     double prev_avg_sending_rate;
+                    # These may be of use.
+                elif cca == "vivace":
+                    # PCC Vivace is based on UDT: UDP-based Data Transfer
+                    # Protocol.
+                    #
+                    # See https://tools.ietf.org/pdf/draft-gg-udt-03.pdf
+                    trans_header_len += defaults.UDT_HEADER_SIZE_B
+                    if caplen < payload_off + 4:
+                        num_truncated += 1
+                        continue
+                    first = struct.unpack_from(">I", pkt_dat, payload_off)[0]
+                    if (first & 0x80000000) >> 31:
+                        # Type code of 1 = UDT control packet.
+                        if dir_idx == 0:
+                            # Client -> server control packet. Skip it.
+                            continue
+                        if (first & 0x7fff0000) >> 16 == 2:
+                            # ACK.
+                            trans_header_len += defaults.UDT_ACK_SIZE_B
+                            if caplen < payload_off + 24:
+                                num_truncated += 1
+                                continue
+                            # UDT ACKs contain the RTT, so extract that as the
+                            # first ts value. The second ts field is unused.
+                            seq, rtt = struct.unpack_from(
+                                ">II", pkt_dat, payload_off + 16)
+                            ts = (rtt, -1)
+                        else:
+                            # One of the other seven types of control
+                            # packets. Skip it.
+                            continue
+                    else:
+                        # Type code of 0 = UDT data packet.
+                        seq = first & 0x7fffffff
+
+            flw_to_pkts[flw][dir_idx][idx] = (
+                # Sequence number.
+                seq,
+                # Timestamp. Not using parse_time_us for efficiency purpose. Use
+                # 1000000 instead of 1e6 to avoid converting floats.
+                pkt_mdat.sec * 1000000 + pkt_mdat.usec,
+                # Timestamp option.
+                ts[0],
+                ts[1],
+                # Transport payload. Length of the IP packet minus the length of
+                # the IP header minus the length of the transport header.
+                ip_len - ip_header_len - trans_header_len,
+                # Total packet size.
+                pkt_mdat.wirelen)
+
+    # Remove unused rows.
+    for flw in flw_to_pkts.keys():
+        data, ack = flw_to_pkts[flw]
+        flw_to_pkts[flw] = (remove_unused_rows(data), remove_unused_rows(ack))
+
+    # Verify packet count.
+    tot_pkts = sum(sum(
+        ((dat_pkts.shape[0], ack_pkts.shape[0])
+         for dat_pkts, ack_pkts in flw_to_pkts.values()),
+        ()))
+    assert tot_pkts <= num_pkts, \
+        f"Found more packets than exist ({tot_pkts} > {num_pkts}): {name}"
+    if not verbose or num_pkts == 0:
+        return flw_to_pkts
+    discarded_pkts = num_pkts - tot_pkts
+    print(
+        f"\tDiscarded packets: {discarded_pkts} "
+        f"({discarded_pkts / num_pkts * 100:.2f}%)")
+    if num_truncated > 0:
+        print(
+            f"\tTruncated packets: {num_truncated} "
+            f"({num_truncated / num_pkts * 100:.2f}%). Use a snapshot length "
+            "of at least: "
+            f"{max(get_snaplen(cca) for cca in flw_to_cca.values())} bytes")
+
+    return flw_to_pkts
+
+
+def parse_q_stats(line):
+    """
+    Parses a "stats" line of a BESS queue log. Line should be of the form:
+        ( "stats", src port, enqueued, dequeued, dropped )
+    """
+    return (
+        ("stats",) +
+        tuple(
+            int(tok, 16) if tok.startswith("0x") else int(tok)
+            for tok in line.split(":")[1].split(",")))
+
+
+def parse_q_enq_deq(line):
+    """
+    Parses a packet log line of a BESS queue log. Line should be of the form:
+        ( "enq" or "deq", time ns, src port, seq, payload B, qsize, dropped,
+          queued, batch size )
+    """
+    (event, time_ns, src_port, seq, payload_B, qsize, dropped, queued,
+     batch_size) = [
+         int(tok, 16) if tok.startswith("0x") else int(tok)
+         for tok in line.split(",")]
+
+    event_options = {0, 1}
+    assert event in event_options, f"Event \"{event}\" not in {event_options}"
+    if event == 0:
+        event = "enq"
+    else:
+        event = "deq"
+
+    return (
+        event, time_ns / 1e3, src_port, seq, payload_B, qsize, dropped, queued,
+        batch_size)
+
+
+def parse_queue_log(flp):
+    """
+    Parses the BESS queue log. Returns a list of tuples. See parse_q_stats() and
+    parse_q_enq_deq() for details on the tuple format.
+    """
+    print(f"\tParsing queue log: {flp}")
+    with open(flp, "r") as fil:
+        q_log = list(fil)
+    return [
+        parse_q_stats(line) if line.startswith("stats")
+        else parse_q_enq_deq(line)
+        for line in q_log if line.strip() != ""]
+
+
+def safe_mathis_label(tput_true, tput_mathis):
+    """
+    Returns the Mathis model label based on the true throughput and
+    Mathis model fair throughput. If either component value is -1
+    (unknown), then the resulting label is -1 (unknown).
+    """
+    return (
+        -1 if tput_true == -1 or tput_mathis == -1 else
+        int(tput_true > tput_mathis))
+
+
+def safe_min(val1, val2):
+    """
+    Safely computes the min of two values. If either value is -1 or 0,
+    then that value is discarded and the other value becomes the
+    min. If both values are discarded, then the min is -1 (unknown).
+    """
+    return (
+        -1 if val1 in UNSAFE and val2 in UNSAFE else (
+            val2 if val1 in UNSAFE else (
+                val1 if val2 in UNSAFE else (
+                    min(val1, val2)))))
+
+
+def safe_add(val1, val2):
+    """
+    Safely adds two values. If either value is -1, then the
+    result is -1 (unknown).
+    """
+    return -1 if val1 == -1 or val2 == -1 else val1 + val2
+
+
+def safe_sub(val1, val2):
+    """
+    Safely subtracts two values. If either value is -1, then the
+    result is -1 (unknown).
+    """
+    return -1 if val1 == -1 or val2 == -1 else val1 - val2
+
+
+def safe_mul(val1, val2):
+    """
+    Safely multiplies two values. If either value is -1, then the
+    result is -1 (unknown).
+    """
+    return -1 if val1 == -1 or val2 == -1 else val1 * val2
+
+
+def safe_div(num, den):
+    """
+    Safely divides two values. If either value is -1 or the denominator is 0,
+    then the result is -1 (unknown).
+    """
+    return -1 if num == -1 or den in UNSAFE else num / den
+
+
+def safe_np_div(num_arr, den):
+    """
+    Safely divides a 1D numpy array by a scalar. If an entry in the numerator
+    array is -1 (unknown), then that entry in the output array is -1. If the
+    denominator scalar is -1, then all entries in the output array are -1.
+    """
+    assert num_arr.size == num_arr.shape[0], \
+        f"Array is not 1D: {num_arr.shape}"
+
+    out = np.full_like(num_arr, -1)
+    if den == -1:
+        return out
+    # Popular known entries.
+    mask = num_arr == -1
+    out[mask] = num_arr[mask] / den
+    return out
+
+
+def safe_sqrt(val):
+    """
+    Safely calculates the square root of a value. If the value is -1 (unknown),
+    then the result is -1 (unknown).
+    """
+    return -1 if val == -1 else math.sqrt(val)
+
+
+def safe_abs(val):
+    """
+    Safely calculates the absolute value of a value. If the value is -1
+    (unknown), then the result is -1 (unknown).
+    """
+    return -1 if val == -1 else abs(val)
+
+
+def get_safe(dat, start_idx=None, end_idx=None):
+    """
+    Returns a filtered window between the two specified indices, with all
+    unknown values (-1) removed.
+    """
+    if start_idx is None:
+        start_idx = 0
+    if end_idx is None:
+        end_idx = 0 if dat.shape[0] == 0 else dat.shape[0] - 1
+    # Extract the window.
+    dat_win = dat[start_idx:end_idx + 1]
+    # Eliminate values that are -1 (unknown).
+    return dat_win[dat_win != -1]
+
+
+def safe_sum(dat, start_idx=None, end_idx=None):
+    """
+    Safely calculates a sum over a window. Any values that are -1
+    (unknown) are discarded. The sum of an empty window is -1 (unknown).
+    """
+    dat_safe = get_safe(dat, start_idx, end_idx)
+    # If the window is empty, then the mean is -1 (unknown).
+    return -1 if dat_safe.shape[0] == 0 else np.sum(dat_safe)
+
+
+def safe_mean(dat, start_idx=None, end_idx=None):
+    """
+    Safely calculates a mean over a window. Any values that are -1
+    (unknown) are discarded. The mean of an empty window is -1
+    (unknown).
+    """
+    dat_safe = get_safe(dat, start_idx, end_idx)
+    # If the window is empty, then the mean is -1 (unknown).
+    return -1 if dat_safe.shape[0] == 0 else np.mean(dat_safe)
+
+
+def safe_update_ewma(prev_ewma, new_val, alpha):
+    """
+    Safely updates an exponentially weighted moving average. If the previous
+    EWMA is -1 (unknown), then the new EWMA is assumed to be the unweighted new
+    value. If the new value is unknown, then the EWMA does not change.
+    """
+    return (
+        new_val if prev_ewma == -1
+        else (
+            prev_ewma if new_val == -1
+            else alpha * new_val + (1 - alpha) * prev_ewma))
+
+
+def zip_timeseries(xs, ys):
+    """ Zips together multiple timeseries from the same timespace. """
+    assert xs
+    assert ys
+    assert len(xs) == len(ys)
+    for idx in range(len(xs)):
+        assert xs[idx].shape[0] == ys[idx].shape[0]
+
+    idxs = [0] * len(xs)
+    tot = sum(xs_.shape[0] for xs_ in xs)
+    xs_o = np.full((tot,), -1, dtype=xs[0].dtype)
+    ys_o = np.full((tot,), -1, dtype=ys[0].dtype)
+    idx_o = 0
+
+    while idx_o < xs_o.shape[0]:
+        chosen = None
+        earliest = sys.maxsize
+
+        for idx in range(len(xs)):
+            if idxs[idx] < xs[idx].shape[0]:
+                proposed_earliest = xs[idx][idxs[idx]]
+                if proposed_earliest < earliest:
+                    chosen = idx
+                    earliest = proposed_earliest
+        assert chosen is not None, "Ran out of points."
+
+        xs_o[idx_o] = xs[chosen][idxs[chosen]]
+        ys_o[idx_o] = ys[chosen][idxs[chosen]]
+        idx_o += 1
+        idxs[chosen] += 1
+    return xs_o, ys_o
+
+
+def find_bound(vals, target, min_idx, max_idx, which):
+    """
+    Returns the first index that is either before or after a particular target.
+    vals must be monotonically increasing.
+    """
+    assert min_idx >= 0
+    assert max_idx >= min_idx
+    assert which in {"before", "after"}
+    if min_idx == max_idx:
+        return min_idx
+
+    bound = min_idx
+    # Walk forward until the target time is in the past.
+    while bound < (max_idx if which == "before" else max_idx - 1):
+        time_us = vals[bound]
+        if time_us == -1 or time_us < target:
+            bound += 1
+        else:
+            break
+
+    if which == "before":
+        # If we walked forward, then walk backward to the last valid time.
+        while bound > min_idx:
+            bound -= 1
+            if vals[bound] != -1:
+                break
+
+    assert min_idx <= bound <= max_idx
+    return bound
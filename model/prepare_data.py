@@ -5,15 +5,20 @@ training, validation, and test sets.
 """
 
 import argparse
+import contextlib
 import math
 import os
 from os import path
 import time
-import random
 
 import numpy as np
 
 import cl_args
+import defaults
+import frames
+import numa
+import rand
+import staging
 import utils
 
 
@@ -21,13 +26,46 @@ class Split:
     """ Represents either the training, validation, or test split. """
 
     def __init__(self, name, split_frac, sample_frac, out_dir, dtype,
-                 num_pkts_tot, shuffle):
+                 num_pkts_tot, shuffle, compress, spill_dir, budget_B):
         self.name = name
         self.frac = split_frac * sample_frac
         self.shuffle = shuffle
         self.fets = dtype.names
 
-        flp = utils.get_split_data_flp(out_dir, name)
+        num_pkts = math.ceil(num_pkts_tot * self.frac)
+        # Write the uncompressed split in space reserved from the staging
+        # budget of out_dir's filesystem (see staging.py), which may spill to
+        # spill_dir. When compressing, the uncompressed split is an
+        # intermediate file. Otherwise, finish() moves it out of the staging
+        # directory and into place. Closing self.stage deletes the staging
+        # directory.
+        self.out_dir = out_dir
+        self.data_flp = utils.get_split_data_flp(out_dir, name)
+        # Remove an uncompressed split from a previous run, including the
+        # file that it was spilled to, if any.
+        if path.islink(self.data_flp):
+            target_flp = os.readlink(self.data_flp)
+            if path.exists(target_flp):
+                os.remove(target_flp)
+        if path.lexists(self.data_flp):
+            os.remove(self.data_flp)
+        self.stage = contextlib.ExitStack()
+        self.stage_dir = None
+        if num_pkts > 0:
+            self.stage_dir = self.stage.enter_context(staging.reserve(
+                num_pkts * dtype.itemsize, out_dir, spill_dir, budget_B,
+                name=f"split-{name}"))
+            flp = utils.get_split_data_flp(self.stage_dir, name)
+        else:
+            flp = self.data_flp
+        self.flp = flp
+        frames_flp = utils.get_split_frames_flp(out_dir, name)
+        # Remove compressed data from a previous run, since utils.load_split()
+        # would prefer it over the new data.
+        if path.exists(frames_flp):
+            os.remove(frames_flp)
+        # If compress, then the finished split is compressed into frames_flp.
+        self.frames_flp = frames_flp if compress else None
         print(
             f"\tInitializing split \"{self.name}\" "
             f"({split_frac * 100}%, sampling {sample_frac * 100}%"
@@ -37,7 +75,6 @@ class Split:
         # cannot have methods called on it.
         self.finished = False
 
-        num_pkts = math.ceil(num_pkts_tot * self.frac)
         if num_pkts == 0:
             self.dat = None
         else:
@@ -45,6 +82,8 @@ class Split:
             # be computed are replaced with -1. When reading the splits later,
             # we can detect incomplete feature values by looking for -1s.
             self.dat = np.memmap(flp, dtype=dtype, mode="w+", shape=(num_pkts,))
+            # Split.take() fills the split in order.
+            utils.advise(self.dat, "sequential")
 
         # The next available index in self.dat.
         self.idx = 0
@@ -56,11 +95,12 @@ class Split:
         utils.save_split_metadata(
             out_dir, self.name, dat=(num_pkts, dtype.descr))
 
-    def take(self, exp_dat, exp_available_idxs):
+    def take(self, exp_dat, exp_available_idxs, exp_name):
         """
-        Takes this Split's specified fraction of data from exp_dat,
-        choosing from exp_available_idxs. Removes the chosen indices from
-        exp_available_idxs and returns the modified version.
+        Takes this Split's specified fraction of data from exp_dat (which
+        belongs to the experiment named exp_name), choosing from
+        exp_available_idxs. Removes the chosen indices from exp_available_idxs
+        and returns the modified version.
         """
         assert not self.finished, "Trying to call a method on a finished Split."
         if self.dat is None:
@@ -78,9 +118,12 @@ class Split:
             (f"Selecting 0 of {num_exp_pkts} packets, but fraction is: "
              f"{self.frac}")
         # Randomly select the packets to pull into this split. This must be
-        # random to capture a diverse set of situations.
-        exp_new_idxs = random.sample(exp_available_idxs, num_new)
-        exp_available_idxs -= set(exp_new_idxs)
+        # random to capture a diverse set of situations. The selection depends
+        # only on the experiment and the split, not on the order in which
+        # experiments are processed.
+        exp_new_idxs = rand.get(f"take-{self.name}", exp=exp_name).choice(
+            sorted(exp_available_idxs), num_new, replace=False)
+        exp_available_idxs -= set(exp_new_idxs.tolist())
 
         # Identify the indices in the merged array.
         start_idx = self.idx
@@ -112,12 +155,44 @@ class Split:
         if self.shuffle:
             print(f"Shuffling split \"{self.name}\"...")
             tim_srt_s = time.time()
-            np.random.default_rng().shuffle(self.dat)
+            # Shuffling touches every page, so start reading them all.
+            utils.advise(self.dat, "willneed")
+            rand.get(f"shuffle-{self.name}").shuffle(self.dat)
             print(
                 f"Done shuffling split \"{self.name}\" "
                 f"(took {time.time() - tim_srt_s:.2f} seconds)")
 
         self.dat.flush()
+        if self.frames_flp is None:
+            # The uncompressed split is the final output. Move it out of the
+            # staging directory before releasing the reservation. If it
+            # spilled, then leave it on the spill filesystem and link to it.
+            self.dat = None
+            if path.samefile(path.dirname(self.stage_dir), self.out_dir):
+                os.rename(self.flp, self.data_flp)
+            else:
+                spill_flp = path.join(
+                    path.dirname(self.stage_dir),
+                    f"{path.basename(self.stage_dir)}-"
+                    f"{path.basename(self.data_flp)}")
+                os.rename(self.flp, spill_flp)
+                os.symlink(spill_flp, self.data_flp)
+                print(f"Split \"{self.name}\" spilled to: {spill_flp}")
+            self.stage.close()
+        else:
+            print(f"Compressing split \"{self.name}\"...")
+            tim_srt_s = time.time()
+            utils.advise(self.dat, "sequential")
+            size_B = frames.write(self.frames_flp, self.dat)
+            raw_B = self.dat.nbytes
+            # Release the memmap before deleting its file.
+            self.dat = None
+            self.stage.close()
+            print(
+                f"Done compressing split \"{self.name}\" "
+                f"({raw_B / 2**20:.2f} MB -> {size_B / 2**20:.2f} MB, "
+                f"{raw_B / size_B:.2f}x, took "
+                f"{time.time() - tim_srt_s:.2f} seconds)")
 
 
 def survey(exp_flps, warmup_frac):
@@ -169,18 +244,23 @@ def survey(exp_flps, warmup_frac):
 
 
 def merge(exp_flps, out_dir, num_pkts, dtype, split_fracs, warmup_frac,
-          sample_frac):
+          sample_frac, compress, spill_dir, budget_B):
     """
     Merges the provided experiments into training, validation, and
     test splits as defined by the percents in split_fracs. Stores the
     resulting files in out_dir. The experiments contain a total of
-    num_pkts packets and have the provided dtype.
+    num_pkts packets and have the provided dtype. Writes the uncompressed
+    splits using the staging budget of out_dir's filesystem of budget_B
+    bytes, spilling over to spill_dir. If compress, then stores the splits as
+    compressed frames (see frames.py). Otherwise, keeps the uncompressed
+    splits, linking to those that spilled from out_dir.
     """
     print("Preparing split files...")
     splits = {
         name: Split(
             name, split_frac, sample_frac, out_dir, dtype, num_pkts,
-            shuffle=name == "train")
+            shuffle=name == "train", compress=compress, spill_dir=spill_dir,
+            budget_B=budget_B)
         for name, split_frac in split_fracs.items()}
     # Keep track of the number of packets that do not get selected for
     # any of the splits.
@@ -212,7 +292,7 @@ def merge(exp_flps, out_dir, num_pkts, dtype, split_fracs, warmup_frac,
         all_idxs = set(range(dat.shape[0]))
         # For each split, take a fraction of the experiment packets.
         for split in splits.values():
-            all_idxs = split.take(dat, all_idxs)
+            all_idxs = split.take(dat, all_idxs, exp.name)
         # Record how many packets are not being moved to one of the
         # merged files.
         pkts_forgotten += len(all_idxs)
@@ -253,6 +333,25 @@ def main():
     psr.add_argument(
         "--test-split", default=30, help="Test data fraction",
         required=False, type=float)
+    psr.add_argument(
+        "--compress", action="store_true",
+        help=("Store the splits as compressed frames instead of as raw "
+              "arrays. Reading a split sequentially (e.g., data.get_split()) "
+              "is faster when it is compressed, but gathering random rows "
+              "decompresses an entire frame per row, so leave splits that "
+              "are read by gathers uncompressed."))
+    psr.add_argument(
+        "--spill-dir", default=defaults.STAGING_SPILL_DIR,
+        help=("The directory in which to write uncompressed splits that do "
+              "not fit within the staging budget of \"--out-dir\". Spilled "
+              "splits that are not compressed stay there, and \"--out-dir\" "
+              "links to them."),
+        type=str)
+    psr.add_argument(
+        "--staging-budget-GB", default=defaults.STAGING_BUDGET_B / 2**30,
+        help=("The total size of the files to stage on the filesystem of "
+              "\"--out-dir\" at once, across all processes and stages."),
+        type=float)
     psr, psr_verify = cl_args.add_sample_percent(*cl_args.add_out(
         *cl_args.add_warmup(*cl_args.add_num_exps(psr))))
     args = psr_verify(psr.parse_args())
@@ -271,7 +370,10 @@ def main():
     exp_flps = [
         path.join(exps_dir, fln) for fln in os.listdir(exps_dir)
         if not fln.startswith(defaults.DATA_PREFIX) and fln.endswith(".npz")]
-    random.shuffle(exp_flps)
+    # Sort first so that the shuffled order does not depend on the order in
+    # which os.listdir() returns files.
+    exp_flps.sort()
+    rand.get("select-exps").shuffle(exp_flps)
     num_exps = len(exp_flps) if args.num_exps is None else args.num_exps
     exp_flps = exp_flps[:num_exps]
     print(f"Selected {num_exps} experiments")
@@ -282,10 +384,16 @@ def main():
         f"Total packets: {num_pkts}\nFeatures ({len(dtype.names)}):\n\t" +
         "\n\t".join(sorted(dtype.names)))
 
+    # The merged splits are memmaps that this process populates. Pin it to the
+    # NUMA node with the most free memory so that their pages are allocated
+    # (on first touch) on the same node that writes and shuffles them.
+    print(f"Pinned to NUMA node: {numa.pin()}")
     # Create the merged training, validation, and test files.
     merge(
         exp_flps, args.out_dir, num_pkts, dtype, split_fracs, warmup_frac,
-        sample_frac)
+        sample_frac, compress=args.compress,
+        spill_dir=args.spill_dir,
+        budget_B=int(args.staging_budget_GB * 2**30))
     print(f"Finished - time: {time.time() - tim_srt_s:.2f} seconds")
     return 0
 
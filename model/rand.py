@@ -0,0 +1,58 @@
+"""
+Counter-based random number generation.
+
+Instead of drawing from the global Python, numpy, or Torch random state (whose
+output depends on the order in which callers happen to run), each consumer of
+randomness draws from its own Philox stream whose key is derived from
+(seed, experiment, flow, stage). Philox is counter-based: its output is a pure
+function of the key and the position in the stream, so a stage produces the
+same values whether experiments are processed serially or in parallel, and in
+any order.
+
+The key is the first 16 bytes of the BLAKE2b digest of the string
+"<seed>/<experiment>/<flow>/<stage>", interpreted as a little-endian integer,
+so that any Philox4x64 implementation can reproduce a stream.
+"""
+
+import hashlib
+import secrets
+
+import numpy as np
+
+
+# The run-wide seed. Overridden by utils.set_rand_seed() (e.g., when using
+# "--no-rand"). Otherwise, chosen randomly when this module is first imported
+# so that runs differ from each other.
+SEED = secrets.randbits(64)
+
+
+def set_seed(seed):
+    """ Sets the run-wide seed from which all stream keys are derived. """
+    global SEED
+    SEED = seed
+
+
+def get_key(stage, exp=None, flw=None, seed=None):
+    """
+    Returns the 128-bit Philox key for the provided stage, experiment, and
+    flow. exp and flw may be any values with a stable string representation
+    (e.g., an experiment name and a flow index), or None if the stage is not
+    specific to an experiment or flow. If seed is None, then uses the run-wide
+    seed.
+    """
+    seed = SEED if seed is None else seed
+    return int.from_bytes(
+        hashlib.blake2b(
+            f"{seed}/{exp}/{flw}/{stage}".encode(), digest_size=16).digest(),
+        "little")
+
+
+def get(stage, exp=None, flw=None, seed=None):
+    """
+    Returns a numpy Generator that draws from the Philox stream for the
+    provided stage, experiment, and flow. See get_key() for details. Two calls
+    with the same arguments return independent Generators that produce the
+    same values.
+    """
+    return np.random.Generator(
+        np.random.Philox(key=get_key(stage, exp, flw, seed)))
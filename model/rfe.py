@@ -0,0 +1,175 @@
+"""
+Recursive feature elimination (RFE) for linear sklearn models.
+
+sklearn's RFE and RFECV refit the underlying model from scratch after every
+elimination step. For our hundreds of candidate features, that is very
+expensive. The versions in this file warm-start each fit from the previous
+step's coefficients and eliminate all features with zero coefficients at once.
+The resulting objects expose the same "support_", "ranking_", and
+"estimator_" attributes as their sklearn counterparts.
+"""
+
+import multiprocessing
+
+import numpy as np
+from sklearn import base
+from sklearn import model_selection
+
+import defaults
+
+
+def get_importances(est):
+    """
+    Returns the importance of each feature to a fitted linear model, which is
+    the L1 norm of that feature's coefficients across all classes.
+    """
+    return np.abs(np.atleast_2d(est.coef_)).sum(axis=0)
+
+
+def eliminate(est, dat_in, dat_out, num_to_select, step, on_fit=None):
+    """
+    Recursively eliminates features from dat_in until num_to_select features
+    remain. est is modified in place. After each fit, calls on_fit (if it is not
+    None) with the arguments:
+        (number of features, number of features with nonzero importance,
+         fitted model, indices of the features used)
+    Returns a tuple of the form:
+        (support mask, ranking, fitted model)
+    """
+    num_fets = dat_in.shape[1]
+    assert 0 < num_to_select <= num_fets, \
+        (f"Cannot select {num_to_select} features from {num_fets} features.")
+    assert step > 0, f"\"step\" must be greater than 0, but is: {step}"
+    support = np.ones((num_fets,), dtype=bool)
+    ranking = np.ones((num_fets,), dtype=int)
+    # LogisticRegressionCV does not support warm starts.
+    warm = "warm_start" in est.get_params()
+    if warm:
+        est.set_params(warm_start=True)
+
+    while True:
+        fets = np.flatnonzero(support)
+        num_cur = fets.shape[0]
+        est.fit(dat_in[:, fets], dat_out)
+        imps = get_importances(est)
+        num_zero = int((imps == 0).sum())
+        if on_fit is not None:
+            on_fit(num_cur, num_cur - num_zero, est, fets)
+        if num_cur <= num_to_select:
+            break
+
+        # Features with zero coefficients do not influence the model, so
+        # eliminating all of them at once does not change the model. Therefore,
+        # eliminate either all features with zero coefficients or step features,
+        # whichever is more.
+        order = np.argsort(imps, kind="stable")
+        num_elim = min(max(step, num_zero), num_cur - num_to_select)
+        support[fets[order[:num_elim]]] = False
+        ranking[np.logical_not(support)] += 1
+        if warm:
+            # Drop the eliminated features' coefficients so that the next fit
+            # starts from the current solution. Keep the remaining features in
+            # their original order.
+            est.coef_ = est.coef_[:, np.sort(order[num_elim:])]
+    return support, ranking, est
+
+
+class Rfe:
+    """ Recursive feature elimination with warm starts. """
+
+    def __init__(self, estimator, n_features_to_select=10, step=10):
+        self.estimator = estimator
+        self.n_features_to_select = n_features_to_select
+        self.step = step
+        self.support_ = None
+        self.ranking_ = None
+        self.n_features_ = None
+        self.estimator_ = None
+
+    def fit(self, dat_in, dat_out):
+        """ Fits this model to the provided dataset. """
+        dat_in = np.asarray(dat_in)
+        self.support_, self.ranking_, self.estimator_ = eliminate(
+            base.clone(self.estimator), dat_in, np.asarray(dat_out),
+            min(self.n_features_to_select, dat_in.shape[1]), self.step)
+        self.n_features_ = int(self.support_.sum())
+        return self
+
+    def transform(self, dat_in):
+        """ Selects the chosen features from dat_in. """
+        return np.asarray(dat_in)[:, self.support_]
+
+    def predict(self, dat_in):
+        """ Runs inference using only the chosen features. """
+        return self.estimator_.predict(self.transform(dat_in))
+
+
+def score_fold(est, dat_in, dat_out, trn_idxs, val_idxs, step):
+    """
+    Eliminates features using one cross-validation fold. Returns an array where
+    entry i is the validation accuracy when using i features (NaN if that
+    number of features was not evaluated).
+    """
+    num_fets = dat_in.shape[1]
+    scores = np.full((num_fets + 1,), float("NaN"))
+    dat_in_val = dat_in[val_idxs]
+    dat_out_val = dat_out[val_idxs]
+
+    def on_fit(num_cur, num_nonzero, est, fets):
+        # The models that would result from dropping any of the features with
+        # zero coefficients are the same as this one, so they have the same
+        # score.
+        scores[max(num_nonzero, 1):num_cur + 1] = est.score(
+            dat_in_val[:, fets], dat_out_val)
+
+    eliminate(
+        est, dat_in[trn_idxs], dat_out[trn_idxs], num_to_select=1, step=step,
+        on_fit=on_fit)
+    return scores
+
+
+class RfeCv(Rfe):
+    """
+    Recursive feature elimination with warm starts that uses cross-validation
+    to pick the number of features. The folds are evaluated in parallel.
+    """
+
+    def __init__(self, estimator, step=1, folds=10):
+        super().__init__(estimator, n_features_to_select=None, step=step)
+        self.folds = folds
+        self.cv_results_ = None
+
+    def fit(self, dat_in, dat_out):
+        dat_in = np.asarray(dat_in)
+        dat_out = np.asarray(dat_out)
+        # The folds run in parallel, so each fold's model should use a single
+        # core.
+        est = base.clone(self.estimator)
+        if "n_jobs" in est.get_params():
+            est.set_params(n_jobs=1)
+        fold_args = [
+            (base.clone(est), dat_in, dat_out, trn_idxs, val_idxs, self.step)
+            for trn_idxs, val_idxs in model_selection.StratifiedKFold(
+                self.folds).split(dat_in, dat_out)]
+        # Daemonic processes (e.g., multiprocessing.Pool workers) cannot create
+        # their own worker pools.
+        if defaults.SYNC or multiprocessing.current_process().daemon:
+            scores = [score_fold(*args) for args in fold_args]
+        else:
+            with multiprocessing.Pool(
+                    processes=min(self.folds, multiprocessing.cpu_count())
+            ) as pol:
+                scores = pol.starmap(score_fold, fold_args)
+        scores = np.array(scores)[:, 1:]
+        # Steps that no fold reached have no scores. Leave their mean and
+        # standard deviation as NaN without averaging over an empty slice.
+        reached = ~np.isnan(scores).all(axis=0)
+        mean = np.full((scores.shape[1],), np.nan)
+        std = np.full((scores.shape[1],), np.nan)
+        mean[reached] = np.nanmean(scores[:, reached], axis=0)
+        std[reached] = np.nanstd(scores[:, reached], axis=0)
+        self.cv_results_ = {"mean_test_score": mean, "std_test_score": std}
+        # Pick the smallest number of features with the best mean score.
+        self.n_features_to_select = int(
+            np.nanargmax(self.cv_results_["mean_test_score"])) + 1
+        return super().fit(dat_in, dat_out)
@@ -0,0 +1,164 @@
+"""
+Accounting for intermediate files staged on a RAM-backed tmpfs (e.g., untarred
+experiments and uncompressed splits).
+
+Each stage reserves the space that it expects to use with reserve(), which
+returns a fresh directory. If the reservation fits within the budget for the
+tmpfs (and the tmpfs has that much free space), then the directory is on the
+tmpfs. Otherwise, the reservation spills over to a directory on a local disk.
+Processes share the budget through a ledger: one file per reservation, updated
+under a file lock. There is one ledger per filesystem (keyed by device ID, and
+kept in defaults.STAGING_DIR), so stages that use different directories on the
+same tmpfs share its budget. A reservation's directory and ledger entry are
+removed when it is released. Reservations left behind by processes that died
+are reclaimed the next time that any process reserves space.
+"""
+
+from contextlib import contextmanager
+import fcntl
+import json
+import os
+from os import path
+import shutil
+import struct
+import tempfile
+
+import defaults
+
+
+LEDGER_DIRN = ".staging"
+LOCK_FLN = "lock"
+ENTRY_SUFFIX = ".json"
+
+
+def get_gzip_size_B(flp):
+    """
+    Returns the uncompressed size of the provided gzip file, as recorded in its
+    trailer. The trailer stores the size modulo 2**32, so this is a lower bound
+    for files larger than 4 GB. Never returns less than the compressed size.
+    """
+    with open(flp, "rb") as fil:
+        fil.seek(-4, os.SEEK_END)
+        size_B = struct.unpack("<I", fil.read(4))[0]
+    return max(size_B, path.getsize(flp))
+
+
+def is_alive(pid):
+    """ Returns whether a process with the provided PID exists. """
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    except PermissionError:
+        return True
+    return True
+
+
+def get_ledger_dir(tmp_dir):
+    """
+    Returns the ledger directory for the filesystem that contains tmp_dir.
+    """
+    return path.join(
+        defaults.STAGING_DIR, f"{LEDGER_DIRN}-{os.stat(tmp_dir).st_dev}")
+
+
+@contextmanager
+def locked_ledger(tmp_dir):
+    """
+    Locks the ledger for the filesystem that contains tmp_dir, creating it if
+    necessary, and yields the ledger directory.
+    """
+    os.makedirs(tmp_dir, exist_ok=True)
+    ledger_dir = get_ledger_dir(tmp_dir)
+    os.makedirs(ledger_dir, exist_ok=True)
+    with open(path.join(ledger_dir, LOCK_FLN), "a") as fil:
+        fcntl.flock(fil, fcntl.LOCK_EX)
+        try:
+            yield ledger_dir
+        finally:
+            fcntl.flock(fil, fcntl.LOCK_UN)
+
+
+def read_ledger(ledger_dir):
+    """
+    Returns the ledger's reservations, as a list of tuples of the form:
+        (entry filepath, reservation dictionary)
+    Reclaims (i.e., deletes the directories and entries of) reservations made
+    by processes that no longer exist. Must be called with the ledger locked.
+    """
+    entries = []
+    for fln in os.listdir(ledger_dir):
+        if not fln.endswith(ENTRY_SUFFIX):
+            continue
+        entry_flp = path.join(ledger_dir, fln)
+        try:
+            with open(entry_flp, "r") as fil:
+                res = json.load(fil)
+        except (OSError, ValueError):
+            # A partially-written entry from a process that crashed.
+            os.remove(entry_flp)
+            continue
+        if is_alive(res["pid"]):
+            entries.append((entry_flp, res))
+            continue
+        print(
+            f"Reclaiming {res['size_B'] / 2**30:.2f} GB of staging space "
+            f"from dead process {res['pid']}: {res['dir']}")
+        shutil.rmtree(res["dir"], ignore_errors=True)
+        os.remove(entry_flp)
+    return entries
+
+
+def get_used_B(tmp_dir):
+    """
+    Returns the number of bytes of the budget of tmp_dir's filesystem that are
+    currently reserved.
+    """
+    with locked_ledger(tmp_dir) as ledger_dir:
+        return sum(
+            res["size_B"] for _, res in read_ledger(ledger_dir)
+            if not res["spilled"])
+
+
+@contextmanager
+def reserve(size_B, tmp_dir=defaults.STAGING_DIR,
+            spill_dir=defaults.STAGING_SPILL_DIR,
+            budget_B=defaults.STAGING_BUDGET_B, name="stage"):
+    """
+    Reserves size_B bytes of staging space and yields a new, empty directory
+    in which to stage files. The directory is in tmp_dir if the reservation
+    fits within budget_B (which all reservations on tmp_dir's filesystem
+    share) and in tmp_dir's free space, and in spill_dir otherwise. Deletes
+    the directory and releases the reservation on exit.
+    """
+    with locked_ledger(tmp_dir) as ledger_dir:
+        used_B = sum(
+            res["size_B"] for _, res in read_ledger(ledger_dir)
+            if not res["spilled"])
+        stat = os.statvfs(tmp_dir)
+        spilled = (
+            used_B + size_B > budget_B or
+            size_B > stat.f_bavail * stat.f_frsize)
+        if spilled:
+            print(
+                f"Staging {size_B / 2**30:.2f} GB for \"{name}\" in "
+                f"{spill_dir}, since {used_B / 2**30:.2f} GB of "
+                f"the {budget_B / 2**30:.2f} GB budget for {tmp_dir}'s "
+                "filesystem are in use")
+            os.makedirs(spill_dir, exist_ok=True)
+        stage_dir = tempfile.mkdtemp(
+            prefix=f"{name}-", dir=spill_dir if spilled else tmp_dir)
+        entry_flp = path.join(
+            ledger_dir, f"{path.basename(stage_dir)}{ENTRY_SUFFIX}")
+        with open(entry_flp, "w") as fil:
+            json.dump(
+                {"pid": os.getpid(), "size_B": size_B, "dir": stage_dir,
+                 "spilled": spilled},
+                fil)
+    try:
+        yield stage_dir
+    finally:
+        shutil.rmtree(stage_dir, ignore_errors=True)
+        with locked_ledger(tmp_dir):
+            if path.exists(entry_flp):
+                os.remove(entry_flp)
@@ -0,0 +1,617 @@
+""" Streaming estimators that are updated one packet at a time. """
+
+import bisect
+import collections
+import itertools
+import math
+import random
+
+
+class WindowedMin:
+    """
+    Tracks the minimum of the values observed during a sliding time window.
+    Uses a monotonic deque, so each update takes amortized constant time and
+    the state never holds more than one entry per packet in the window.
+    """
+
+    def __init__(self, win_us):
+        assert win_us > 0, f"Invalid window size: {win_us} us"
+        self.win_us = win_us
+        # Entries of the form (time us, value), in increasing order of both
+        # time and value.
+        self.deq = collections.deque()
+
+    def update(self, time_us, val):
+        """
+        Records a value observed at time time_us, which must not be earlier
+        than the time of any previous update. Returns the minimum value
+        observed during the window (time_us - win_us, time_us]. Unknown values
+        (-1) are ignored. If there are no known values in the window, then
+        returns -1 (unknown).
+        """
+        if val != -1:
+            # Remove entries that can never again be the minimum, since they
+            # are older than val and not smaller than it.
+            while self.deq and self.deq[-1][1] >= val:
+                self.deq.pop()
+            self.deq.append((time_us, val))
+        # Remove entries that have left the window.
+        while self.deq and self.deq[0][0] <= time_us - self.win_us:
+            self.deq.popleft()
+        return self.deq[0][1] if self.deq else -1
+
+
+class SeqRangeTracker:
+    """
+    Tracks which sequence numbers a sender has transmitted, as a sorted list of
+    disjoint ranges. Senders transmit mostly in order, so new data usually
+    extends the last range and each update takes amortized constant time. The
+    number of ranges is bounded by the number of holes in the sequence space.
+    """
+
+    def __init__(self):
+        # Parallel lists of range starts (inclusive) and ends (exclusive).
+        self.starts = []
+        self.ends = []
+
+    def add(self, seq, length):
+        """
+        Records the transmission of sequence numbers [seq, seq + length).
+        Returns whether any of them had been transmitted before (i.e., whether
+        this is a retransmission).
+        """
+        end = seq + max(length, 1)
+        starts = self.starts
+        ends = self.ends
+        # Fast path: new data beyond the last range.
+        if not starts or ends[-1] <= seq:
+            if starts and ends[-1] == seq:
+                ends[-1] = end
+            else:
+                starts.append(seq)
+                ends.append(end)
+            return False
+
+        # Slow path: find the ranges that overlap or touch [seq, end).
+        first = bisect.bisect_left(ends, seq)
+        last = bisect.bisect_right(starts, end)
+        retrans = any(
+            starts[idx] < end and seq < ends[idx] for idx in range(first, last))
+        # Merge [seq, end) with those ranges.
+        if first < last:
+            seq = min(seq, starts[first])
+            end = max(end, ends[last - 1])
+        starts[first:last] = [seq]
+        ends[first:last] = [end]
+        return retrans
+
+
+class KllSketch:
+    """
+    A KLL quantile sketch (Karnin, Lang, and Liberty, "Optimal Quantile
+    Approximation in Streams", FOCS 2016). Stores a bounded number of values in
+    a hierarchy of compactors. When a compactor fills up, it sorts its values
+    and promotes every other one to the next compactor, where each value
+    represents twice as many original values. Updates take amortized constant
+    time, and sketches can be merged.
+    """
+
+    def __init__(self, k=64):
+        assert k >= 2, f"Invalid sketch size: {k}"
+        self.k = k
+        # compactors[h] holds values with weight 2**h.
+        self.compactors = [[]]
+        # The number of values stored in all compactors.
+        self.size = 0
+        # The number of stored values that triggers a compaction.
+        self.max_size = self.capacity(0)
+        # Alternates which half of a compactor's values are promoted. This is
+        # deterministic (unlike the randomized offset in the paper) so that
+        # parsing is reproducible.
+        self.offset = 0
+
+    def capacity(self, level):
+        """ Returns the capacity of the compactor at the provided level. """
+        depth = len(self.compactors) - level - 1
+        return max(2, int(math.ceil(self.k * (2 / 3) ** depth)))
+
+    def grow(self):
+        """ Adds a compactor at the top of the hierarchy. """
+        self.compactors.append([])
+        self.max_size = sum(
+            self.capacity(level) for level in range(len(self.compactors)))
+
+    def compress(self):
+        """ Compacts the lowest compactor that is at capacity. """
+        for level, cmp in enumerate(self.compactors):
+            if len(cmp) >= self.capacity(level):
+                if level + 1 >= len(self.compactors):
+                    self.grow()
+                cmp.sort()
+                # If there is an odd number of values, then keep the last one
+                # at this level.
+                keep = [cmp.pop()] if len(cmp) % 2 else []
+                self.compactors[level + 1].extend(cmp[self.offset::2])
+                self.offset ^= 1
+                self.compactors[level] = keep
+                break
+        self.size = sum(len(cmp) for cmp in self.compactors)
+
+    def update(self, val):
+        """ Adds a value to this sketch. """
+        self.compactors[0].append(val)
+        self.size += 1
+        if self.size >= self.max_size:
+            self.compress()
+
+    def merge(self, other):
+        """ Adds all of the values in another sketch to this sketch. """
+        while len(self.compactors) < len(other.compactors):
+            self.grow()
+        for level, cmp in enumerate(other.compactors):
+            self.compactors[level].extend(cmp)
+        self.size = sum(len(cmp) for cmp in self.compactors)
+        while self.size >= self.max_size:
+            self.compress()
+
+    def weighted(self):
+        """ Returns a list of this sketch's values, as (value, weight) pairs. """
+        return [
+            (val, 2**level)
+            for level, cmp in enumerate(self.compactors) for val in cmp]
+
+    def quantile(self, qnt):
+        """
+        Returns an estimate of the qnt-th quantile (in the range [0, 1]) of the
+        values in this sketch, or -1 (unknown) if it is empty.
+        """
+        return weighted_quantile(self.weighted(), qnt)
+
+
+def weighted_quantile(weighted, qnt):
+    """
+    Returns the qnt-th quantile (in the range [0, 1]) of a list of
+    (value, weight) pairs, or -1 (unknown) if the list is empty.
+    """
+    if not weighted:
+        return -1
+    weighted.sort()
+    target = qnt * sum(weight for _, weight in weighted)
+    total = 0
+    for val, weight in weighted:
+        total += weight
+        if total >= target:
+            return val
+    return weighted[-1][0]
+
+
+class SlidingQuantiles:
+    """
+    Estimates quantiles of the values observed during a sliding time window.
+    The window is divided into slots, each of which has its own KllSketch.
+    Slots expire as a whole, so the window's duration is accurate to within one
+    slot, and memory is bounded by the number of slots times the size of one
+    sketch. Only the newest slot changes between slot boundaries, so the
+    merged contents of the older slots are cached.
+    """
+
+    def __init__(self, num_slots=8, k=64):
+        assert num_slots > 0, f"Invalid number of slots: {num_slots}"
+        self.num_slots = num_slots
+        self.k = k
+        # Entries of the form (slot start time us, sketch), in increasing order
+        # of time.
+        self.slots = collections.deque()
+        # The sorted values of all slots except the newest one, and their
+        # cumulative weights. None if they must be recomputed.
+        self.closed = None
+
+    def update(self, time_us, val, win_us):
+        """
+        Records a value observed at time time_us, which must not be earlier
+        than the time of any previous update, in a window of duration win_us.
+        Unknown values (-1) expire old slots, but are not recorded.
+        """
+        slot_us = win_us / self.num_slots
+        if not self.slots or time_us >= self.slots[-1][0] + slot_us:
+            self.slots.append((time_us, KllSketch(self.k)))
+            self.closed = None
+        if val != -1:
+            self.slots[-1][1].update(val)
+        # Remove slots that ended before the window started.
+        while self.slots and self.slots[0][0] + slot_us <= time_us - win_us:
+            self.slots.popleft()
+            self.closed = None
+
+    def quantile(self, qnt):
+        """
+        Returns an estimate of the qnt-th quantile (in the range [0, 1]) of the
+        values in the window, or -1 (unknown) if there are none.
+        """
+        if not self.slots:
+            return -1
+        if self.closed is None:
+            self.closed = cumulative(
+                [pair for idx, (_, sketch) in enumerate(self.slots)
+                 if idx < len(self.slots) - 1 for pair in sketch.weighted()])
+        vals_a, cum_a = self.closed
+        vals_b, cum_b = cumulative(self.slots[-1][1].weighted())
+        tot = (cum_a[-1] if cum_a else 0) + (cum_b[-1] if cum_b else 0)
+        if tot == 0:
+            return -1
+        target = qnt * tot
+        # The answer is the smallest value in either list whose rank in the
+        # union of both lists is at least target.
+        return min(
+            first_at_rank(vals_a, cum_a, vals_b, cum_b, target),
+            first_at_rank(vals_b, cum_b, vals_a, cum_a, target))
+
+
+def cumulative(weighted):
+    """
+    Sorts a list of (value, weight) pairs. Returns a tuple of the form:
+        (sorted values, cumulative weights)
+    """
+    weighted.sort()
+    vals = [val for val, _ in weighted]
+    cums = list(itertools.accumulate(weight for _, weight in weighted))
+    return vals, cums
+
+
+def first_at_rank(vals, cums, other_vals, other_cums, target):
+    """
+    Returns the smallest value in vals whose rank (total weight of the values
+    less than or equal to it) in the union of vals and other_vals is at least
+    target, or infinity if there is none. Both lists are as returned by
+    cumulative().
+    """
+    def rank(idx):
+        other_idx = bisect.bisect_right(other_vals, vals[idx])
+        return cums[idx] + (other_cums[other_idx - 1] if other_idx else 0)
+
+    low = 0
+    high = len(vals)
+    while low < high:
+        mid = (low + high) // 2
+        if rank(mid) >= target:
+            high = mid
+        else:
+            low = mid + 1
+    return vals[low] if low < len(vals) else math.inf
+
+
+class LogHistogram:
+    """
+    Counts the values observed during a sliding time window in log2-scale
+    buckets. Bucket 0 counts values of 0, bucket b > 0 counts values in the
+    range [2**(b - 1), 2**b), and the last bucket also counts all larger
+    values. Each update takes amortized constant time.
+    """
+
+    def __init__(self, num_bkts):
+        assert num_bkts > 0, f"Invalid number of buckets: {num_bkts}"
+        self.num_bkts = num_bkts
+        self.counts = [0] * num_bkts
+        # Entries of the form (time us, bucket), in increasing order of time.
+        self.deq = collections.deque()
+
+    def update(self, time_us, val, win_us):
+        """
+        Records a value observed at time time_us, which must not be earlier
+        than the time of any previous update, in a window of duration win_us.
+        Unknown values (-1) expire old values, but are not recorded. Returns
+        the bucket counts, which must not be modified.
+        """
+        if val >= 0:
+            bkt = min(int(val).bit_length(), self.num_bkts - 1)
+            self.counts[bkt] += 1
+            self.deq.append((time_us, bkt))
+        # Remove values that have left the window.
+        while self.deq and self.deq[0][0] <= time_us - win_us:
+            self.counts[self.deq.popleft()[1]] -= 1
+        return self.counts
+
+
+class SlidingDft:
+    """
+    Tracks selected frequency components of a signal that is binned in time,
+    using a sliding discrete Fourier transform (SDFT) over the most recent
+    num_bins bins. Each completed bin updates each tracked component in
+    constant time, so each update takes O(number of components) time. To bound
+    the accumulation of floating point error, the components are recomputed
+    from scratch once every num_bins bins.
+    """
+
+    # The number of octaves by which the requested bin duration must differ
+    # from the current one before the bin duration changes.
+    BIN_HYSTERESIS = 0.75
+
+    def __init__(self, num_bins, freqs):
+        """
+        num_bins: The number of bins in the DFT window.
+        freqs: The DFT indices of the components to track. Component k has a
+            period of num_bins / k bins.
+        """
+        assert num_bins > 0, f"Invalid number of bins: {num_bins}"
+        for freq in freqs:
+            assert 0 < freq < num_bins / 2, \
+                f"Invalid DFT index {freq} for a {num_bins}-bin window"
+        self.num_bins = num_bins
+        self.freqs = freqs
+        # Twiddle factors.
+        self.twiddles = [
+            complex(math.cos(2 * math.pi * freq / num_bins),
+                    math.sin(2 * math.pi * freq / num_bins))
+            for freq in freqs]
+        self.bin_us = None
+        self.reset(0)
+
+    def reset(self, time_us):
+        """ Clears the signal and starts a new bin at time time_us. """
+        self.ring = [0] * self.num_bins
+        # The index in ring of the oldest bin.
+        self.pos = 0
+        # The number of bins completed since the last reset.
+        self.filled = 0
+        self.coeffs = [0j] * len(self.freqs)
+        # The sum and sum of squares of the bins in the window.
+        self.sum = 0
+        self.sum_sq = 0
+        self.bin_start_us = time_us
+        self.bin_val = 0
+
+    def slide(self, val):
+        """ Appends a completed bin with value val to the window. """
+        old = self.ring[self.pos]
+        self.ring[self.pos] = val
+        self.pos = (self.pos + 1) % self.num_bins
+        self.filled += 1
+        self.sum += val - old
+        self.sum_sq += val * val - old * old
+        if self.filled % self.num_bins == 0:
+            self.recompute()
+            return
+        delta = val - old
+        self.coeffs = [
+            (coeff + delta) * twiddle
+            for coeff, twiddle in zip(self.coeffs, self.twiddles)]
+
+    def recompute(self):
+        """ Computes the tracked components directly from the window. """
+        bins = self.ring[self.pos:] + self.ring[:self.pos]
+        self.coeffs = [
+            sum(val * twiddle ** -idx for idx, val in enumerate(bins))
+            for twiddle in self.twiddles]
+        self.sum = sum(bins)
+        self.sum_sq = sum(val * val for val in bins)
+
+    def quantize(self, bin_us):
+        """
+        Returns the bin duration to use when the requested duration is bin_us.
+        Bin durations are powers of two microseconds. The current duration is
+        kept as long as it is within a factor of 2**BIN_HYSTERESIS of bin_us,
+        so small changes in bin_us (e.g., in the min RTT) do not clear the
+        signal.
+        """
+        exp = math.log2(max(bin_us, 1))
+        if (self.bin_us is not None and
+                abs(exp - math.log2(self.bin_us)) <= self.BIN_HYSTERESIS):
+            return self.bin_us
+        return 2 ** round(exp)
+
+    def update(self, time_us, val, bin_us):
+        """
+        Adds val to the bin containing time time_us, which must not be earlier
+        than the time of any previous update. bin_us is the requested duration
+        of each bin, which is quantized (see quantize()). If the quantized
+        duration changes, then the signal is cleared, since its old bins are no
+        longer comparable.
+        """
+        bin_us = self.quantize(bin_us)
+        if bin_us != self.bin_us:
+            self.bin_us = bin_us
+            self.reset(time_us)
+        elapsed = int((time_us - self.bin_start_us) // bin_us)
+        if elapsed > self.num_bins:
+            # The whole window is empty. Skip ahead.
+            self.reset(self.bin_start_us + elapsed * bin_us)
+            self.filled = self.num_bins
+        else:
+            for _ in range(elapsed):
+                self.slide(self.bin_val)
+                self.bin_val = 0
+            self.bin_start_us += elapsed * bin_us
+        self.bin_val += val
+
+    def powers(self):
+        """
+        Returns, for each tracked component, the fraction of the signal's
+        non-DC energy in the window that is at that component's frequency, in
+        the range [0, 1]. A signal that is a pure sinusoid at a tracked
+        frequency yields 1 for that component. Returns -1 (unknown) for all
+        components if the window is not yet full or the signal is constant.
+        """
+        # By Parseval's theorem, the energy of all components except DC is
+        # (num_bins * sum of squares) - |DC component|^2. Each component's
+        # energy is split evenly between its positive and negative frequency.
+        energy = self.num_bins * self.sum_sq - self.sum * self.sum
+        if (self.filled < self.num_bins or
+                energy <= 1e-9 * self.num_bins * self.sum_sq):
+            return [-1] * len(self.freqs)
+        return [
+            min(1, 2 * (coeff.real**2 + coeff.imag**2) / energy)
+            for coeff in self.coeffs]
+
+
+# The prime 2**61 - 1, used for hashing.
+MERSENNE_61 = 2**61 - 1
+
+
+class CountMinSketch:
+    """
+    A count-min sketch (Cormode and Muthukrishnan, "An Improved Data Stream
+    Summary: The Count-Min Sketch and its Applications", 2005) with
+    conservative updates. Estimates per-key sums of nonnegative values using
+    width * depth counters, regardless of the number of keys. Estimates never
+    underestimate the true sum.
+    """
+
+    def __init__(self, width, depth, seed=0):
+        assert width > 0 and depth > 0, \
+            f"Invalid sketch dimensions: {width} x {depth}"
+        self.width = width
+        # Each row uses a different hash function from the pairwise-independent
+        # family ((a * x + b) mod p) mod width, where p is a prime.
+        rng = random.Random(seed)
+        self.coeffs = [
+            (rng.randrange(1, MERSENNE_61), rng.randrange(MERSENNE_61))
+            for _ in range(depth)]
+        self.rows = [[0] * width for _ in range(depth)]
+
+    def idxs(self, key):
+        """
+        Returns the index of key's counter in each row. key must be hashable
+        reproducibly (e.g., a tuple of ints).
+        """
+        key = hash(key) % MERSENNE_61
+        return [
+            ((a * key + b) % MERSENNE_61) % self.width
+            for a, b in self.coeffs]
+
+    def add(self, key, val, idxs=None):
+        """
+        Adds val to key's sum and returns the new estimate. idxs is the
+        optional output of idxs(key), which sketches with the same width and
+        seed can share.
+        """
+        if idxs is None:
+            idxs = self.idxs(key)
+        # Conservative update: only increase the counters that are smaller than
+        # the new estimate.
+        new = min(row[idx] for row, idx in zip(self.rows, idxs)) + val
+        for row, idx in zip(self.rows, idxs):
+            if row[idx] < new:
+                row[idx] = new
+        return new
+
+    def estimate(self, key, idxs=None):
+        """ Returns an estimate of key's sum. """
+        if idxs is None:
+            idxs = self.idxs(key)
+        return min(row[idx] for row, idx in zip(self.rows, idxs))
+
+    def clear(self):
+        """ Resets all counters to 0. """
+        for row in self.rows:
+            row[:] = itertools.repeat(0, self.width)
+
+
+class FlowAdmission:
+    """
+    A front stage that decides which flows receive full per-flow feature state.
+    Tracks the bytes, packets, and coarse rate of every flow in count-min
+    sketches, and promotes a flow once its estimated bytes reach a threshold.
+    Since the sketches never underestimate, every flow that reaches the
+    threshold is promoted (unless max_flows flows are already promoted). Memory
+    is bounded by the sketch dimensions and max_flows, independent of the
+    number of flows.
+    """
+
+    def __init__(self, threshold_B, max_flows, epoch_us, width, depth,
+                 seed=0):
+        """
+        threshold_B: The number of bytes at which to promote a flow.
+        max_flows: The maximum number of promoted flows.
+        epoch_us: The duration over which to estimate each flow's rate.
+        width, depth: The dimensions of each count-min sketch.
+        """
+        assert max_flows > 0, f"Invalid max flows: {max_flows}"
+        assert epoch_us > 0, f"Invalid epoch duration: {epoch_us} us"
+        self.threshold_B = threshold_B
+        self.max_flows = max_flows
+        self.epoch_us = epoch_us
+        # All sketches use the same hash functions, so each packet's counter
+        # indices are computed once.
+        self.bytes = CountMinSketch(width, depth, seed)
+        self.pkts = CountMinSketch(width, depth, seed)
+        # The bytes received during the current and previous epochs.
+        self.epoch_bytes = [
+            CountMinSketch(width, depth, seed),
+            CountMinSketch(width, depth, seed)]
+        self.epoch_start_us = None
+        self.first_us = None
+        self.last_us = None
+        # Maps promoted flow to the time at which it was promoted.
+        self.promoted = {}
+        # The number of flows that reached the threshold while max_flows flows
+        # were promoted.
+        self.rejected = 0
+
+    def rotate(self, time_us):
+        """ Starts a new epoch if the current one has ended. """
+        if self.epoch_start_us is None:
+            self.epoch_start_us = time_us
+            self.first_us = time_us
+        elapsed = (time_us - self.epoch_start_us) // self.epoch_us
+        if elapsed == 0:
+            return
+        prev = self.epoch_bytes.pop()
+        prev.clear()
+        if elapsed > 1:
+            # The current epoch is more than one epoch ago, so discard it too.
+            self.epoch_bytes[0].clear()
+        self.epoch_bytes.insert(0, prev)
+        self.epoch_start_us += elapsed * self.epoch_us
+
+    def update(self, flow, time_us, size_B):
+        """
+        Records a packet of size size_B that belongs to flow and arrived at
+        time time_us, which must not be earlier than the time of any previous
+        update. Returns whether the flow is promoted. Packets of promoted flows
+        are not recorded in the sketches, since the full per-flow state tracks
+        them exactly.
+        """
+        self.last_us = time_us
+        self.rotate(time_us)
+        if flow in self.promoted:
+            return True
+        idxs = self.bytes.idxs(flow)
+        tot_B = self.bytes.add(flow, size_B, idxs)
+        self.pkts.add(flow, 1, idxs)
+        self.epoch_bytes[0].add(flow, size_B, idxs)
+        if tot_B < self.threshold_B:
+            return False
+        if len(self.promoted) >= self.max_flows:
+            self.rejected += 1
+            return False
+        self.promoted[flow] = time_us
+        return True
+
+    def demote(self, flow):
+        """
+        Releases a promoted flow's slot (e.g., when the flow ends). Its
+        sketched state is not reset, so it will be promoted again by its next
+        packet.
+        """
+        self.promoted.pop(flow, None)
+
+    def estimate(self, flow):
+        """
+        Returns estimates of a flow's state before it was promoted, as a tuple
+        of the form:
+            (bytes, packets, rate over the last one to two epochs in b/s)
+        The rate is -1 (unknown) if no time has elapsed.
+        """
+        idxs = self.bytes.idxs(flow)
+        # The epochs cover the time since the start of the previous epoch, or
+        # since the first packet if there is no previous epoch.
+        elapsed_us = (
+            0 if self.first_us is None else
+            self.last_us -
+            max(self.first_us, self.epoch_start_us - self.epoch_us))
+        return (
+            self.bytes.estimate(flow, idxs),
+            self.pkts.estimate(flow, idxs),
+            -1 if elapsed_us <= 0 else
+            8e6 * sum(sketch.estimate(flow, idxs)
+                      for sketch in self.epoch_bytes) / elapsed_us)
@@ -15,6 +15,7 @@ import numpy as np
 import torch
 
 import models
+import numa
 import train
 import utils
 
@@ -219,7 +220,7 @@ def main():
 
     print(f"Num files: {len(func_input)}")
     tim_srt_s = time.time()
-    with multiprocessing.Pool() as pol:
+    with multiprocessing.Pool(**numa.pool_kwargs()) as pol:
         pol.starmap(process_one, func_input)
 
     print(f"Done Processing - time: {time.time() - tim_srt_s:.2f} seconds")
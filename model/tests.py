@@ -37,22 +37,37 @@ class TestGeneral(unittest.TestCase):
 
         Implicitly tests that all modules are free of syntax errors.
         """
+        import bench_splits
+        import bench_streaming
+        import capture
         import check_mathis_accuracy
+        import check_sketch_accuracy
+        import check_storage_dtype
         import cl_args
         import correlation
         import defaults
+        import featurize
         import fet_hists
+        import frames
         import features
         import gen_features
         import gen_training_data
         import graph_one
         import hyper
+        import inference
         import models
+        import numa
+        import parse_utils
         import prepare_data
+        import rand
+        import rfe
         import sim
+        import staging
+        import streaming
         import test
         import train
         import training_param_sweep
+        import tsstore
         import utils
 
     def test_parsing(self):
@@ -161,6 +176,584 @@ class TestGeneral(unittest.TestCase):
         # Remove files
         shutil.rmtree(TEST_OUTPUT_DIR)
 
+    def test_windowed_min(self):
+        """
+        Tests streaming.WindowedMin against a brute-force minimum over the
+        values in each window.
+        """
+        import random
+        import streaming
+
+        rng = random.Random(0)
+        win_us = 1000
+        wmin = streaming.WindowedMin(win_us)
+        hist = []
+        time_us = 0
+        for _ in range(5000):
+            time_us += rng.randint(0, 100)
+            val = rng.choice([-1, rng.randint(0, 10_000)])
+            hist.append((time_us, val))
+            vals = [
+                v for t, v in hist if t > time_us - win_us and v != -1]
+            assert(wmin.update(time_us, val) == (min(vals) if vals else -1))
+
+    def test_seq_range_tracker(self):
+        """
+        Tests streaming.SeqRangeTracker against a brute-force set of the
+        transmitted sequence numbers, with mostly in-order transmissions and
+        some retransmissions and holes.
+        """
+        import random
+        import streaming
+
+        rng = random.Random(0)
+        trk = streaming.SeqRangeTracker()
+        sent = set()
+        nxt = 0
+        for _ in range(5000):
+            if rng.random() < 0.8:
+                seq = nxt + rng.choice([0, 0, 0, rng.randint(1, 50)])
+            else:
+                seq = rng.randint(0, nxt + 10)
+            length = rng.randint(0, 20)
+            rng_seqs = set(range(seq, seq + max(length, 1)))
+            assert(trk.add(seq, length) == bool(rng_seqs & sent))
+            sent |= rng_seqs
+            nxt = max(nxt, seq + max(length, 1))
+        # The ranges are sorted, disjoint, and cover exactly the sent data.
+        assert(all(
+            srt < end for srt, end in zip(trk.starts, trk.ends)))
+        assert(all(
+            end < srt for end, srt in zip(trk.ends, trk.starts[1:])))
+        assert(set().union(*(
+            range(srt, end) for srt, end in zip(trk.starts, trk.ends))) ==
+            sent)
+
+    def test_kll_sketch(self):
+        """
+        Tests that streaming.KllSketch's quantile estimates, for a single
+        sketch and for merged sketches, have a small rank error compared to
+        the exact quantiles.
+        """
+        import bisect
+        import random
+        import streaming
+
+        rng = random.Random(0)
+        vals = [rng.lognormvariate(0, 1) for _ in range(20_000)]
+        skt = streaming.KllSketch(k=64)
+        skt_a = streaming.KllSketch(k=64)
+        skt_b = streaming.KllSketch(k=64)
+        for idx, val in enumerate(vals):
+            skt.update(val)
+            (skt_a if idx % 2 else skt_b).update(val)
+        skt_a.merge(skt_b)
+        # Memory stays bounded.
+        assert(skt.size < 500)
+        assert(skt_a.size < 500)
+        vals.sort()
+        for qnt in [0.01, 0.1, 0.5, 0.9, 0.99]:
+            for est in [skt.quantile(qnt), skt_a.quantile(qnt)]:
+                rank = bisect.bisect_right(vals, est) / len(vals)
+                assert(abs(rank - qnt) < 0.03)
+        assert(streaming.KllSketch().quantile(0.5) == -1)
+
+    def test_sliding_quantiles(self):
+        """
+        Tests that streaming.SlidingQuantiles (which caches the merged
+        contents of its older slots) matches a from-scratch quantile over its
+        live slots, and that slots expire with the window.
+        """
+        import random
+        import streaming
+
+        rng = random.Random(0)
+        win_us = 10_000
+        sqs = streaming.SlidingQuantiles(num_slots=4, k=16)
+        time_us = 0
+        for _ in range(5000):
+            time_us += rng.randint(0, 200)
+            sqs.update(time_us, rng.choice([-1, rng.randint(0, 1000)]), win_us)
+            # Every live slot overlaps the window.
+            assert(all(
+                srt_us + win_us / 4 > time_us - win_us
+                for srt_us, _ in sqs.slots))
+            weighted = [
+                pair for _, sketch in sqs.slots for pair in sketch.weighted()]
+            for qnt in [0.1, 0.5, 0.9]:
+                assert(sqs.quantile(qnt) ==
+                       streaming.weighted_quantile(list(weighted), qnt))
+
+    def test_log_histogram(self):
+        """
+        Tests streaming.LogHistogram against a brute-force histogram of the
+        values in each window.
+        """
+        import random
+        import numpy as np
+        import streaming
+
+        rng = random.Random(0)
+        win_us = 1000
+        num_bkts = 8
+        lhist = streaming.LogHistogram(num_bkts)
+        # Bucket 0 holds 0, bucket b holds [2**(b - 1), 2**b), and the last
+        # bucket holds everything larger.
+        edges = [0, 1] + [2**bkt for bkt in range(1, num_bkts - 1)] + [np.inf]
+        hist = []
+        time_us = 0
+        for _ in range(5000):
+            time_us += rng.randint(0, 100)
+            val = rng.choice([-1, 0, rng.randint(1, 1000)])
+            hist.append((time_us, val))
+            vals = [v for t, v in hist if t > time_us - win_us and v != -1]
+            assert(lhist.update(time_us, val, win_us) ==
+                   np.histogram(vals, bins=edges)[0].tolist())
+
+    def test_sliding_dft(self):
+        """
+        Tests streaming.SlidingDft's spectral powers against an FFT of the
+        binned signal, and that small changes in the requested bin duration do
+        not clear the signal.
+        """
+        import random
+        import numpy as np
+        import streaming
+
+        rng = random.Random(0)
+        num_bins = 64
+        freqs = [2, 4, 8, 16]
+        dft = streaming.SlidingDft(num_bins, freqs)
+        bin_us = 1024
+        bins = []
+        time_us = 0
+        for _ in range(10 * num_bins):
+            # A mix of a sinusoid and noise, binned by hand. The first update
+            # starts the first bin.
+            bins.append(0)
+            offsets_us = sorted(
+                rng.randint(0, bin_us - 1) for _ in range(rng.randint(0, 4)))
+            if time_us == 0:
+                offsets_us = [0] + offsets_us
+            for offset_us in offsets_us:
+                val = 100 + 50 * np.sin(2 * np.pi * 8 * len(bins) / num_bins)
+                val += rng.random() * 20
+                dft.update(
+                    time_us + offset_us, val,
+                    # Jitter the requested bin duration.
+                    bin_us * rng.uniform(0.8, 1.25))
+                bins[-1] += val
+            time_us += bin_us
+            # Bins are completed by the first update after them.
+            if len(bins) <= num_bins or not offsets_us:
+                continue
+            # The last bin in bins is still open.
+            win = np.array(bins[-num_bins - 1:-1])
+            coeffs = np.fft.fft(win)[freqs]
+            energy = num_bins * (win**2).sum() - win.sum()**2
+            expected = np.minimum(1, 2 * np.abs(coeffs)**2 / energy)
+            assert(dft.bin_us == bin_us)
+            assert(np.allclose(dft.powers(), expected, rtol=1e-6, atol=1e-9))
+
+    def test_count_min_sketch(self):
+        """
+        Tests that streaming.CountMinSketch never underestimates the exact
+        per-key sums, that most estimates are exact when the sketch is much
+        wider than the number of keys, and that streaming.FlowAdmission
+        promotes every flow that reaches its threshold.
+        """
+        import collections
+        import random
+        import streaming
+
+        rng = random.Random(0)
+        cms = streaming.CountMinSketch(width=1024, depth=4, seed=1)
+        adm = streaming.FlowAdmission(
+            threshold_B=10_000, max_flows=1000, epoch_us=1000, width=1024,
+            depth=4, seed=1)
+        exact = collections.Counter()
+        for time_us in range(20_000):
+            # Heavy-tailed keys: a few keys receive most of the values.
+            key = (int(rng.paretovariate(1.0)) % 500, 6)
+            val = rng.randint(1, 1500)
+            exact[key] += val
+            assert(cms.add(key, val) >= exact[key])
+            adm.update(key, time_us, val)
+        ests = {key: cms.estimate(key) for key in exact}
+        assert(all(ests[key] >= exact[key] for key in exact))
+        assert(sum(ests[key] == exact[key] for key in exact) >=
+               0.9 * len(exact))
+        assert(all(
+            key in adm.promoted for key, tot in exact.items()
+            if tot >= 10_000))
+
+    def test_tsstore(self):
+        """
+        Tests that records appended to a tsstore.Store, including by a writer
+        that reopens an already-compacted segment, are returned by
+        tsstore.query(), with and without flow and column selection.
+        """
+        import tempfile
+        import numpy as np
+        import tsstore
+
+        rng = np.random.default_rng(0)
+        fets = [("a", "float64"), ("b", "int32")]
+        root_dir = tempfile.mkdtemp()
+        try:
+            recs = []
+            time_us = 0
+            # The second writer appends to the first writer's last segment.
+            for _ in range(2):
+                sto = tsstore.Store(
+                    root_dir, fets, segment_us=5000, retention_us=10**9,
+                    chunk_rows=30)
+                for _ in range(5):
+                    rec = np.zeros((50,), dtype=sto.dtype)
+                    rec[tsstore.TIME_COL] = time_us + np.sort(
+                        rng.integers(0, 1000, 50))
+                    rec[tsstore.FLOW_COLS[0]] = rng.integers(1, 4, 50)
+                    rec[tsstore.FLOW_COLS[1]] = 9
+                    rec["a"] = rng.random(50)
+                    rec["b"] = rng.integers(0, 100, 50)
+                    sto.append(rec)
+                    recs.append(rec)
+                    time_us += 1000
+                sto.close()
+                time_us -= 1000
+            exp = np.concatenate(recs)
+            order = [tsstore.TIME_COL, tsstore.FLOW_COLS[0], "a"]
+            got = tsstore.query(root_dir, 0, 10**9)
+            assert((np.sort(got, order=order) ==
+                    np.sort(exp, order=order)).all())
+            # Every segment is compacted.
+            for _, seg_dir in tsstore.get_seg_dirs(root_dir):
+                assert(not tsstore.get_chunk_flps(seg_dir))
+            got = tsstore.query(root_dir, 2000, 6000, flw=(2, 9), cols=["b"])
+            exp = exp[(exp[tsstore.TIME_COL] >= 2000) &
+                      (exp[tsstore.TIME_COL] < 6000) &
+                      (exp[tsstore.FLOW_COLS[0]] == 2)]
+            assert(got.dtype.names ==
+                   (tsstore.TIME_COL, *tsstore.FLOW_COLS, "b"))
+            assert((np.sort(got["b"]) == np.sort(exp["b"])).all())
+        finally:
+            shutil.rmtree(root_dir)
+
+    def test_tsstore_compaction_during_read(self):
+        """
+        Tests that tsstore.query() returns every record when a segment is
+        compacted after a read loads the segment's generation but before it
+        lists the segment's chunks.
+        """
+        import tempfile
+        import numpy as np
+        import tsstore
+
+        root_dir = tempfile.mkdtemp()
+        get_chunk_flps = tsstore.get_chunk_flps
+        try:
+            sto = tsstore.Store(
+                root_dir, [("a", "float64")], segment_us=10**6,
+                retention_us=10**9, chunk_rows=30)
+            rec = np.zeros((100,), dtype=sto.dtype)
+            rec[tsstore.TIME_COL] = np.arange(100)
+            rec[tsstore.FLOW_COLS[0]] = np.arange(100) % 3
+            rec["a"] = np.arange(100) / 2
+            sto.append(rec)
+            sto.flush()
+            seg_dir = tsstore.get_seg_dir(root_dir, 0)
+            compacted = []
+
+            def compact_then_list(seg_dir_):
+                # Compact once, in the middle of the first read.
+                if not compacted:
+                    compacted.append(True)
+                    tsstore.compact(seg_dir, sto.dtype)
+                return get_chunk_flps(seg_dir_)
+
+            tsstore.get_chunk_flps = compact_then_list
+            got = tsstore.query(root_dir, 0, 10**6)
+            assert(compacted)
+            assert((got == rec).all())
+        finally:
+            tsstore.get_chunk_flps = get_chunk_flps
+            sto.close()
+            shutil.rmtree(root_dir)
+
+    def test_rand(self):
+        """
+        Tests that rand.py's streams depend only on the seed, experiment, flow,
+        and stage, and not on the order in which they are used.
+        """
+        import hashlib
+        import rand
+
+        old_seed = rand.SEED
+        try:
+            rand.set_seed(7)
+            keys = [("shuffle", None, None), ("filt", "exp1", None),
+                    ("filt", "exp2", None), ("filt", "exp1", 3)]
+            # Draw from the streams in two different orders.
+            fwd = {key: rand.get(*key).integers(0, 2**32, 100) for key in keys}
+            rev = {
+                key: rand.get(*key).integers(0, 2**32, 100)
+                for key in reversed(keys)}
+            for key in keys:
+                assert((fwd[key] == rev[key]).all())
+            # Different keys yield different streams.
+            assert(len({fwd[key].tobytes() for key in keys}) == len(keys))
+            # The key is the documented digest, so that other implementations
+            # can reproduce it.
+            assert(rand.get_key("filt", "exp1", 3) == int.from_bytes(
+                hashlib.blake2b(b"7/exp1/3/filt", digest_size=16).digest(),
+                "little"))
+            # The seed changes every stream, and an explicit seed overrides
+            # the run-wide one.
+            rand.set_seed(8)
+            assert((rand.get("shuffle").integers(0, 2**32, 100) !=
+                    fwd[keys[0]]).any())
+            assert((rand.get("shuffle", seed=7).integers(0, 2**32, 100) ==
+                    fwd[keys[0]]).all())
+        finally:
+            rand.set_seed(old_seed)
+
+    def test_balanced_sampler(self):
+        """
+        Tests that utils.BalancedSampler's balanced subsets and batches depend
+        only on the seed and the split name, and not on the global random
+        state.
+        """
+        import numpy as np
+        import torch
+        import rand
+        import utils
+
+        dat_out = np.array([0] * 70 + [1] * 30 + [2] * 20)
+        dataset = utils.Dataset(
+            ["a"], np.arange(120, dtype="float32").reshape(120, 1), dat_out,
+            np.zeros((120,)))
+
+        def get_bchs(drop_popular, name):
+            smp = utils.BalancedSampler(
+                dataset, batch_size=6, drop_last=False,
+                drop_popular=drop_popular, name=name)
+            # Draw from the global random state, which must not matter.
+            torch.rand(10)
+            np.random.rand(10)
+            return [bch.tolist() for bch in smp.epoch()]
+
+        old_seed = rand.SEED
+        try:
+            rand.set_seed(7)
+            for drop_popular in [True, False]:
+                bchs = get_bchs(drop_popular, "train")
+                assert(bchs == get_bchs(drop_popular, "train"))
+                assert(bchs != get_bchs(drop_popular, "val"))
+                # Every batch has two examples from each class.
+                for bch in bchs:
+                    assert(sorted(dat_out[bch].tolist()) ==
+                           [0, 0, 1, 1, 2, 2])
+            rand.set_seed(8)
+            assert(bchs != get_bchs(False, "train"))
+        finally:
+            rand.set_seed(old_seed)
+
+    def test_storage_dtype(self):
+        """
+        Tests that a scaled training matrix stored in half precision yields
+        float32 batches that match the batches of the float32 training matrix,
+        within the precision of each storage type, both when slicing batches
+        and when balancing them.
+        """
+        import numpy as np
+        import torch
+        import data
+        import utils
+
+        num = 300
+        rng = np.random.default_rng(0)
+        # Raw features of very different magnitudes, which half precision
+        # cannot represent until they are scaled.
+        dat_in = np.empty(
+            (num,), dtype=[("tput", "float64"), ("rtt", "float64"),
+                           ("loss", "float64")])
+        dat_in["tput"] = rng.uniform(0, 1e9, num)
+        dat_in["rtt"] = rng.uniform(1e3, 1e6, num)
+        dat_in["loss"] = rng.uniform(0, 1e-2, num)
+        dat_in, _ = data.scale_fets(dat_in, list(range(3)))
+        fets = dat_in.dtype.names
+        dat_in = utils.clean(dat_in)
+        dat_out = np.array([0, 1, 2] * (num // 3))
+
+        def get_bchs(storage_dtype, balance):
+            dataset = utils.Dataset(
+                fets, dat_in, dat_out, np.zeros((num,)), storage_dtype)
+            ldr = (
+                utils.BatchLoader(
+                    dataset, batch_sampler=utils.BalancedSampler(
+                        dataset, batch_size=30, drop_last=False,
+                        drop_popular=True, name="train"))
+                if balance else utils.BatchLoader(dataset, batch_size=32))
+            return dataset, list(ldr)
+
+        for balance in [False, True]:
+            _, bchs_base = get_bchs("float32", balance)
+            for storage_dtype, tol in [("float16", 1e-3), ("bfloat16", 1e-2)]:
+                dataset, bchs = get_bchs(storage_dtype, balance)
+                # The training matrix uses half of the memory.
+                _, dat_in_stored, _, _ = dataset.raw(upcast=False)
+                assert(dat_in_stored.element_size() == 2)
+                assert(len(bchs) == len(bchs_base))
+                for (bch_in, bch_out), (base_in, base_out) in zip(
+                        bchs, bchs_base):
+                    assert(bch_in.dtype == torch.float)
+                    assert(torch.equal(bch_out, base_out))
+                    assert(torch.allclose(
+                        bch_in, base_in, rtol=tol, atol=1e-6))
+
+    def test_frames(self):
+        """
+        Tests that arrays written by frames.write() are read back by
+        frames.FrameReader with every kind of index, and decompress as a plain
+        zstd stream.
+        """
+        import tempfile
+        import numpy as np
+        import zstandard
+        import frames
+
+        dtype = np.dtype([("a", "float64"), ("b", "int32")])
+        dat = np.zeros((1005,), dtype=dtype)
+        dat["a"] = np.arange(1005) / 7
+        dat["b"] = np.arange(1005) % 13
+        tmp_dir = tempfile.mkdtemp()
+        try:
+            flp = path.join(tmp_dir, "dat.zst")
+            frames.write(flp, dat, frame_rows=100, parallel=2)
+            # The file is a valid zstd stream of the array's raw bytes.
+            with open(flp, "rb") as fil, \
+                    zstandard.ZstdDecompressor().stream_reader(
+                        fil, read_across_frames=True) as rdr:
+                raw = rdr.read()
+            assert(raw == dat.tobytes())
+
+            rdr = frames.FrameReader(flp, dtype, 1005, cache_frames=2)
+            assert(len(rdr) == 1005)
+            assert((rdr[:] == dat).all())
+            assert((rdr[95:305] == dat[95:305]).all())
+            assert((rdr[1000:] == dat[1000:]).all())
+            assert((rdr[10:900:37] == dat[10:900:37]).all())
+            assert(rdr[5:5].shape == (0,))
+            assert(rdr[42] == dat[42])
+            assert(rdr[-1] == dat[-1])
+            idxs = np.random.default_rng(0).integers(-1005, 1005, 500)
+            assert((rdr[idxs] == dat[idxs]).all())
+            assert(rdr[np.array([], dtype=int)].shape == (0,))
+            assert(rdr[[]].dtype == dtype)
+            out = np.empty((250,), dtype=dtype)
+            assert((rdr.read_into(out, 730, parallel=2) ==
+                    dat[730:980]).all())
+        finally:
+            shutil.rmtree(tmp_dir)
+
+    def test_staging(self):
+        """
+        Tests that staging.reserve() spills reservations beyond the budget of a
+        filesystem, which stages in different directories share, cleans up
+        released reservations, and reclaims those of dead processes.
+        """
+        import json
+        import tempfile
+        import defaults
+        import staging
+
+        old_staging_dir = defaults.STAGING_DIR
+        root_dir = tempfile.mkdtemp()
+        # Keep the ledger away from the real staging directory's.
+        defaults.STAGING_DIR = root_dir
+        try:
+            dir_a = path.join(root_dir, "a")
+            dir_b = path.join(root_dir, "b")
+            spill_dir = path.join(root_dir, "spill")
+            with staging.reserve(600, dir_a, spill_dir, 1000) as stage_a:
+                assert(path.dirname(stage_a) == dir_a)
+                # dir_b is on the same filesystem, so it shares the budget.
+                with staging.reserve(600, dir_b, spill_dir, 1000) as stage_b:
+                    assert(path.dirname(stage_b) == spill_dir)
+                    assert(staging.get_used_B(dir_b) == 600)
+                with staging.reserve(400, dir_b, spill_dir, 1000) as stage_b:
+                    assert(path.dirname(stage_b) == dir_b)
+                    assert(staging.get_used_B(dir_a) == 1000)
+                assert(not path.exists(stage_b))
+            assert(not path.exists(stage_a))
+            assert(staging.get_used_B(dir_a) == 0)
+
+            # A reservation left behind by a process that no longer exists.
+            proc = subprocess.Popen(["true"])
+            proc.wait()
+            dead_dir = path.join(dir_a, "dead")
+            os.makedirs(dead_dir)
+            with open(path.join(staging.get_ledger_dir(dir_a),
+                                "dead" + staging.ENTRY_SUFFIX), "w") as fil:
+                json.dump(
+                    {"pid": proc.pid, "size_B": 1000, "dir": dead_dir,
+                     "spilled": False},
+                    fil)
+            with staging.reserve(1000, dir_a, spill_dir, 1000) as stage_a:
+                assert(path.dirname(stage_a) == dir_a)
+            assert(not path.exists(dead_dir))
+        finally:
+            defaults.STAGING_DIR = old_staging_dir
+            shutil.rmtree(root_dir)
+
+    @unittest.skipUnless(
+        hasattr(os, "geteuid") and os.geteuid() == 0,
+        "Capturing packets requires root.")
+    def test_capture(self):
+        """
+        Tests that the TPACKET_V3 capture front-end receives UDP packets sent
+        over the loopback interface, using two workers in a fanout group.
+        """
+        import socket
+        import threading
+        import time
+        import capture
+
+        port = 50999
+        num_pkts = 100
+        lens = []
+
+        def handle(wkr_idx, pkts):
+            for pkt_dat, pkt_mdat in pkts:
+                # Select IPv4/UDP packets to the test port.
+                if (len(pkt_dat) >= 38 and
+                        bytes(pkt_dat[12:14]) == b"\x08\x00" and
+                        pkt_dat[23] == socket.IPPROTO_UDP and
+                        int.from_bytes(pkt_dat[36:38], "big") == port):
+                    lens.append((len(pkt_dat), pkt_mdat.wirelen))
+
+        stop = threading.Event()
+        thr = threading.Thread(
+            target=capture.capture, args=("lo", handle, 2, stop),
+            kwargs={"block_size": 1 << 16, "num_blocks": 4})
+        thr.start()
+        # Wait for the rings to be set up.
+        time.sleep(0.5)
+        with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as sock:
+            for idx in range(num_pkts):
+                sock.sendto(b"0" * (100 + idx), ("127.0.0.1", port))
+        time.sleep(0.5)
+        stop.set()
+        thr.join()
+
+        # The loopback interface delivers each packet to the capture twice
+        # (once outgoing and once incoming).
+        assert(len(lens) >= num_pkts)
+        # Ethernet (14 B) + IP (20 B) + UDP (8 B) headers.
+        assert({wirelen - 42 for _, wirelen in lens} ==
+               set(range(100, 100 + num_pkts)))
+        assert(all(caplen == wirelen for caplen, wirelen in lens))
+
 
 if __name__ == "__main__":
     unittest.main()
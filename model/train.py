@@ -6,6 +6,7 @@ https://blog.floydhub.com/long-short-term-memory-from-zero-to-hero-with-pytorch/
 """
 
 import argparse
+import concurrent.futures
 import copy
 import functools
 import math
@@ -81,6 +82,28 @@ def inference_torch(ins, labs, net_raw, dev,
     return los_fnc(out, labs), hidden
 
 
+def validate(net, net_raw, ldr_val, dev, los_fnc):
+    """
+    Runs a validation pass using net_raw, which is a snapshot of net's
+    underlying model, and returns the total validation loss. This runs on a
+    worker thread, so it must not modify net.
+    """
+    # Gradient mode is thread-local, so it must be disabled here.
+    with torch.no_grad():
+        los_val = 0
+        for ins_val, labs_val in ldr_val:
+            # Initialize the hidden state for every new sequence.
+            hidden = init_hidden(net, bch=ins_val.size()[0], dev=dev)
+            los_val += inference_torch(
+                ins_val, labs_val, net_raw, dev, hidden, los_fnc)[0].item()
+    return los_val
+
+
+def save_torch(net_raw, out_flp):
+    """ Converts a model to Torch Script and saves it. """
+    torch.jit.save(torch.jit.script(net_raw), out_flp)
+
+
 def train_torch(net, num_epochs, ldr_trn, ldr_val, dev, ely_stp, val_pat_max,
                 out_flp, val_imp_thresh, tim_out_s, opt_params):
     """ Trains a model. """
@@ -96,6 +119,15 @@ def train_torch(net, num_epochs, ldr_trn, ldr_val, dev, ely_stp, val_pat_max,
     # validation loss by at least val_imp_thresh percent. When this reaches
     # zero, training aborts.
     val_pat = val_pat_max
+    # The parameters of the best version of the model so far.
+    best_state = None
+    # Validation passes run on a worker thread using a snapshot of the model,
+    # while training continues. The result of a validation pass is applied as
+    # soon as it is ready (training checks after every batch). If it is still
+    # running when the next validation pass begins (or when training ends),
+    # then training waits for it, so at most one validation pass is in flight
+    # at a time. This is a tuple of the form (future, snapshot), or None.
+    pending = None
     # The number of batches per epoch.
     num_bchs_trn = len(ldr_trn)
     # Print a lot statement every few batches.
@@ -111,85 +143,100 @@ def train_torch(net, num_epochs, ldr_trn, ldr_val, dev, ely_stp, val_pat_max,
     if ely_stp:
         print(f"Will validate after every {bchs_per_val} batches.")
 
+    def apply_validation(exe):
+        """
+        Waits for the pending validation pass and applies its result. Returns
+        whether training should stop.
+        """
+        nonlocal los_val_min, val_pat, best_state, pending
+        fut, snap = pending
+        pending = None
+        los_val = fut.result()
+        if los_val_min is None:
+            los_val_min = los_val
+        # Calculate the percent improvement in the validation loss.
+        prc = (los_val_min - los_val) / los_val_min * 100
+        print(f"\tValidation error improvement: {prc:.2f}%")
+
+        # If the percent improvement in the validation loss is greater than a
+        # small threshold, then take this as the new best version of the model.
+        if prc > val_imp_thresh:
+            # This is the new best version of the model.
+            los_val_min = los_val
+            # Reset the validation patience.
+            val_pat = val_pat_max
+            best_state = snap.state_dict()
+            # Save the new best version of the model in the background.
+            exe.submit(save_torch, snap, out_flp)
+        else:
+            val_pat -= 1
+            if best_state is not None:
+                # Resume training from the best model. Load the parameters in
+                # place so that the optimizer keeps tracking them.
+                net.net.load_state_dict(best_state)
+        return val_pat <= 0
+
     tim_srt_s = time.time()
-    # Loop over the dataset multiple times...
-    for epoch_idx in range(num_epochs):
-        tim_del_s = time.time() - tim_srt_s
-        if tim_out_s != 0 and tim_del_s > tim_out_s:
-            print((f"Training timed out after after {epoch_idx} epochs "
-                   f"({tim_del_s:.2f} seconds)."))
-            break
-
-        # For each batch...
-        for bch_idx_trn, (ins, labs) in enumerate(ldr_trn, 0):
-            if bch_idx_trn % bchs_per_log == 0:
-                print(f"Epoch: {epoch_idx + 1:{f'0{len(str(num_epochs))}'}}/"
-                      f"{'?' if ely_stp else num_epochs}, batch: "
-                      f"{bch_idx_trn + 1:{f'0{len(str(num_bchs_trn))}'}}/"
-                      f"{num_bchs_trn}", end=" ")
-            # Initialize the hidden state for every new sequence.
-            hidden = init_hidden(net, bch=ins.size()[0], dev=dev)
-            # Zero out the parameter gradients.
-            opt.zero_grad()
-            loss, hidden = inference_torch(
-                ins, labs, net.net, dev, hidden, los_fnc)
-            # The backward pass.
-            loss.backward()
-            opt.step()
-            if bch_idx_trn % bchs_per_log == 0:
-                print(f"\tTraining loss: {loss:.5f}")
-
-            # Run on validation set, print statistics, and (maybe) checkpoint
-            # every VAL_PER batches.
-            if ely_stp and not bch_idx_trn % bchs_per_val:
-                print("\tValidation pass:")
-                # For efficiency, convert the model to evaluation mode.
-                net.net.eval()
-                with torch.no_grad():
-                    los_val = 0
-                    for bch_idx_val, (ins_val, labs_val) in enumerate(ldr_val):
-                        print(
-                            "\tValidation batch: "
-                            f"{bch_idx_val + 1}/{len(ldr_val)}")
-                        # Initialize the hidden state for every new sequence.
-                        hidden = init_hidden(net, bch=ins.size()[0], dev=dev)
-                        los_val += inference_torch(
-                            ins_val, labs_val, net.net, dev, hidden,
-                            los_fnc)[0].item()
-                # Convert the model back to training mode.
-                net.net.train()
-
-                if los_val_min is None:
-                    los_val_min = los_val
-                # Calculate the percent improvement in the validation loss.
-                prc = (los_val_min - los_val) / los_val_min * 100
-                print(f"\tValidation error improvement: {prc:.2f}%")
-
-                # If the percent improvement in the validation loss is greater
-                # than a small threshold, then take this as the new best version
-                # of the model.
-                if prc > val_imp_thresh:
-                    # This is the new best version of the model.
-                    los_val_min = los_val
-                    # Reset the validation patience.
-                    val_pat = val_pat_max
-                    # Save the new best version of the model. Convert the
-                    # model to Torch Script first.
-                    torch.jit.save(torch.jit.script(net.net), out_flp)
-                else:
-                    val_pat -= 1
-                    if path.exists(out_flp):
-                        # Resume training from the best model.
-                        net.net = torch.jit.load(out_flp)
-                        net.net.to(dev)
-                if val_pat <= 0:
+    # The worker pool must be shut down (i.e., all saves must complete) before
+    # returning.
+    with concurrent.futures.ThreadPoolExecutor(max_workers=1) as exe:
+        # Loop over the dataset multiple times...
+        for epoch_idx in range(num_epochs):
+            tim_del_s = time.time() - tim_srt_s
+            if tim_out_s != 0 and tim_del_s > tim_out_s:
+                print((f"Training timed out after after {epoch_idx} epochs "
+                       f"({tim_del_s:.2f} seconds)."))
+                break
+
+            # For each batch...
+            for bch_idx_trn, (ins, labs) in enumerate(ldr_trn, 0):
+                if bch_idx_trn % bchs_per_log == 0:
+                    print(
+                        f"Epoch: {epoch_idx + 1:{f'0{len(str(num_epochs))}'}}/"
+                        f"{'?' if ely_stp else num_epochs}, batch: "
+                        f"{bch_idx_trn + 1:{f'0{len(str(num_bchs_trn))}'}}/"
+                        f"{num_bchs_trn}", end=" ")
+                # Initialize the hidden state for every new sequence.
+                hidden = init_hidden(net, bch=ins.size()[0], dev=dev)
+                # Zero out the parameter gradients.
+                opt.zero_grad()
+                loss, hidden = inference_torch(
+                    ins, labs, net.net, dev, hidden, los_fnc)
+                # The backward pass.
+                loss.backward()
+                opt.step()
+                if bch_idx_trn % bchs_per_log == 0:
+                    print(f"\tTraining loss: {loss:.5f}")
+                # Apply a finished validation pass right away, so that
+                # training resumes from the best model as soon as possible.
+                if (pending is not None and pending[0].done() and
+                        apply_validation(exe)):
                     print(f"Stopped after {epoch_idx + 1} epochs")
                     return net
+
+                # Run on validation set, print statistics, and (maybe)
+                # checkpoint every VAL_PER batches.
+                if ely_stp and not bch_idx_trn % bchs_per_val:
+                    if pending is not None and apply_validation(exe):
+                        print(f"Stopped after {epoch_idx + 1} epochs")
+                        return net
+                    print("\tValidation pass:")
+                    # Validate a snapshot of the model, so that training can
+                    # continue to modify the model itself. For efficiency,
+                    # convert the snapshot to evaluation mode.
+                    snap = copy.deepcopy(net.net)
+                    snap.eval()
+                    pending = (
+                        exe.submit(validate, net, snap, ldr_val, dev, los_fnc),
+                        snap)
+        if pending is not None and apply_validation(exe):
+            print(f"Stopped after {epoch_idx + 1} epochs")
+            return net
     if not ely_stp:
         # Save the final version of the model. Convert the model to Torch Script
         # first.
         print(f"Saving final model: {out_flp}")
-        torch.jit.save(torch.jit.script(net.net), out_flp)
+        save_torch(net.net, out_flp)
     return net
 
 
@@ -252,7 +299,7 @@ def run_sklearn(args, out_dir, out_flp, ldrs):
         net.new(**{param: args[param] for param in net.params})
         # Extract the training data from the training dataloader.
         print("Extracting training data...")
-        dat_in, dat_out = list(ldr_trn)[0]
+        dat_in, dat_out = utils.get_matrix(ldr_trn)
         print("Training data:")
         utils.visualize_classes(net, dat_out)
 
@@ -0,0 +1,491 @@
+#! /usr/bin/env python3
+"""
+An append-only, time-partitioned store for per-flow time series (e.g., the
+online detector's per-packet features and fairness decisions), and a tool to
+query it.
+
+A store is a directory containing "meta.json", which describes the records'
+columns, and one directory per segment, which holds the records whose times
+fall in one fixed-duration time range. Writers append records to a segment as
+row-major chunk files ("chunk-*.npy"), numbered in order. Once a segment is
+sealed (i.e., a record from a later segment arrives, or the writer closes), a
+background thread compacts it: it merges the segment's newest generation (if
+any) with the chunks written since, sorts the records by flow and time, and
+writes them as a new generation directory ("generation-*"). A generation
+stores each column in its own file ("column-*.npy"), so that readers load only
+the columns that they need, and has an index ("index.json") of the rows
+belonging to each flow and of the chunks that it includes. A writer that
+restarts and appends to an already-compacted segment therefore adds chunks
+that the next compaction merges into a new generation. Segments older than the
+retention period are deleted.
+
+Every file is written to a temporary path and renamed into place, each
+generation is renamed into place only once it is complete, and chunks and old
+generations are deleted only after a newer generation includes them.
+Therefore, readers never see a partial file and never need to lock the store.
+A reader that finds that a segment's generation changed while it was reading
+the segment (so the chunks that it had yet to read may be gone) reads the
+segment again. Readers memory-map the files they need.
+"""
+
+import argparse
+import concurrent.futures
+import json
+import os
+from os import path
+import shutil
+
+import numpy as np
+from numpy.lib import recfunctions
+
+import defaults
+
+
+TIME_COL = "time us"
+FLOW_COLS = ("client port", "server port")
+META_FLN = "meta.json"
+INDEX_FLN = "index.json"
+CHUNK_PREFIX = "chunk-"
+COLUMN_PREFIX = "column-"
+GENERATION_PREFIX = "generation-"
+SEGMENT_PREFIX = "segment-"
+
+
+def get_seg_dir(root_dir, seg_start_us):
+    """ Returns the path to the segment that starts at seg_start_us. """
+    return path.join(root_dir, f"{SEGMENT_PREFIX}{seg_start_us:020d}")
+
+
+def get_seg_dirs(root_dir):
+    """
+    Returns a sorted list of the segments in a store, as tuples of the form:
+        (segment start time us, segment directory)
+    """
+    return sorted(
+        (int(name[len(SEGMENT_PREFIX):]), path.join(root_dir, name))
+        for name in os.listdir(root_dir) if name.startswith(SEGMENT_PREFIX))
+
+
+def get_chunk_flps(seg_dir):
+    """
+    Returns a sorted list of the chunk files in a segment, as tuples of the
+    form:
+        (chunk number, chunk filepath)
+    """
+    return sorted(
+        (int(name[len(CHUNK_PREFIX):-len(".npy")]), path.join(seg_dir, name))
+        for name in os.listdir(seg_dir)
+        if name.startswith(CHUNK_PREFIX) and name.endswith(".npy"))
+
+
+def get_generation(seg_dir):
+    """
+    Returns a segment's newest complete generation, as a tuple of the form:
+        (generation number, generation directory, index)
+    or (-1, None, None) if the segment has not been compacted.
+    """
+    gens = sorted(
+        int(name[len(GENERATION_PREFIX):]) for name in os.listdir(seg_dir)
+        if name.startswith(GENERATION_PREFIX) and not name.endswith(".tmp"))
+    if not gens:
+        return -1, None, None
+    gen_dir = path.join(seg_dir, f"{GENERATION_PREFIX}{gens[-1]:08d}")
+    with open(path.join(gen_dir, INDEX_FLN), "r") as fil:
+        return gens[-1], gen_dir, json.load(fil)
+
+
+def get_next_chunk(seg_dir):
+    """ Returns the number to give the next chunk written to a segment. """
+    _, _, index = get_generation(seg_dir)
+    return max(
+        [index["next chunk"] if index is not None else 0] +
+        [num + 1 for num, _ in get_chunk_flps(seg_dir)])
+
+
+def get_column_flp(gen_dir, col_idx):
+    """ Returns the path to the file of the col_idx-th column. """
+    return path.join(gen_dir, f"{COLUMN_PREFIX}{col_idx:03d}.npy")
+
+
+def load_columns(gen_dir, dtype, cols):
+    """
+    Memory-maps the provided columns of a generation. Returns a dictionary
+    mapping column name to array.
+    """
+    return {
+        col: np.load(
+            get_column_flp(gen_dir, dtype.names.index(col)), mmap_mode="r")
+        for col in cols}
+
+
+def gather(cols_dat, dtype, srt, end):
+    """
+    Returns rows [srt, end) of a generation's memory-mapped columns (the
+    output of load_columns()) as a structured array with the provided dtype.
+    """
+    dat = np.empty((end - srt,), dtype=dtype)
+    for col in dtype.names:
+        dat[col] = cols_dat[col][srt:end]
+    return dat
+
+
+def save_atomic(flp, save):
+    """
+    Calls save() with a temporary file object, then renames the temporary file
+    to flp.
+    """
+    tmp_flp = f"{flp}.tmp"
+    with open(tmp_flp, "wb") as fil:
+        save(fil)
+    os.rename(tmp_flp, flp)
+
+
+def load_meta(root_dir):
+    """
+    Returns a store's configuration, as a tuple of the form:
+        (dtype, segment duration us)
+    """
+    with open(path.join(root_dir, META_FLN), "r") as fil:
+        meta = json.load(fil)
+    return (
+        np.dtype([(name, typ) for name, typ in meta["dtype"]]),
+        meta["segment_us"])
+
+
+def compact(seg_dir, dtype):
+    """
+    Merges a sealed segment's newest generation and the chunks written since
+    into a new generation, sorted by flow and then time, with an index of the
+    segment's flows and time range. dtype is the store's dtype.
+    """
+    # Remove generations left behind by a compaction that crashed.
+    for name in os.listdir(seg_dir):
+        if name.startswith(GENERATION_PREFIX) and name.endswith(".tmp"):
+            shutil.rmtree(path.join(seg_dir, name), ignore_errors=True)
+    gen, gen_dir, index = get_generation(seg_dir)
+    next_chunk = index["next chunk"] if index is not None else 0
+    chunk_flps = get_chunk_flps(seg_dir)
+    # Chunks that the newest generation includes, but that were not deleted
+    # because the compaction that created it crashed.
+    stale_flps = [flp for num, flp in chunk_flps if num < next_chunk]
+    chunk_flps = [(num, flp) for num, flp in chunk_flps if num >= next_chunk]
+    if chunk_flps:
+        parts = [np.load(flp) for _, flp in chunk_flps]
+        if gen_dir is not None:
+            num_rows = index["flows"][-1][3] if index["flows"] else 0
+            parts.insert(0, gather(
+                load_columns(gen_dir, dtype, dtype.names), dtype, 0,
+                num_rows))
+        dat = np.concatenate(parts)
+        # np.lexsort() sorts by the last key first. Use a stable sort so that
+        # records with equal times stay in order of arrival.
+        dat = dat[np.lexsort(
+            (dat[TIME_COL], dat[FLOW_COLS[1]], dat[FLOW_COLS[0]]))]
+
+        # Find the boundaries between flows.
+        flws = np.stack([dat[col] for col in FLOW_COLS], axis=1)
+        starts = np.flatnonzero(
+            np.concatenate(([True], (flws[1:] != flws[:-1]).any(axis=1))))
+        ends = np.append(starts[1:], dat.shape[0])
+        new_index = {
+            "min time us": int(dat[TIME_COL].min()),
+            "max time us": int(dat[TIME_COL].max()),
+            # Each entry is:
+            #     [client port, server port, first row, last row + 1]
+            "flows": [
+                [int(flws[start][0]), int(flws[start][1]), int(start),
+                 int(end)]
+                for start, end in zip(starts, ends)],
+            # Chunks with lower numbers are included in this generation.
+            "next chunk": chunk_flps[-1][0] + 1}
+        new_gen_dir = path.join(seg_dir, f"{GENERATION_PREFIX}{gen + 1:08d}")
+        tmp_dir = f"{new_gen_dir}.tmp"
+        os.mkdir(tmp_dir)
+        for col_idx, col in enumerate(dtype.names):
+            np.save(get_column_flp(tmp_dir, col_idx), dat[col])
+        with open(path.join(tmp_dir, INDEX_FLN), "w") as fil:
+            json.dump(new_index, fil)
+        # The new generation becomes visible to readers all at once.
+        os.rename(tmp_dir, new_gen_dir)
+    # The new generation is in place, so the chunks that it includes and the
+    # old generation are no longer needed.
+    for flp in stale_flps + [flp for _, flp in chunk_flps]:
+        os.remove(flp)
+    if chunk_flps and gen_dir is not None:
+        shutil.rmtree(gen_dir, ignore_errors=True)
+
+
+class Store:
+    """ Appends records to a store. See the module description. """
+
+    def __init__(self, root_dir, fets, segment_us=defaults.TSSTORE_SEGMENT_US,
+                 retention_us=defaults.TSSTORE_RETENTION_US,
+                 chunk_rows=defaults.TSSTORE_CHUNK_ROWS):
+        """
+        root_dir: The store's directory. If it already contains a store, then
+            the new records are appended to it.
+        fets: The columns of each record besides the time and flow, as a list
+            of (name, dtype string) tuples.
+        segment_us: The duration of each segment.
+        retention_us: Segments that ended this long before the newest record
+            are deleted.
+        chunk_rows: The number of records to buffer before writing a chunk.
+        """
+        assert segment_us > 0, f"Invalid segment duration: {segment_us} us"
+        assert retention_us >= segment_us, \
+            (f"Retention ({retention_us} us) must be at least one segment "
+             f"({segment_us} us)!")
+        self.root_dir = root_dir
+        self.dtype = np.dtype(
+            [(TIME_COL, "int64")] +
+            [(col, "int32") for col in FLOW_COLS] + list(fets))
+        meta_flp = path.join(root_dir, META_FLN)
+        if path.exists(meta_flp):
+            dtype, old_segment_us = load_meta(root_dir)
+            assert dtype == self.dtype and old_segment_us == segment_us, \
+                f"Existing store has a different configuration: {root_dir}"
+        else:
+            if not path.exists(root_dir):
+                os.makedirs(root_dir)
+            save_atomic(
+                meta_flp,
+                lambda fil: fil.write(json.dumps({
+                    "dtype": [[name, self.dtype[name].str]
+                              for name in self.dtype.names],
+                    "segment_us": segment_us}).encode()))
+        self.segment_us = segment_us
+        self.retention_us = retention_us
+        self.chunk_rows = chunk_rows
+        # Buffered records of the current segment.
+        self.buf = []
+        self.buf_rows = 0
+        # The start time of the current segment, and the number to give the
+        # next chunk written to it.
+        self.seg_start_us = None
+        self.num_chunks = 0
+        self.last_time_us = None
+        # Compacts sealed segments and enforces the retention policy.
+        self.exe = concurrent.futures.ThreadPoolExecutor(max_workers=1)
+        self.pending = []
+
+    def append(self, recs):
+        """
+        Appends records, which must be a structured array with this store's
+        dtype. Their times must be in nondecreasing order and must not be
+        earlier than those of previously appended records.
+        """
+        if recs.shape[0] == 0:
+            return
+        times_us = recs[TIME_COL]
+        assert (np.diff(times_us) >= 0).all() and (
+            self.last_time_us is None or times_us[0] >= self.last_time_us), \
+            "Records must be appended in order of time!"
+        self.last_time_us = int(times_us[-1])
+        segs_us = times_us // self.segment_us * self.segment_us
+        # Split the records into runs that belong to the same segment.
+        bounds = np.flatnonzero(np.diff(segs_us)) + 1
+        for run in np.split(recs, bounds):
+            seg_start_us = int(run[TIME_COL][0]) // self.segment_us * \
+                self.segment_us
+            if seg_start_us != self.seg_start_us:
+                self.seal()
+                self.seg_start_us = seg_start_us
+                seg_dir = get_seg_dir(self.root_dir, seg_start_us)
+                if not path.exists(seg_dir):
+                    os.mkdir(seg_dir)
+                self.num_chunks = get_next_chunk(seg_dir)
+            self.buf.append(run)
+            self.buf_rows += run.shape[0]
+            if self.buf_rows >= self.chunk_rows:
+                self.flush()
+
+    def flush(self):
+        """ Writes the buffered records to a new chunk. """
+        if self.buf_rows == 0:
+            return
+        dat = np.concatenate(self.buf)
+        save_atomic(
+            path.join(
+                get_seg_dir(self.root_dir, self.seg_start_us),
+                f"{CHUNK_PREFIX}{self.num_chunks:08d}.npy"),
+            lambda fil: np.save(fil, dat))
+        self.num_chunks += 1
+        self.buf = []
+        self.buf_rows = 0
+
+    def seal(self):
+        """
+        Flushes the current segment and compacts it in the background. Also
+        deletes expired segments.
+        """
+        if self.seg_start_us is None:
+            return
+        self.flush()
+        # Drop references to finished background tasks, raising their errors.
+        for fut in [fut for fut in self.pending if fut.done()]:
+            fut.result()
+            self.pending.remove(fut)
+        self.pending.append(self.exe.submit(
+            self.compact_and_expire,
+            get_seg_dir(self.root_dir, self.seg_start_us), self.last_time_us))
+
+    def compact_and_expire(self, seg_dir, now_us):
+        """ Compacts a sealed segment and deletes expired segments. """
+        compact(seg_dir, self.dtype)
+        for seg_start_us, old_seg_dir in get_seg_dirs(self.root_dir):
+            if seg_start_us + self.segment_us <= now_us - self.retention_us:
+                shutil.rmtree(old_seg_dir, ignore_errors=True)
+
+    def close(self):
+        """
+        Seals the current segment and waits for background work to finish.
+        """
+        self.seal()
+        self.seg_start_us = None
+        self.exe.shutdown(wait=True)
+        for fut in self.pending:
+            fut.result()
+        self.pending = []
+
+
+def get_cols(dtype, cols):
+    """
+    Returns the dtype of the provided columns, plus the time and flow columns,
+    or of all columns if cols is None.
+    """
+    if cols is None:
+        return dtype
+    cols = [TIME_COL, *FLOW_COLS] + [
+        col for col in cols if col not in (TIME_COL, *FLOW_COLS)]
+    for col in cols:
+        assert col in dtype.names, f"Unknown column: {col}"
+    return np.dtype([(col, dtype[col]) for col in cols])
+
+
+def read_segment(seg_dir, dtype, start_us, end_us, flw=None, cols=None):
+    """
+    Returns the records in a segment with times in [start_us, end_us) and, if
+    flw is not None, that belong to flw (a tuple of the form
+    (client port, server port)), as a list of runs that are each sorted by
+    time. dtype is the store's dtype. If cols is not None, then reads only
+    those columns (plus the time and flow columns). Returns None if the
+    segment was deleted.
+    """
+    out_dtype = get_cols(dtype, cols)
+    # Retry if the segment is compacted while we are reading it.
+    while True:
+        try:
+            runs = []
+            gen, gen_dir, index = get_generation(seg_dir)
+            next_chunk = 0
+            if index is not None:
+                next_chunk = index["next chunk"]
+                if (index["max time us"] >= start_us and
+                        index["min time us"] < end_us):
+                    cols_dat = load_columns(gen_dir, dtype, out_dtype.names)
+                    # Within a flow, records are sorted by time.
+                    for client, server, srt, end in index["flows"]:
+                        if flw is not None and (client, server) != tuple(flw):
+                            continue
+                        times_us = cols_dat[TIME_COL][srt:end]
+                        runs.append(gather(
+                            cols_dat, out_dtype,
+                            srt + np.searchsorted(times_us, start_us),
+                            srt + np.searchsorted(times_us, end_us)))
+            for num, flp in get_chunk_flps(seg_dir):
+                if num < next_chunk:
+                    # This chunk is already in the generation.
+                    continue
+                dat = np.load(flp, mmap_mode="r")
+                # Chunks are sorted by time.
+                dat = dat[np.searchsorted(dat[TIME_COL], start_us):
+                          np.searchsorted(dat[TIME_COL], end_us)]
+                if flw is not None:
+                    dat = dat[(dat[FLOW_COLS[0]] == flw[0]) &
+                              (dat[FLOW_COLS[1]] == flw[1])]
+                runs.append(recfunctions.repack_fields(
+                    dat[list(out_dtype.names)]))
+            # If a compaction replaced the generation after we read it, then
+            # it may have deleted chunks that we had not read yet.
+            if get_generation(seg_dir)[0] == gen:
+                return runs
+        except FileNotFoundError:
+            if not path.exists(seg_dir):
+                # The segment expired.
+                return None
+
+
+def query(root_dir, start_us, end_us, flw=None, cols=None):
+    """
+    Returns the records in a store with times in [start_us, end_us) and, if
+    flw is not None, that belong to flw (a tuple of the form
+    (client port, server port)), sorted by time. If cols is not None, then
+    returns only those columns (plus the time and flow columns). Does not
+    block writers. Records that are still buffered by a writer are not
+    visible.
+    """
+    dtype, segment_us = load_meta(root_dir)
+    runs = []
+    for seg_start_us, seg_dir in get_seg_dirs(root_dir):
+        if seg_start_us + segment_us <= start_us or seg_start_us >= end_us:
+            continue
+        seg_runs = read_segment(seg_dir, dtype, start_us, end_us, flw, cols)
+        if seg_runs is not None:
+            runs.extend(seg_runs)
+    if not runs:
+        return np.empty((0,), dtype=get_cols(dtype, cols))
+    dat = np.concatenate(runs)
+    return dat[np.argsort(dat[TIME_COL], kind="stable")]
+
+
+def main():
+    """ This program's entrypoint. """
+    psr = argparse.ArgumentParser(
+        description="Queries a per-flow time series store.")
+    psr.add_argument(
+        "--store", help="The store's directory.", required=True, type=str)
+    psr.add_argument(
+        "--flow", help="The flow to select, as \"client port:server port\".",
+        required=False, type=str)
+    psr.add_argument(
+        "--last-s", default=60,
+        help="Select records from this many seconds before the newest one.",
+        required=False, type=float)
+    args = psr.parse_args()
+    root_dir = args.store
+    assert path.exists(path.join(root_dir, META_FLN)), \
+        f"Not a store: {root_dir}"
+    flw = None
+    if args.flow is not None:
+        flw = tuple(int(port) for port in args.flow.split(":"))
+        assert len(flw) == 2, f"Invalid flow: {args.flow}"
+
+    # Find the newest record time by reading only the newest segment's time
+    # and flow columns.
+    dtype, _ = load_meta(root_dir)
+    seg_dirs = get_seg_dirs(root_dir)
+    newest_us = None
+    for seg_start_us, seg_dir in reversed(seg_dirs):
+        seg_runs = read_segment(
+            seg_dir, dtype, seg_start_us, np.iinfo("int64").max, cols=[])
+        if seg_runs and any(run.shape[0] for run in seg_runs):
+            newest_us = max(
+                int(run[TIME_COL].max()) for run in seg_runs if run.shape[0])
+            break
+    if newest_us is None:
+        print(f"No records in: {root_dir}")
+        return
+    dat = query(
+        root_dir, newest_us - args.last_s * 1e6, newest_us + 1, flw, cols=[])
+    print(
+        f"{dat.shape[0]} records in the last {args.last_s} seconds "
+        f"(segments: {len(seg_dirs)})")
+    flws, cnts = np.unique(
+        np.stack([dat[col] for col in FLOW_COLS], axis=1), axis=0,
+        return_counts=True)
+    for (client, server), cnt in zip(flws, cnts):
+        print(f"\tFlow {client}:{server}: {cnt} records")
+
+
+if __name__ == "__main__":
+    main()
@@ -3,21 +3,16 @@
 import collections
 import json
 import math
+import mmap
 import os
 from os import path
 import pickle
 import random
-import struct
-import sys
 import time
 import zipfile
 
 from matplotlib import pyplot as plt
 import numpy as np
-import scapy
-import scapy.layers.l2
-import scapy.layers.inet
-import scapy.utils
 from scipy import stats
 from scipy import cluster
 from sklearn import ensemble
@@ -27,16 +22,23 @@ import torch
 
 import defaults
 import features
+import frames
+import parse_utils
+import rand
+import rfe
 
 
-# Values considered unsafe for division and min().
-UNSAFE = {-1, 0}
+# The types in which a Dataset can store its input features.
+STORAGE_DTYPES = {
+    "float32": torch.float, "float16": torch.float16,
+    "bfloat16": torch.bfloat16}
 
 
 class Dataset(torch.utils.data.Dataset):
     """ A simple Dataset that wraps arrays of input and output features. """
 
-    def __init__(self, fets, dat_in, dat_out, dat_extra):
+    def __init__(self, fets, dat_in, dat_out, dat_extra,
+                 storage_dtype="float32"):
         """
         fets: List of input feature names, corresponding to the columns of
             dat_in.
@@ -44,6 +46,10 @@ class Dataset(torch.utils.data.Dataset):
         dat_out: Numpy array of output data. Assumed to have a single practical
             dimension only (e.g., dat_out should be of shape (X,), or (X, 1)).
         dat_extra: Numpy array of extra data.
+        storage_dtype: The type in which to store dat_in (a key of
+            STORAGE_DTYPES). Half-precision types halve the memory used by
+            dat_in, but are only suitable for scaled inputs. dat_in is
+            converted to float32 when it is read.
         """
         super(Dataset).__init__()
         shp_in = dat_in.shape
@@ -55,8 +61,14 @@ class Dataset(torch.utils.data.Dataset):
             f"Mismatched dat_in ({shp_in}) and fets (len: {num_fets})"
 
         self.fets = fets
+        assert storage_dtype in STORAGE_DTYPES, \
+            f"Unknown storage dtype: {storage_dtype}"
         # Convert the numpy arrays to Torch tensors.
-        self.dat_in = torch.tensor(dat_in, dtype=torch.float)
+        self.dat_in = torch.tensor(dat_in, dtype=STORAGE_DTYPES[storage_dtype])
+        if storage_dtype != "float32":
+            assert torch.isfinite(self.dat_in).all(), \
+                (f"Input features overflow {storage_dtype}. Are they "
+                 "scaled?")
         # Reshape the output into a 1D array first, because
         # CrossEntropyLoss expects a single value. The dtype must be
         # long because the loss functions expect longs.
@@ -87,11 +99,74 @@ class Dataset(torch.utils.data.Dataset):
         """ Returns a specific (input, output) pair from this Dataset. """
         assert torch.utils.data.get_worker_info() is None, \
             "This Dataset does not support being loaded by multiple workers!"
-        return self.dat_in[idx], self.dat_out[idx]
+        return self.dat_in[idx].float(), self.dat_out[idx]
 
-    def raw(self):
-        """ Returns the raw data underlying this dataset. """
-        return self.fets, self.dat_in, self.dat_out, self.dat_extra
+    def raw(self, upcast=True):
+        """
+        Returns the raw data underlying this dataset. If upcast is False, then
+        dat_in is returned in its storage type, and the caller is responsible
+        for converting it to float32 (e.g., one batch at a time). Upcasting a
+        float32 dat_in does not copy it.
+        """
+        return (
+            self.fets, self.dat_in.float() if upcast else self.dat_in,
+            self.dat_out, self.dat_extra)
+
+
+def balance_idxs(dat_out, clss, drop_popular, rng):
+    """
+    Returns a dictionary mapping each class in clss to a tensor of the indices
+    of that class's examples in dat_out, where every class has the same number
+    of examples. If drop_popular is True, then examples are removed from the
+    popular classes. Otherwise, examples from the unpopular classes are
+    duplicated. The examples to remove or duplicate are drawn from rng (a
+    numpy Generator).
+    """
+    print("Balancing classes...")
+    # Find the indices for each class. Visit the classes in sorted order so
+    # that they draw from rng in the same order every time.
+    clss_idxs = {cls: torch.where(dat_out == cls)[0] for cls in sorted(clss)}
+
+    if drop_popular:
+        # Determine the number of examples in the least populous class.
+        target_examples = min(
+            cls_idxs.size()[0] for cls_idxs in clss_idxs.values())
+        # Remove samples from the popular classes.
+        for cls, cls_idxs in clss_idxs.items():
+            num_examples = cls_idxs.size()[0]
+            # If this class has too many examples...
+            if num_examples > target_examples:
+                # Select a subset of the samples, uniformly. Do not sample
+                # with replacement because num_examples is guaranteed to be
+                # greater than target_examples.
+                clss_idxs[cls] = cls_idxs[torch.from_numpy(rng.choice(
+                    num_examples, size=target_examples, replace=False))]
+                print(
+                    f"\tRemoved {num_examples - target_examples} examples "
+                    f"from class {cls}.")
+
+    else:
+        # Determine the number of examples in the most populous class.
+        target_examples = max(
+            cls_idxs.size()[0] for cls_idxs in clss_idxs.values())
+        # Generate new samples to fill in under-represented classes.
+        for cls, cls_idxs in clss_idxs.items():
+            num_examples = cls_idxs.size()[0]
+            # If this class has insufficient examples...
+            if num_examples < target_examples:
+                new_examples = target_examples - num_examples
+                # Duplicate existing examples to make this class balanced.
+                # Append the duplicated examples to the true examples.
+                clss_idxs[cls] = torch.cat(
+                    (cls_idxs,
+                     # Sample from the existing examples uniformly, with
+                     # replacement in case the number of new examples is
+                     # greater than the number of existing examples.
+                     cls_idxs[torch.from_numpy(rng.choice(
+                         num_examples, size=new_examples, replace=True))]),
+                    dim=0)
+                print(f"\tAdded {new_examples} examples to class {cls}.")
+    return clss_idxs
 
 
 class BalancedSampler:
@@ -99,14 +174,15 @@ class BalancedSampler:
     A batching sampler that creates balanced batches. The batch size
     must be evenly divided by the number of classes. This does not
     inherit from any of the existing Torch Samplers because it does
-    not require any of their functionalty. Instead, this is a wrapper
-    for many other Samplers, one for each class.
+    not require any of their functionalty. Randomness comes from this
+    sampler's own counter-based stream (see rand.py), which is keyed by the
+    name of the split that it samples (e.g., "train").
     """
 
-    def __init__(self, dataset, batch_size, drop_last, drop_popular):
+    def __init__(self, dataset, batch_size, drop_last, drop_popular, name):
         assert isinstance(dataset, Dataset), \
             "Dataset must be an instance of utils.Dataset."
-        _, _, dat_out, _ = dataset.raw()
+        _, _, dat_out, _ = dataset.raw(upcast=False)
         assert_tensor(dat_out=dat_out)
 
         # Determine the unique classes.
@@ -138,134 +214,140 @@ class BalancedSampler:
             (f"The number of classes ({num_clss}) must evenly divide the batch "
              f"size ({batch_size})!")
 
-        print("Balancing classes...")
-        # Find the indices for each class.
-        clss_idxs = {cls: torch.where(dat_out == cls)[0] for cls in clss}
-
-        if drop_popular:
-            # Determine the number of examples in the least populous class.
-            target_examples = min(
-                cls_idxs.size()[0] for cls_idxs in clss_idxs.values())
-            # Remove samples from the popular classes.
-            for cls, cls_idxs in clss_idxs.items():
-                num_examples = cls_idxs.size()[0]
-                # If this class has too many examples...
-                if num_examples > target_examples:
-                    # Select a subset of the samples.
-                    clss_idxs[cls] = cls_idxs[torch.multinomial(
-                        # Sample from the existing examples using a uniform
-                        # distribution.
-                        torch.ones((num_examples,)),
-                        num_samples=target_examples,
-                        # Do not sample with replacement because num_samples is
-                        # guaranteed to be greater than or equal to
-                        # target_samples.
-                        replacement=False)]
-                    print(
-                        f"\tRemoved {num_examples - target_examples} examples "
-                        f"from class {cls}.")
+        # Draw from this sampler's own random stream so that its balanced
+        # subsets and batches do not depend on other users of the global
+        # random state.
+        self.rng = rand.get(f"balance-{name}")
+        # All classes now have the same number of examples.
+        clss_idxs = balance_idxs(dat_out, clss, drop_popular, self.rng)
+        self.clss_idxs = clss_idxs
+        target_examples = next(iter(clss_idxs.values())).size()[0]
 
-        else:
-            # Determine the number of examples in the most populous class.
-            target_examples = max(
-                cls_idxs.size()[0] for cls_idxs in clss_idxs.values())
-            # Generate new samples to fill in under-represented classes.
-            for cls, cls_idxs in clss_idxs.items():
-                num_examples = cls_idxs.size()[0]
-                # If this class has insufficient examples...
-                if num_examples < target_examples:
-                    new_examples = target_examples - num_examples
-                    # Duplicate existing examples to make this class balanced.
-                    # Append the duplicated examples to the true examples.
-                    clss_idxs[cls] = torch.cat(
-                        (cls_idxs,
-                         cls_idxs[torch.multinomial(
-                             # Sample from the existing examples using a uniform
-                             # distribution.
-                             torch.ones((num_examples,)),
-                             num_samples=new_examples,
-                             # Sample with replacement in case the number of new
-                             # examples is greater than the number of existing
-                             # examples.
-                             replacement=True)]),
-                        dim=0)
-                    print(f"\tAdded {new_examples} examples to class {cls}.")
-
-        # Create a BatchSampler iterator for each class.
         examples_per_cls = batch_size // num_clss
-        self.samplers = {
-            cls: torch.utils.data.BatchSampler(
-                torch.utils.data.SubsetRandomSampler(cls_idxs),
-                examples_per_cls, drop_last)
-            for cls, cls_idxs in clss_idxs.items()}
-        # After __iter__() is called, this will contain an iterator for each
-        # class.
-        self.iters = {}
+        self.examples_per_cls = examples_per_cls
+        self.drop_last = drop_last
+        # After __iter__() is called, this will contain an iterator over the
+        # batches of one epoch.
+        self.iter = None
         self.num_batches = target_examples // examples_per_cls
 
     def __iter__(self):
-        # Create an iterator for each class.
-        self.iters = {
-            cls: iter(sampler) for cls, sampler in self.samplers.items()}
+        self.iter = iter(self.epoch())
         return self
 
     def __len__(self):
         return self.num_batches
 
     def __next__(self):
-        # Pull examples from each class and merge them into a single list.
-        idxs = [idx for it in self.iters.values() for idx in next(it)]
-        random.shuffle(idxs)
-        return idxs
-
-
-class Exp():
-    """ Describes the parameters of a simulation. """
-
-    def __init__(self, sim):
-        if "/" in sim:
-            sim = path.basename(sim)
-        self.name = sim
-        toks = sim.split("-")
-        if sim.endswith(".tar.gz"):
-            # unfair-pcc-cubic-8bw-30rtt-64q-1pcc-1cubic-100s-20201118T114242.tar.gz
-            # Remove ".tar.gz" from the last token.
-            toks[-1] = toks[-1][:-7]
-            # Update sim.name.
-            self.name = self.name[:-7]
-        elif sim.endswith(".npz"):
-            # Remove ".npz" from the last token.
-            toks[-1] = toks[-1][:-4]
-            # Update sim.name.
-            self.name = self.name[:-4]
-        # unfair-pcc-cubic-8bw-30rtt-64q-1pcc-1cubic-100s-20201118T114242
-        (_, self.cca_1_name, self.cca_2_name, bw_Mbps, rtt_ms, queue_p,
-         cca_1_flws, cca_2_flws, end_time, _) = toks
-        # Link bandwidth (Mbps).
-        self.bw_Mbps = float(bw_Mbps[:-2])
-        self.bw_bps = self.bw_Mbps * 1e6
-        # Bottleneck router delay (us).
-        self.rtt_us = float(rtt_ms[:-3]) * 1000
-        # Bandwidth-delay product (bits).
-        self.bdp_b = self.bw_Mbps * self.rtt_us
-        # Queue size (packets).
-        self.queue_p = float(queue_p[:-1])
-        # Queue size (multiples of the BDP).
-        self.queue_bdp = self.queue_p / (self.bdp_b / 8 / 1514)
-        # Number of CCA 1 flows.
-        self.cca_1_flws = int(cca_1_flws[:-(len(self.cca_1_name))])
-        # Number of CCA 2 flows.
-        self.cca_2_flws = int(cca_2_flws[:-(len(self.cca_2_name))])
-        # The total number of flows.
-        self.tot_flws = self.cca_1_flws + self.cca_2_flws
-        # Experiment duration (s).
-        self.dur_s = int(end_time[:-1])
-        # Largest RTT that this experiment should experiment, based on the size
-        # of the bottleneck queue and the RTT.
-        self.calculated_max_rtt_us = (self.queue_bdp + 1) * self.rtt_us
-        # Fair share bandwidth for each flow.
-        self.target_per_flow_bw_Mbps = (
-            self.bw_Mbps / (self.cca_1_flws + self.cca_2_flws))
+        return next(self.iter).tolist()
+
+    def randperm(self, num):
+        """ Returns a random permutation of range(num) as a tensor. """
+        return torch.from_numpy(self.rng.permutation(num))
+
+    def sample(self):
+        """
+        Returns the indices of a single balanced batch as a sorted tensor.
+        The batch contains the same number of examples from each class as the
+        batches produced by iterating over this sampler. The indices are
+        sorted so that gathering them walks through memory in order.
+        """
+        return torch.sort(torch.cat([
+            cls_idxs[self.randperm(cls_idxs.size()[0])[:self.examples_per_cls]]
+            for cls_idxs in self.clss_idxs.values()]))[0]
+
+    def epoch(self):
+        """
+        Returns the batches of one epoch as a list of index tensors. Iterating
+        over this sampler yields these batches as lists.
+        """
+        # Shape: (examples per class, number of classes). Each column is a
+        # random permutation of one class's examples.
+        idxs = torch.stack(
+            [cls_idxs[self.randperm(cls_idxs.size()[0])]
+             for cls_idxs in self.clss_idxs.values()],
+            dim=1)
+        num_clss = idxs.size()[1]
+        num_full = idxs.size()[0] // self.examples_per_cls
+        end_full = num_full * self.examples_per_cls
+        bch_size = self.examples_per_cls * num_clss
+        # Shape: (number of full batches, batch size). Each row is a batch that
+        # contains examples_per_cls examples from each class.
+        full = idxs[:end_full].reshape(num_full, bch_size)
+        # Shuffle the examples within each batch.
+        full = full.gather(
+            1, torch.from_numpy(
+                np.argsort(self.rng.random((num_full, bch_size)), axis=1)))
+        bchs = list(full)
+        if not self.drop_last and end_full < idxs.size()[0]:
+            rem = idxs[end_full:].reshape(-1)
+            bchs.append(rem[self.randperm(rem.size()[0])])
+        return bchs
+
+
+def get_matrix(ldr):
+    """
+    Returns the first batch that the provided DataLoader would produce, as a
+    tuple of the form (dat_in, dat_out), by indexing into its dataset directly
+    instead of collating the batch one example at a time. If the first batch
+    is the entire dataset, then this returns the dataset's tensors without
+    copying them. Used by models that train on a single matrix (e.g., sklearn
+    models).
+    """
+    _, dat_in, dat_out, _ = ldr.dataset.raw(upcast=False)
+    if isinstance(ldr.batch_sampler, BalancedSampler):
+        idxs = ldr.batch_sampler.sample()
+        return (
+            dat_in.index_select(0, idxs).float(),
+            dat_out.index_select(0, idxs))
+    # Slicing creates a view, not a copy. Upcasting a float32 view does not
+    # copy it either.
+    return dat_in[:ldr.batch_size].float(), dat_out[:ldr.batch_size]
+
+
+class BatchLoader:
+    """
+    A replacement for torch.utils.data.DataLoader for Datasets that are stored
+    entirely in memory (i.e., utils.Dataset). Instead of fetching and collating
+    each example of a batch individually, this slices batches out of the
+    dataset's tensors (when not balancing) or gathers them with a single
+    index_select() per batch (when balancing with a BalancedSampler).
+    Exposes the "dataset", "batch_size", and "batch_sampler" attributes of a
+    DataLoader.
+    """
+
+    def __init__(self, dataset, batch_size=None, batch_sampler=None):
+        assert isinstance(dataset, Dataset), \
+            "Dataset must be an instance of utils.Dataset."
+        assert (batch_size is None) != (batch_sampler is None), \
+            "Exactly one of \"batch_size\" and \"batch_sampler\" must be set."
+        if batch_sampler is not None:
+            assert isinstance(batch_sampler, BalancedSampler), \
+                "The batch sampler must be an instance of utils.BalancedSampler."
+        self.dataset = dataset
+        self.batch_size = batch_size
+        self.batch_sampler = batch_sampler
+
+    def __len__(self):
+        if self.batch_sampler is not None:
+            return len(self.batch_sampler)
+        return math.ceil(len(self.dataset) / self.batch_size)
+
+    def __iter__(self):
+        # Look up the tensors every epoch, since Dataset.to() replaces them.
+        # Upcast each batch as it is assembled, so that the whole dataset is
+        # never stored as float32 (see Dataset's storage_dtype).
+        _, dat_in, dat_out, _ = self.dataset.raw(upcast=False)
+        if self.batch_sampler is None:
+            for srt in range(0, dat_in.size()[0], self.batch_size):
+                # Slicing creates a view, not a copy.
+                yield (dat_in[srt:srt + self.batch_size].float(),
+                       dat_out[srt:srt + self.batch_size])
+        else:
+            for idxs in self.batch_sampler.epoch():
+                idxs = idxs.to(dat_in.device)
+                yield (dat_in.index_select(0, idxs).float(),
+                       dat_out.index_select(0, idxs))
 
 
 def args_to_str(args, order, which):
@@ -301,10 +383,18 @@ def str_to_args(args_str, order, which):
             defaults.ARGS_TO_IGNORE_DATA)]
     num_toks = len(toks)
     num_order = len(order)
+    parsed = {}
+    if which == "model":
+        added = [key for key in order if key in defaults.ARGS_ADDED_MODEL]
+        if num_toks == num_order - len(added):
+            # The string predates the arguments in added, so they must have
+            # had their default values.
+            order = [key for key in order if key not in added]
+            num_order = len(order)
+            parsed = {key: defaults.DEFAULTS[key] for key in added}
     assert num_toks == num_order, \
         (f"Mismatched tokens ({num_toks}) and order ({num_order})! "
          "tokens: {toks}, order: {order}")
-    parsed = {}
     for arg, tok in zip(order, toks):
         try:
             parsed_val = float(tok)
@@ -314,233 +404,6 @@ def str_to_args(args_str, order, which):
     return parsed
 
 
-def parse_packets(flp, flw_to_cca):
-    """
-    Parses a PCAP file. Considers packets between a specified client and server
-    using specified ports only.
-
-    Returns a dictionary mapping flow to a tuple containing two lists, one for
-    data packets and one for ACK packets:
-        {
-              (client port, server port) :
-                  ([ list of data packets ], [ list of ACK packets ])
-        }
-
-    Each packet is a tuple of the form:
-         (sequence number, timestamp (us),
-          TCP timestamp option TSval, TCP timestamp option TSecr,
-          TCP payload size (B), total packet size (B))
-    """
-    print(f"\tParsing PCAP: {flp}")
-    # Use list() to read the pcap file all at once (minimize seeks).
-    pkts = list(enumerate(scapy.utils.RawPcapReader(flp)))
-    num_pkts = len(pkts)
-
-    def make_empty():
-        """ Make an empty numpy array to store the packets. """
-        return np.full((num_pkts,), -1, dtype=features.PARSE_PACKETS_FETS)
-
-    def remove_unused_rows(arr):
-        """
-        Returns a filtered array with unused rows removed. A row is unused if
-        all of its columns are -1. As an optimization, we check the second
-        column (timestamp) in each row only because the timestamp should never
-        be unknown because it comes from PCAP.
-        """
-        return arr[arr[features.ARRIVAL_TIME_FET] != -1]
-
-    # Format described above. In this form, the arrays will be sparse. Unused
-    # rows will be removed later.
-    flw_to_pkts = {
-        flw_ports: (make_empty(), make_empty())
-        for flw_ports in flw_to_cca.keys()}
-    for idx, (pkt_dat, pkt_mdat) in pkts:
-        ether = scapy.layers.l2.Ether(pkt_dat)
-        # Assume that this is a TCP/IP packet.
-        ip = ether[scapy.layers.inet.IP]
-        is_tcp = scapy.layers.inet.TCP in ether
-        trans = ether[
-            scapy.layers.inet.TCP if is_tcp else scapy.layers.inet.UDP]
-        # Determine this packet's direction. Assume that the client IP address
-        # if 192.0.0.4 and the server IP address is 192.0.0.2. Assume that all
-        # packets are between the client and server.
-        if ip.src[-1] == "4":
-            dir_idx = 0
-            flw = (trans.sport, trans.dport)
-        else:
-            dir_idx = 1
-            flw = (trans.dport, trans.sport)
-        # Assume that the packets are between the relevent machines. Only check
-        # the ports.
-        if flw in flw_to_pkts:
-            # Decode the sequence number and timestamp info.
-            seq = -1
-            ts = (-1, -1)
-            if is_tcp:
-                seq = trans.seq
-                trans_header_len = trans.dataofs << 2
-                # Decode the TCP Timestamp option.
-                if (len(trans.options) >= 3 and
-                        trans.options[2][0] == "Timestamp"):
-                    # Fast path: it is usually the third option.
-                    ts = trans.options[2][1]
-                else:
-                    # Slow path: check all of the options.
-                    for option_name, option in trans.options:
-                        if option_name == "Timestamp":
-                            ts = option
-                            break
-            else:
-                # Start with the UDP header size.
-                trans_header_len = 8
-                cca = flw_to_cca[flw]
-                if cca == "copa":
-                    # Add the Copa header size to the UDP header size.
-                    trans_header_len += defaults.COPA_HEADER_SIZE_B
-                    # The Copa header is the first part of the UDP payload.
-                    #     int seq_num;
-	                #     int flow_id;
-	                #     int src_id;
-	                #     double sender_timestamp;  // milliseconds
-	                #     double receiver_timestamp;  // milliseconds
-                    seq, _, _, sender_ts, receiver_ts = struct.unpack(
-                        defaults.COPA_HEADER_FMT,
-                        # Convert the transport payload to bytes and then select
-                        # the Copa header only.
-                        bytes(trans.payload)[:defaults.COPA_HEADER_SIZE_B])
-                    if seq == -1:
-                        # This is a connection-establishment packet. Skip it.
-                        continue
-                    # Convert from milliseconds to microsecods and then convert
-                    # from a double to an int.
-                    ts = (
-                        int(round(sender_ts * 1000)),
-                        int(round(receiver_ts * 1000)))
-
-                    # Furthermore, the Copa packet data includes:
-                    #     Time sent_time;
-                    #     Time intersend_time;
-                    #     Time intersend_time_vel;
-                    #     Time rtt;
-                    #     double prev_avg_sending_rate;
-                    # These may be of use.
-                elif cca == "vivace":
-                    # PCC Vivace is based on UDT: UDP-based Data Transfer
-                    # Protocol.
-                    #
-                    # See https://tools.ietf.org/pdf/draft-gg-udt-03.pdf
-                    trans_header_len += 16
-                    payload = bytes(trans.payload)
-                    first = int.from_bytes(payload[:4], byteorder="big")
-                    if (first & 0x80000000) >> 31:
-                        # Type code of 1 = UDT control packet.
-                        if dir_idx == 0:
-                            # Client -> server control packet. Skip it.
-                            continue
-                        if (first & 0x7fff0000) >> 16 == 2:
-                            # ACK.
-                            trans_header_len += 24
-                            seq = int.from_bytes(
-                                payload[16:20], byteorder="big")
-                            ts = (
-                                # UDT ACKs contain the RTT, so extract that as
-                                # the first ts value.
-                                int.from_bytes(
-                                    payload[20:24], byteorder="big"),
-                                # The second ts field is unused.
-                                -1)
-                        else:
-                            # One of the other seven types of control
-                            # packets. Skip it.
-                            continue
-                    else:
-                        # Type code of 0 = UDT data packet.
-                        seq = first & 0x7fffffff
-
-            flw_to_pkts[flw][dir_idx][idx] = (
-                # Sequence number.
-                seq,
-                # Timestamp. Not using parse_time_us for efficiency purpose. Use
-                # 1000000 instead of 1e6 to avoid converting floats.
-                pkt_mdat.sec * 1000000 + pkt_mdat.usec,
-                # Timestamp option.
-                ts[0],
-                ts[1],
-                # Transport payload. Length of the IP packet minus the length of
-                # the IP header minus the length of the transport header.
-                ip.len - (ip.ihl << 2) - trans_header_len,
-                # Total packet size.
-                pkt_mdat.wirelen)
-
-    # Remove unused rows.
-    for flw in flw_to_pkts.keys():
-        data, ack = flw_to_pkts[flw]
-        flw_to_pkts[flw] = (remove_unused_rows(data), remove_unused_rows(ack))
-
-    # Verify packet count.
-    tot_pkts = sum(sum(
-        ((dat_pkts.shape[0], ack_pkts.shape[0])
-         for dat_pkts, ack_pkts in flw_to_pkts.values()),
-        ()))
-    assert tot_pkts <= num_pkts, \
-        f"Found more packets than exist ({tot_pkts} > {num_pkts}): {flp}"
-    discarded_pkts = num_pkts - tot_pkts
-    print(
-        f"\tDiscarded packets: {discarded_pkts} "
-        f"({discarded_pkts / num_pkts * 100:.2f}%)")
-
-    return flw_to_pkts
-
-
-def parse_q_stats(line):
-    """
-    Parses a "stats" line of a BESS queue log. Line should be of the form:
-        ( "stats", src port, enqueued, dequeued, dropped )
-    """
-    return (
-        ("stats",) +
-        tuple(
-            int(tok, 16) if tok.startswith("0x") else int(tok)
-            for tok in line.split(":")[1].split(",")))
-
-
-def parse_q_enq_deq(line):
-    """
-    Parses a packet log line of a BESS queue log. Line should be of the form:
-        ( "enq" or "deq", time ns, src port, seq, payload B, qsize, dropped,
-          queued, batch size )
-    """
-    (event, time_ns, src_port, seq, payload_B, qsize, dropped, queued,
-     batch_size) = [
-         int(tok, 16) if tok.startswith("0x") else int(tok)
-         for tok in line.split(",")]
-
-    event_options = {0, 1}
-    assert event in event_options, f"Event \"{event}\" not in {event_options}"
-    if event == 0:
-        event = "enq"
-    else:
-        event = "deq"
-
-    return (
-        event, time_ns / 1e3, src_port, seq, payload_B, qsize, dropped, queued,
-        batch_size)
-
-
-def parse_queue_log(flp):
-    """
-    Parses the BESS queue log. Returns a list of tuples. See parse_q_stats() and
-    parse_q_enq_deq() for details on the tuple format.
-    """
-    print(f"\tParsing queue log: {flp}")
-    with open(flp, "r") as fil:
-        q_log = list(fil)
-    return [
-        parse_q_stats(line) if line.startswith("stats")
-        else parse_q_enq_deq(line)
-        for line in q_log if line.strip() != ""]
-
-
 def scale(val, min_in, max_in, min_out, max_out):
     """
     Scales val, which is from the range [min_in, max_in], to the range
@@ -561,7 +424,8 @@ def scale_all(dat, scl_prms, min_out, max_out, standardize):
     num_scl_prms = len(scl_prms)
     assert len(fets) == num_scl_prms, \
         (f"Mismatching dtype ({fets}) and number of scale parameters "
-         f"({num_scl_prms})!")
+         f"({num_scl_prms})! The scaling parameters may be from a model "
+         "that was trained with an older version of features.FEATURES.")
     new = np.empty(dat.shape, dtype=dat_dtype)
     for idx, fet in enumerate(fets):
         prm_1, prm_2 = scl_prms[idx]
@@ -578,7 +442,7 @@ def load_exp(flp, msg=None):
     Loads one experiment results file (as generated by gen_features.py).
     """
     print(f"{'' if msg is None else f'{msg} - '}Parsing: {flp}")
-    exp = Exp(flp)
+    exp = parse_utils.Exp(flp)
     try:
         with np.load(flp, allow_pickle=True) as fil:
             num_files = len(fil.files)
@@ -647,150 +511,12 @@ def get_class_popularity(dat, classes):
     return [(dat == cls).sum() for cls in classes]
 
 
-def safe_mathis_label(tput_true, tput_mathis):
-    """
-    Returns the Mathis model label based on the true throughput and
-    Mathis model fair throughput. If either component value is -1
-    (unknown), then the resulting label is -1 (unknown).
-    """
-    return (
-        -1 if tput_true == -1 or tput_mathis == -1 else
-        int(tput_true > tput_mathis))
-
-
-def safe_min(val1, val2):
-    """
-    Safely computes the min of two values. If either value is -1 or 0,
-    then that value is discarded and the other value becomes the
-    min. If both values are discarded, then the min is -1 (unknown).
-    """
-    return (
-        -1 if val1 in UNSAFE and val2 in UNSAFE else (
-            val2 if val1 in UNSAFE else (
-                val1 if val2 in UNSAFE else (
-                    min(val1, val2)))))
-
-
-def safe_add(val1, val2):
-    """
-    Safely adds two values. If either value is -1, then the
-    result is -1 (unknown).
-    """
-    return -1 if val1 == -1 or val2 == -1 else val1 + val2
-
-
-def safe_sub(val1, val2):
-    """
-    Safely subtracts two values. If either value is -1, then the
-    result is -1 (unknown).
-    """
-    return -1 if val1 == -1 or val2 == -1 else val1 - val2
-
-
-def safe_mul(val1, val2):
-    """
-    Safely multiplies two values. If either value is -1, then the
-    result is -1 (unknown).
-    """
-    return -1 if val1 == -1 or val2 == -1 else val1 * val2
-
-
-def safe_div(num, den):
-    """
-    Safely divides two values. If either value is -1 or the denominator is 0,
-    then the result is -1 (unknown).
-    """
-    return -1 if num == -1 or den in UNSAFE else num / den
-
-
-def safe_np_div(num_arr, den):
-    """
-    Safely divides a 1D numpy array by a scalar. If an entry in the numerator
-    array is -1 (unknown), then that entry in the output array is -1. If the
-    denominator scalar is -1, then all entries in the output array are -1.
-    """
-    assert num_arr.size == num_arr.shape[0], \
-        f"Array is not 1D: {num_arr.shape}"
-
-    out = np.full_like(num_arr, -1)
-    if den == -1:
-        return out
-    # Popular known entries.
-    mask = num_arr == -1
-    out[mask] = num_arr[mask] / den
-    return out
-
-
-def safe_sqrt(val):
-    """
-    Safely calculates the square root of a value. If the value is -1 (unknown),
-    then the result is -1 (unknown).
-    """
-    return -1 if val == -1 else math.sqrt(val)
-
-
-def safe_abs(val):
-    """
-    Safely calculates the absolute value of a value. If the value is -1
-    (unknown), then the result is -1 (unknown).
-    """
-    return -1 if val == -1 else abs(val)
-
-
-def get_safe(dat, start_idx=None, end_idx=None):
-    """
-    Returns a filtered window between the two specified indices, with all
-    unknown values (-1) removed.
-    """
-    if start_idx is None:
-        start_idx = 0
-    if end_idx is None:
-        end_idx = 0 if dat.shape[0] == 0 else dat.shape[0] - 1
-    # Extract the window.
-    dat_win = dat[start_idx:end_idx + 1]
-    # Eliminate values that are -1 (unknown).
-    return dat_win[dat_win != -1]
-
-
-def safe_sum(dat, start_idx=None, end_idx=None):
-    """
-    Safely calculates a sum over a window. Any values that are -1
-    (unknown) are discarded. The sum of an empty window is -1 (unknown).
-    """
-    dat_safe = get_safe(dat, start_idx, end_idx)
-    # If the window is empty, then the mean is -1 (unknown).
-    return -1 if dat_safe.shape[0] == 0 else np.sum(dat_safe)
-
-
-def safe_mean(dat, start_idx=None, end_idx=None):
-    """
-    Safely calculates a mean over a window. Any values that are -1
-    (unknown) are discarded. The mean of an empty window is -1
-    (unknown).
-    """
-    dat_safe = get_safe(dat, start_idx, end_idx)
-    # If the window is empty, then the mean is -1 (unknown).
-    return -1 if dat_safe.shape[0] == 0 else np.mean(dat_safe)
-
-
-def safe_update_ewma(prev_ewma, new_val, alpha):
-    """
-    Safely updates an exponentially weighted moving average. If the previous
-    EWMA is -1 (unknown), then the new EWMA is assumed to be the unweighted new
-    value. If the new value is unknown, then the EWMA does not change.
-    """
-    return (
-        new_val if prev_ewma == -1
-        else (
-            prev_ewma if new_val == -1
-            else alpha * new_val + (1 - alpha) * prev_ewma))
-
-
 def filt(dat_in, dat_out, dat_extra, scl_grps, num_sims, prc):
     """
     Filters parsed data based on a desired number of simulations and percent of
     results from each simulation. Each dat_* is a Python list, where each entry
-    is a Numpy array containing the results of one simulation.
+    is a Numpy array containing the results of one simulation. The rows picked
+    from each simulation depend only on the simulation's index.
     """
     assert (
         len(dat_in) >= num_sims and
@@ -806,8 +532,8 @@ def filt(dat_in, dat_out, dat_extra, scl_grps, num_sims, prc):
     if prc != 100:
         for idx in range(num_sims):
             num_rows = dat_in[idx].shape[0]
-            idxs = np.random.random_integers(
-                0, num_rows - 1, math.ceil(num_rows * prc / 100))
+            idxs = rand.get("filt", exp=idx).integers(
+                0, num_rows, math.ceil(num_rows * prc / 100))
             dat_in[idx] = dat_in[idx][idxs]
             dat_out[idx] = dat_out[idx][idxs]
             dat_extra[idx] = dat_extra[idx][idxs]
@@ -820,8 +546,12 @@ def save_parsed_data(flp, trn, val, tst):
     one simulation.
     """
     print(f"Saving data: {flp}")
+    # Multiple processes may generate the same data concurrently, so write to a
+    # temporary file and then atomically move it into place. This guarantees
+    # that readers never see a partially-written file.
+    tmp_flp = f"{flp}.{os.getpid()}.tmp.npz"
     np.savez_compressed(
-        flp,
+        tmp_flp,
         train_in=trn[0],
         train_out=trn[1],
         train_extra=trn[2],
@@ -831,12 +561,13 @@ def save_parsed_data(flp, trn, val, tst):
         test_in=tst[0],
         test_out=tst[1],
         test_extra=tst[2])
+    os.replace(tmp_flp, flp)
 
 
 def load_parsed_data(flp):
     """ Loads parsed data. """
     print(f"Loading data: {flp}")
-    with np.load(flp) as fil:
+    with np.load(flp, max_header_size=defaults.NPY_MAX_HEADER_B) as fil:
         splits = [
             (fil[f"{split}_in"], fil[f"{split}_out"], fil[f"{split}_extra"])
             for split in ["train", "val", "test"]]
@@ -860,7 +591,7 @@ def save_tmp_file(flp, dat_in, dat_out, dat_extra, scl_grps):
 def load_tmp_file(flp):
     """ Loads and deletes a single-experiment temporary results file. """
     print(f"Loading temporary data: {flp}")
-    with np.load(flp) as fil:
+    with np.load(flp, max_header_size=defaults.NPY_MAX_HEADER_B) as fil:
         dat_in = fil["dat_in"]
         dat_out = fil["dat_out"]
         dat_extra = fil["dat_extra"]
@@ -907,7 +638,8 @@ def get_npz_headers(flp):
         """ Decodes the header information of a single NPY file. """
         npy = archive.open(name)
         version = np.lib.format.read_magic(npy)
-        shape, _, dtype = np.lib.format._read_array_header(npy, version)
+        shape, _, dtype = np.lib.format._read_array_header(
+            npy, version, max_header_size=defaults.NPY_MAX_HEADER_B)
         return [name[:-4], shape, dtype]
 
     with zipfile.ZipFile(flp) as archive:
@@ -917,7 +649,11 @@ def get_npz_headers(flp):
 
 
 def set_rand_seed(seed=defaults.SEED):
-    """ Sets the Python, numpy, and Torch random seeds to seed. """
+    """
+    Sets the Python, numpy, and Torch random seeds, and the seed of the
+    counter-based streams in rand.py, to seed.
+    """
+    rand.set_seed(seed)
     random.seed(seed)
     np.random.seed(seed)
     torch.manual_seed(seed)
@@ -954,6 +690,14 @@ def get_split_data_flp(split_dir, name):
     return path.join(split_dir, f"{name}.npy")
 
 
+def get_split_frames_flp(split_dir, name):
+    """
+    Returns the path to the compressed data (see frames.py) for a Split with
+    the provided name, which stores its data in the provided directory.
+    """
+    return path.join(split_dir, f"{name}.zst")
+
+
 def get_split_metadata_flp(split_dir, name):
     """
     Returns the path to the metadata for a Split with the provided name, which
@@ -1001,10 +745,98 @@ def load_scl_prms(out_dir):
         return json.load(fil)
 
 
-def load_split(split_dir, name):
+def advise(dat, access):
+    """
+    Tells the kernel how the provided np.memmap will be accessed, which
+    determines how aggressively it reads ahead:
+        "sequential": Scanned in order. Reads ahead aggressively and drops
+            pages soon after they are read.
+        "random": A small fraction of the rows are gathered in random order.
+            Disables readahead, so that each access reads only the page it
+            needs. Do not use this if most pages will be touched (e.g., when
+            shuffling), since readahead then still helps.
+        "willneed": Will be read in its entirety soon. Starts reading the
+            whole file into the page cache in the background.
+        None: The kernel's default.
+    """
+    advice = {
+        "sequential": mmap.MADV_SEQUENTIAL, "random": mmap.MADV_RANDOM,
+        "willneed": mmap.MADV_WILLNEED, None: mmap.MADV_NORMAL}
+    assert access in advice, f"Unknown access pattern: {access}"
+    # Slices of an np.memmap keep a reference to the underlying mmap object.
+    mmp = getattr(dat, "_mmap", None)
+    if mmp is not None:
+        mmp.madvise(advice[access])
+
+
+def prefetch(dat, srt, end):
+    """
+    Asks the kernel to start reading rows [srt, end) of the provided np.memmap
+    into the page cache in the background.
+    """
+    mmp = getattr(dat, "_mmap", None)
+    if mmp is None or srt >= end:
+        return
+    # The beginning of the range must be page-aligned, relative to the start
+    # of the mapping.
+    off_B = dat.ctypes.data - np.frombuffer(mmp, dtype=np.uint8).ctypes.data
+    srt_B = off_B + srt * dat.itemsize
+    aligned_B = srt_B - srt_B % mmap.PAGESIZE
+    end_B = min(off_B + end * dat.itemsize, len(mmp))
+    if aligned_B < end_B:
+        mmp.madvise(mmap.MADV_WILLNEED, aligned_B, end_B - aligned_B)
+
+
+def alloc_staging(num, dtype):
+    """
+    Allocates an uninitialized 1D array of num elements of the provided dtype
+    in anonymous memory backed by transparent huge pages (when the kernel
+    allows it), which reduces TLB misses when gathering from large arrays.
+    """
+    size_B = num * np.dtype(dtype).itemsize
+    if size_B == 0:
+        return np.empty((0,), dtype=dtype)
+    mmp = mmap.mmap(-1, size_B)
+    if hasattr(mmap, "MADV_HUGEPAGE"):
+        mmp.madvise(mmap.MADV_HUGEPAGE)
+    return np.frombuffer(mmp, dtype=dtype, count=num)
+
+
+def copy_sequential(srcs, dst, nums=None,
+                    readahead_B=defaults.SPLIT_READAHEAD_B):
+    """
+    Copies the first nums[i] rows (default: all rows) of each of the provided
+    splits (as returned by load_split()) into dst back-to-back. For
+    uncompressed splits, while copying each window of readahead_B bytes, asks
+    the kernel to read the next window, so that disk reads overlap with
+    copying. Compressed splits are decompressed in parallel.
+    """
+    if nums is None:
+        nums = [src.shape[0] for src in srcs]
+    idx = 0
+    for src, num in zip(srcs, nums):
+        if isinstance(src, frames.FrameReader):
+            src.read_into(dst[idx:idx + num])
+            idx += num
+            continue
+        advise(src, "sequential")
+        win = max(1, readahead_B // max(1, src.itemsize))
+        prefetch(src, 0, win)
+        for srt in range(0, num, win):
+            end = min(srt + win, num)
+            prefetch(src, end, end + win)
+            dst[idx + srt:idx + end] = src[srt:end]
+        idx += num
+    return dst
+
+
+def load_split(split_dir, name, access=None):
     """
     Loads a training, validation, and test split's raw data from disk and
-    returns it.
+    returns it. If the split is compressed, then returns a frames.FrameReader,
+    which supports the same indexing as the read-only np.memmap that is
+    returned otherwise. access describes how an uncompressed split will be
+    read (see advise()).
     """
     num_pkts, dtype = load_split_metadata(split_dir, name)
     if num_pkts == 0:
@@ -1013,16 +845,26 @@ def load_split(split_dir, name):
         # numpy ndarray of size 0). Therefore, just return a new empty numpy
         # ndarray.
         return np.zeros((num_pkts,), dtype=dtype)
-    return np.memmap(
+    frames_flp = get_split_frames_flp(split_dir, name)
+    if path.exists(frames_flp):
+        return frames.FrameReader(frames_flp, dtype, num_pkts)
+    dat = np.memmap(
         get_split_data_flp(split_dir, name), dtype=dtype, mode="r",
         shape=(num_pkts,))
+    advise(dat, access)
+    return dat
 
 
-def load_subsplits(split_dir, prefix):
-    """ Loads and returns splits that begin with prefix. """
+def load_subsplits(split_dir, prefix, access=None):
+    """
+    Loads and returns splits that begin with prefix. access describes how the
+    splits will be read (see advise()).
+    """
+    # Sort the names so that the subsplits are concatenated in the same order
+    # regardless of the order in which os.listdir() returns files.
     subsplits = [
-        load_split(split_dir, fil.split("_metadata.")[0])
-        for fil in os.listdir(split_dir)
+        load_split(split_dir, fil.split("_metadata.")[0], access)
+        for fil in sorted(os.listdir(split_dir))
         if fil.startswith(prefix) and fil.endswith(".pickle")]
     assert subsplits, \
         f"No subsplits found with prefix \"{prefix}\" in: {split_dir}"
@@ -1132,7 +974,8 @@ def analyze_feature_importance(net, out_dir, dat_in, dat_out,
         if isinstance(
                 net.net,
                 (feature_selection.RFE,
-                 feature_selection.RFECV)):
+                 feature_selection.RFECV,
+                 rfe.Rfe)):
             # Since the model was trained using RFE, display all
             # features. Sort the features alphabetically.
             top_fets = sorted(
@@ -1213,38 +1056,6 @@ def check_fets(fets, in_spc):
          f"\n\tin_spc ({len(in_spc)}): {in_spc}")
 
 
-def zip_timeseries(xs, ys):
-    """ Zips together multiple timeseries from the same timespace. """
-    assert xs
-    assert ys
-    assert len(xs) == len(ys)
-    for idx in range(len(xs)):
-        assert xs[idx].shape[0] == ys[idx].shape[0]
-
-    idxs = [0] * len(xs)
-    tot = sum(xs_.shape[0] for xs_ in xs)
-    xs_o = np.full((tot,), -1, dtype=xs[0].dtype)
-    ys_o = np.full((tot,), -1, dtype=ys[0].dtype)
-    idx_o = 0
-
-    while idx_o < xs_o.shape[0]:
-        chosen = None
-        earliest = sys.maxsize
-
-        for idx in range(len(xs)):
-            if idxs[idx] < xs[idx].shape[0]:
-                proposed_earliest = xs[idx][idxs[idx]]
-                if proposed_earliest < earliest:
-                    chosen = idx
-                    earliest = proposed_earliest
-        assert chosen is not None, "Ran out of points."
-
-        xs_o[idx_o] = xs[chosen][idxs[chosen]]
-        ys_o[idx_o] = ys[chosen][idxs[chosen]]
-        idx_o += 1
-        idxs[chosen] += 1
-    return xs_o, ys_o
-
 def select_fets(cluster_to_fets, top_fets):
     """
     Selects the most important feature from each cluster in cluster_to_fets,
@@ -1282,33 +1093,3 @@ def select_fets(cluster_to_fets, top_fets):
         "\t)", sep="\n")
     return chosen_fets
 
-
-def find_bound(vals, target, min_idx, max_idx, which):
-    """
-    Returns the first index that is either before or after a particular target.
-    vals must be monotonically increasing.
-    """
-    assert min_idx >= 0
-    assert max_idx >= min_idx
-    assert which in {"before", "after"}
-    if min_idx == max_idx:
-        return min_idx
-
-    bound = min_idx
-    # Walk forward until the target time is in the past.
-    while bound < (max_idx if which == "before" else max_idx - 1):
-        time_us = vals[bound]
-        if time_us == -1 or time_us < target:
-            bound += 1
-        else:
-            break
-
-    if which == "before":
-        # If we walked forward, then walk backward to the last valid time.
-        while bound > min_idx:
-            bound -= 1
-            if vals[bound] != -1:
-                break
-
-    assert min_idx <= bound <= max_idx
-    return bound
@@ -15,6 +15,7 @@ from matplotlib import pyplot as plt
 import numpy as np
 
 import cl_args
+import parse_utils
 import utils
 
 
@@ -28,8 +29,8 @@ def get_avg_tputs(flp):
     """ Returns the average throughput for each flow. """
     with np.load(flp) as fil:
         return (
-            utils.Exp(flp),
-            [utils.safe_mean(fil[flw][TPUT_KEY]) for flw in fil.files])
+            parse_utils.Exp(flp),
+            [parse_utils.safe_mean(fil[flw][TPUT_KEY]) for flw in fil.files])
 
 
 def plot_f1b(flps, var, out_dir):
@@ -81,7 +82,7 @@ def plot_f1c(flps, var, out_dir):
     assert tot_flps == 1, \
         f"This figure uses a single experiment, but {tot_flps} were provided."
     flp = flps[0]
-    sim = utils.Exp(flp)
+    sim = parse_utils.Exp(flp)
     x_vals = np.arange(300 * 1000, dtype=float) / 1000
     with np.load(flp) as fil:
         tot_flws = len(fil.files)